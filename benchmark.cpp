@@ -30,6 +30,7 @@
 
 #include <gbwt/cached_gbwt.h>
 #include <gbwt/dynamic_gbwt.h>
+#include <gbwt/internal.h>
 
 using namespace gbwt;
 
@@ -43,7 +44,7 @@ void printUsage(int exit_code = EXIT_SUCCESS);
 
 void compareIndexes(const GBWT& first, const GBWT& second, const std::string& first_name, const std::string& second_name);
 
-void extendedStatistics(const DynamicGBWT& index);
+void extendedStatistics(const GBWT& index);
 
 std::vector<SearchState> findBenchmark(const GBWT& compressed_index, const DynamicGBWT& dynamic_index, size_type find_queries, size_type pattern_length, std::vector<vector_type>& queries);
 
@@ -54,6 +55,8 @@ void locateBenchmark(const GBWTType& index, const std::vector<SearchState>& quer
 
 void extractBenchmark(const GBWT& compressed_index, const DynamicGBWT& dynamic_index, size_type extract_queries);
 
+void sortBenchmark(const GBWT& index, size_type batch_size);
+
 //------------------------------------------------------------------------------
 
 int
@@ -62,10 +65,10 @@ main(int argc, char** argv)
   if(argc < 2) { printUsage(); }
 
   int c = 0;
-  bool compare = false, find = false, locate = false, extract = false, statistics = false, breakdown = false;
-  size_type find_queries = 0, pattern_length = 0, extract_queries = 0;
+  bool compare = false, find = false, locate = false, extract = false, statistics = false, breakdown = false, sort = false;
+  size_type find_queries = 0, pattern_length = 0, extract_queries = 0, sort_size = 0;
   std::string compare_base;
-  while((c = getopt(argc, argv, "c:f:p:le:sS")) != -1)
+  while((c = getopt(argc, argv, "c:f:p:le:r:sS")) != -1)
   {
     switch(c)
     {
@@ -83,6 +86,9 @@ main(int argc, char** argv)
     case 'e':
       extract = true;
       extract_queries = std::stoul(optarg); break;
+    case 'r':
+      sort = true;
+      sort_size = std::stoul(optarg); break;
     case 's':
       statistics = true;
       break;
@@ -122,6 +128,14 @@ main(int argc, char** argv)
       std::exit(EXIT_FAILURE);
     }
   }
+  if(sort)
+  {
+    if(sort_size == 0)
+    {
+      std::cerr << "benchmark: Number of sequences to sort must be non-zero" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
 
   Version::print(std::cout, tool_name);
   printHeader("Index name"); std::cout << index_base << std::endl;
@@ -170,7 +184,10 @@ main(int argc, char** argv)
     compareIndexes(compressed_index, second_index, index_base, compare_base);
   }
 
-  if(!(find || locate || extract || statistics)) { return 0; }
+  if(statistics) { extendedStatistics(compressed_index); }
+  if(sort) { sortBenchmark(compressed_index, sort_size); }
+
+  if(!(find || locate || extract)) { return 0; }
 
   DynamicGBWT dynamic_index;
   if(!sdsl::load_from_file(dynamic_index, index_base + DynamicGBWT::EXTENSION))
@@ -180,10 +197,6 @@ main(int argc, char** argv)
   }
   printStatistics(dynamic_index, index_base);
 
-  if(statistics) { extendedStatistics(dynamic_index); }
-
-  if(!(find || locate || extract)) { return 0; }
-
   if(find)
   {
     std::vector<vector_type> queries;
@@ -220,6 +233,7 @@ printUsage(int exit_code)
   std::cerr << "  -p N  Use patterns of length N" << std::endl;
   std::cerr << "  -l    Benchmark locate() queries (requires -f)" << std::endl;
   std::cerr << "  -e N  Benchmark N extract() queries" << std::endl;
+  std::cerr << "  -r N  Benchmark sorting N sequences by the next node during construction" << std::endl;
   std::cerr << "  -s    Print extended statistics" << std::endl;
   std::cerr << "  -S    Write size breakdown to index_base.html" << std::endl;
   std::cerr << std::endl;
@@ -282,12 +296,12 @@ compareIndexes(const GBWT& first, const GBWT& second, const std::string& first_n
 
 void
 printStatistics(const std::string& header, const std::map<size_type, size_type>& distribution,
-                size_type endmarker, size_type total, size_type n)
+                size_type endmarker, size_type total, size_type n, bool print_endmarker = true)
 {
   std::cout << header << std::endl;
   printHeader("Total"); std::cout << total << std::endl;
   printHeader("Average"); std::cout << (total / static_cast<double>(n)) << std::endl;
-  printHeader("Endmarker"); std::cout << endmarker << std::endl;
+  if(print_endmarker) { printHeader("Endmarker"); std::cout << endmarker << std::endl; }
 
   double multiplier = 0.0;
   auto iter = distribution.begin();
@@ -315,30 +329,23 @@ printStatistics(const std::string& header, const std::map<size_type, size_type>&
 }
 
 void
-extendedStatistics(const DynamicGBWT& index)
+extendedStatistics(const GBWT& index)
 {
   if(index.effective() < 2) { return; }
 
-  std::map<size_type, size_type> run_distribution, outdegree_distribution;
-  size_type endmarker_runs = 0, endmarker_outdegree = 0;
-  size_type total_runs = 0, total_outdegree = 0;
+  double start = readTimer();
+  GBWTStatistics stats(index);
+  double seconds = readTimer() - start;
 
-  {
-    const DynamicRecord& endmarker = index.record(ENDMARKER);
-    endmarker_runs = endmarker.runs();
-    endmarker_outdegree = endmarker.outdegree();
-  }
-  for(comp_type comp = 1; comp < index.effective(); comp++)
-  {
-    const DynamicRecord& record = index.record(index.toNode(comp));
-    run_distribution[record.runs()]++;
-    outdegree_distribution[record.outdegree()]++;
-    total_runs += record.runs();
-    total_outdegree += record.outdegree();
-  }
+  printHeader("Statistics"); std::cout << stats.records << " records in " << seconds << " seconds" << std::endl;
+  printHeader("Samples"); std::cout << stats.samples << " in " << stats.sampled_records << " records (one per " << stats.sampleInterval() << " positions)" << std::endl;
+  std::cout << std::endl;
 
-  printStatistics("Runs", run_distribution, endmarker_runs, total_runs, index.effective() - 1);
-  printStatistics("Outdegrees", outdegree_distribution, endmarker_outdegree, total_outdegree, index.effective() - 1);
+  printStatistics("Runs", stats.runs, stats.endmarker_runs, stats.total_runs, stats.records);
+  printStatistics("Outdegrees", stats.outdegrees, stats.endmarker_outdegree, stats.total_outdegree, stats.records);
+  printStatistics("Record lengths", stats.sizes, stats.endmarker_size, stats.total_size, stats.records);
+  printStatistics("Record bytes", stats.bytes, stats.endmarker_bytes, stats.total_bytes, stats.records);
+  printStatistics("Run lengths", stats.run_lengths, 0, stats.total_size, stats.total_runs, false);
 }
 
 //------------------------------------------------------------------------------
@@ -365,6 +372,7 @@ generateQueries(const DynamicGBWT& index, size_type find_queries, size_type patt
 }
 
 std::string indexType(const GBWT&) { return "Compressed GBWT"; }
+std::string indexType(const CachedGBWT&) { return "Cached GBWT"; }
 std::string indexType(const DynamicGBWT&) { return "Dynamic GBWT"; }
 
 //------------------------------------------------------------------------------
@@ -449,6 +457,66 @@ bidirectionalBenchmark(const GBWTType& index, const std::vector<vector_type>& qu
   return total_size;
 }    
 
+// Run the queries in lockstep, extending all active states with one batch per step.
+template<class GBWTType>
+std::vector<BidirectionalState>
+batchedBidirectionalSearch(const GBWTType& index, const std::vector<vector_type>& queries)
+{
+  std::vector<BidirectionalState> states(queries.size());
+  for(size_type i = 0; i < queries.size(); i++)
+  {
+    if(queries[i].empty()) { continue; }
+    states[i] = index.bdFind(queries[i][queries[i].size() / 2]);
+  }
+
+  std::vector<BidirectionalExtension> requests;
+  std::vector<size_type> query_ids;
+  for(bool backward : { false, true })
+  {
+    for(size_type step = 1; ; step++)
+    {
+      requests.clear(); query_ids.clear();
+      for(size_type i = 0; i < queries.size(); i++)
+      {
+        if(states[i].empty()) { continue; }
+        size_type midpoint = queries[i].size() / 2;
+        if(backward && step <= midpoint)
+        {
+          requests.emplace_back(states[i], queries[i][midpoint - step], true);
+          query_ids.push_back(i);
+        }
+        else if(!backward && midpoint + step < queries[i].size())
+        {
+          requests.emplace_back(states[i], queries[i][midpoint + step], false);
+          query_ids.push_back(i);
+        }
+      }
+      if(requests.empty()) { break; }
+      index.bdExtend(requests);
+      for(size_type j = 0; j < requests.size(); j++) { states[query_ids[j]] = requests[j].state; }
+    }
+  }
+
+  return states;
+}
+
+template<class GBWTType>
+size_type
+batchedBidirectionalBenchmark(const GBWTType& index, const std::vector<vector_type>& queries)
+{
+  double start = readTimer();
+  size_type total_length = 0, total_size = 0;
+  std::vector<BidirectionalState> results = batchedBidirectionalSearch(index, queries);
+  for(size_type i = 0; i < queries.size(); i++)
+  {
+    total_length += queries[i].size();
+    total_size += results[i].size();
+  }
+  double seconds = readTimer() - start;
+  printTimeLength(indexType(index), queries.size(), total_length, seconds);
+  return total_size;
+}
+
 void
 bidirectionalBenchmark(const GBWT& compressed_index, const DynamicGBWT& dynamic_index, const std::vector<vector_type>& queries)
 {
@@ -466,6 +534,25 @@ bidirectionalBenchmark(const GBWT& compressed_index, const DynamicGBWT& dynamic_
 
   std::cout << "Found " << queries.size() << " ranges of total length " << compressed_length << std::endl;
   std::cout << std::endl;
+
+  std::cout << "Batched bidirectional benchmarks:" << std::endl;
+
+  CachedGBWT cached_index(compressed_index);
+  size_type batched_lengths[3] =
+  {
+    batchedBidirectionalBenchmark(compressed_index, queries),
+    batchedBidirectionalBenchmark(cached_index, queries),
+    batchedBidirectionalBenchmark(dynamic_index, queries)
+  };
+  for(size_type batched_length : batched_lengths)
+  {
+    if(batched_length != compressed_length)
+    {
+      std::cerr << "bidirectionalBenchmark(): Batched search total length mismatch: "
+                << batched_length << " vs. " << compressed_length << std::endl;
+    }
+  }
+  std::cout << std::endl;
 }
 
 //------------------------------------------------------------------------------
@@ -543,3 +630,80 @@ extractBenchmark(const GBWT& compressed_index, const DynamicGBWT& dynamic_index,
 }
 
 //------------------------------------------------------------------------------
+
+/*
+  Create a batch of sequences in the state sortSequences() sees them during construction:
+  sorted by curr, with the offset being rank(next) within the record. The sequences cover
+  consecutive positions in the index, starting from the first real node.
+*/
+
+std::vector<Sequence>
+getSortBatch(const GBWT& index, size_type batch_size)
+{
+  std::vector<Sequence> result;
+  result.reserve(std::min(batch_size, index.size()));
+  for(comp_type comp = 1; comp < index.effective() && result.size() < batch_size; comp++)
+  {
+    node_type curr = index.toNode(comp);
+    CompressedRecord record = index.record(curr);
+    if(record.outdegree() == 0) { continue; }
+    std::vector<size_type> ranks(record.outdegree(), 0);
+    for(CompressedRecordIterator iter(record); !(iter.end()) && result.size() < batch_size; ++iter)
+    {
+      for(size_type i = 0; i < iter->second && result.size() < batch_size; i++)
+      {
+        Sequence seq;
+        seq.id = result.size(); seq.curr = curr; seq.next = record.successor(iter->first);
+        seq.offset = ranks[iter->first]; ranks[iter->first]++;
+        result.push_back(seq);
+      }
+    }
+  }
+  return result;
+}
+
+template<class Sorter>
+void
+sortBenchmark(const std::string& name, const std::vector<Sequence>& batch, std::vector<size_type>& order, const Sorter& sorter)
+{
+  std::vector<Sequence> seqs = batch;
+  double start = readTimer();
+  sorter(seqs);
+  double seconds = readTimer() - start;
+  printHeader(name);
+  std::cout << seqs.size() << " sequences in " << seconds << " seconds ("
+            << (inMicroseconds(seconds) / seqs.size()) << " µs/sequence)" << std::endl;
+
+  std::vector<size_type> result(seqs.size());
+  for(size_type i = 0; i < seqs.size(); i++) { result[i] = seqs[i].id; }
+  if(order.empty()) { order.swap(result); }
+  else if(result != order)
+  {
+    std::cerr << "sortBenchmark(): " << name << " produced a different order" << std::endl;
+  }
+}
+
+void
+sortBenchmark(const GBWT& index, size_type batch_size)
+{
+  std::vector<Sequence> batch = getSortBatch(index, batch_size);
+  if(batch.empty()) { return; }
+
+  std::cout << "Sorting benchmarks (" << omp_get_max_threads() << " threads):" << std::endl;
+  std::vector<size_type> order;
+  sortBenchmark("Sequential", batch, order, [](std::vector<Sequence>& seqs)
+  {
+    sequentialSort(seqs.begin(), seqs.end());
+  });
+  sortBenchmark("Parallel", batch, order, [](std::vector<Sequence>& seqs)
+  {
+    parallelQuickSort(seqs.begin(), seqs.end());
+  });
+  sortBenchmark("Radix", batch, order, [](std::vector<Sequence>& seqs)
+  {
+    SequenceRadixSort::sort(seqs);
+  });
+  std::cout << std::endl;
+}
+
+//------------------------------------------------------------------------------
@@ -46,6 +46,7 @@ const size_type QUERIES      = 20000;
 const size_type QUERY_LENGTH = 60;
 
 void printUsage(int exit_code = EXIT_SUCCESS);
+void reportConstruction(size_type input_size, double start, size_type start_memory);
 
 std::vector<SearchState> verifyFind(const GBWT& compressed_index, const DynamicGBWT& dynamic_index, const std::string& query_base, std::vector<vector_type>& queries);
 void verifyBidirectional(const GBWT& compressed_index, const DynamicGBWT& dynamic_index, const std::vector<vector_type>& queries, const std::vector<SearchState>& find_results);
@@ -62,25 +63,32 @@ main(int argc, char** argv)
 
   size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE / MILLION, sample_interval = DynamicGBWT::SAMPLE_INTERVAL;
   bool verify_index = false, both_orientations = false, build_index = true;
-  bool build_from_parse = false, skip_overlaps = false, check_overlaps = false;
+  bool build_from_parse = false, skip_overlaps = false, check_overlaps = false, build_external = false, build_bulk = false;
+  size_type contig_jobs = 0, memory_budget = 0;
   std::string index_base, output_base;
   std::set<std::string> phasing_files;
   std::vector<std::string> input_files;
   int c = 0;
-  while((c = getopt(argc, argv, "b:cfF:i:lL:o:pP:rs:Sv")) != -1)
+  while((c = getopt(argc, argv, "b:BcefF:i:j:lL:M:o:pP:rs:Sv")) != -1)
   {
     switch(c)
     {
     case 'b':
       batch_size = std::stoul(optarg); break;
+    case 'B':
+      build_bulk = true; break;
     case 'c':
       check_overlaps = true; break;
+    case 'e':
+      build_external = true; break;
     case 'f':
       both_orientations = false; break;
     case 'F':
       readRows(optarg, input_files, true); break;
     case 'i':
       index_base = optarg; break;
+    case 'j':
+      contig_jobs = std::stoul(optarg); break;
     case 'l':
       build_index = false; break;
     case 'L':
@@ -90,6 +98,8 @@ main(int argc, char** argv)
         phasing_files.insert(rows.begin(), rows.end());
       }
       break;
+    case 'M':
+      memory_budget = std::stoul(optarg); break;
     case 'o':
       output_base = optarg; break;
     case 'p':
@@ -120,6 +130,21 @@ main(int argc, char** argv)
     std::cerr << "build_gbwt: Verification only works with indexes for a single non-parse file" << std::endl;
     verify_index = false;
   }
+  if(contig_jobs > 0 && !(build_from_parse && index_base.empty()))
+  {
+    std::cerr << "build_gbwt: Concurrent construction only works when building a new index from VCF parses" << std::endl;
+    contig_jobs = 0;
+  }
+  if(build_external && !(index_base.empty() && !build_from_parse))
+  {
+    std::cerr << "build_gbwt: Direct construction only works when building a new index from texts" << std::endl;
+    build_external = false;
+  }
+  if(build_bulk && !(index_base.empty() && !build_from_parse && !build_external))
+  {
+    std::cerr << "build_gbwt: Bulk construction only works when building a new index from texts without -e" << std::endl;
+    build_bulk = false;
+  }
   if(!build_index && !verify_index)
   {
     std::cerr << "build_gbwt: Index can only be loaded for verification" << std::endl;
@@ -136,19 +161,59 @@ main(int argc, char** argv)
     std::cout << " (VCF parses";
     if(check_overlaps) { std::cout << "; checking overlaps"; }
     if(skip_overlaps) { std::cout << "; skipping overlaps"; }
+    if(contig_jobs > 0) { std::cout << "; " << contig_jobs << " concurrent contigs"; }
+    if(memory_budget > 0) { std::cout << "; memory budget " << memory_budget << " GB"; }
     if(!(phasing_files.empty())) { std::cout << "; using " << phasing_files.size() << " phasing files"; }
     std::cout << ")";
   }
   std::cout << std::endl;
   printHeader("Output name"); std::cout << output_base << std::endl;
+  if(build_external) { printHeader("Construction"); std::cout << "direct in external memory" << std::endl; }
+  if(build_bulk) { printHeader("Construction"); std::cout << "bulk in memory" << std::endl; }
   if(batch_size != 0) { printHeader("Batch size"); std::cout << batch_size << " million" << std::endl; }
   printHeader("Orientation"); std::cout << (both_orientations ? "both" : "forward only") << std::endl;
   printHeader("Sample interval"); std::cout << sample_interval << std::endl;
   std::cout << std::endl;
 
-  if(build_index)
+  if(build_index && (contig_jobs > 0 || build_external || build_bulk))
+  {
+    double start = readTimer();
+    size_type start_memory = memoryUsage();
+
+    GBWT index;
+    if(contig_jobs > 0)
+    {
+      ContigParameters parameters
+      {
+        batch_size * MILLION, sample_interval,
+        both_orientations, check_overlaps, skip_overlaps,
+        phasing_files
+      };
+      for(const std::string& input_base : input_files) { printHeader("Input name"); std::cout << input_base << std::endl; }
+      std::cout << std::endl;
+      index = buildContigs(input_files, parameters, contig_jobs, memory_budget * GIGABYTE);
+    }
+    else if(build_external)
+    {
+      index = buildExternal(input_files, both_orientations, sample_interval, batch_size * MILLION);
+    }
+    else
+    {
+      index = buildBulk(input_files, both_orientations, sample_interval);
+    }
+    if(!sdsl::store_to_file(index, gbwt_name))
+    {
+      std::cerr << "build_gbwt: Cannot write the index to " << gbwt_name << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    printStatistics(index, output_base);
+
+    reportConstruction(index.size(), start, start_memory);
+  }
+  else if(build_index)
   {
     double start = readTimer();
+    size_type start_memory = memoryUsage();
 
     // Load the index and determine whether we should use sample/contig/path names.
     // We assume that each VCF parse adds new contigs for the same samples.
@@ -282,18 +347,16 @@ main(int argc, char** argv)
       }
     }
 
-    if(!sdsl::store_to_file(dynamic_index, gbwt_name))
+    // Compress the index while releasing the dynamic records.
+    GBWT index(std::move(dynamic_index));
+    if(!sdsl::store_to_file(index, gbwt_name))
     {
       std::cerr << "build_gbwt: Cannot write the index to " << gbwt_name << std::endl;
       std::exit(EXIT_FAILURE);
     }
-    printStatistics(dynamic_index, output_base);
-
-    double seconds = readTimer() - start;
+    printStatistics(index, output_base);
 
-    std::cout << "Indexed " << input_size << " nodes in " << seconds << " seconds (" << (input_size / seconds) << " nodes/second)" << std::endl;
-    std::cout << "Memory usage " << inGigabytes(memoryUsage()) << " GB" << std::endl;
-    std::cout << std::endl;
+    reportConstruction(input_size, start, start_memory);
   }
 
   if(verify_index)
@@ -344,12 +407,16 @@ printUsage(int exit_code)
 
   std::cerr << "Usage: build_gbwt [options] input1 [input2 ...]" << std::endl;
   std::cerr << "  -b N  Insert in batches of N million nodes (default: " << (DynamicGBWT::INSERT_BATCH_SIZE / MILLION) << ")" << std::endl;
+  std::cerr << "  -B    Build the compressed index directly by sorting the prefixes in memory" << std::endl;
   std::cerr << "  -c    Check for overlapping variants in haplotypes (use with -p)" << std::endl;
+  std::cerr << "  -e    Build the compressed index directly using external memory sorting" << std::endl;
   std::cerr << "  -f    Index the sequences only in forward orientation (default)" << std::endl;
   std::cerr << "  -F X  Read a list of input files from X, one file per line (no input1 needed; may repeat)" << std::endl;
   std::cerr << "  -i X  Insert the sequences into an existing index with base name X" << std::endl;
+  std::cerr << "  -j N  Build up to N contigs concurrently and merge them (use with -p)" << std::endl;
   std::cerr << "  -l    Load an existing index instead of building it" << std::endl;
   std::cerr << "  -L X  Read a list of phasing files from X, one file per line (use with -p; may repeat)" << std::endl;
+  std::cerr << "  -M N  Memory budget of N GB for concurrent construction (use with -j; default: none)" << std::endl;
   std::cerr << "  -o X  Use base name X for output (default: the only input)" << std::endl;
   std::cerr << "  -p    The input is a parsed VCF file" << std::endl;
   std::cerr << "  -P X  Only use the phasing information in file X (use with -p; may repeat)" << std::endl;
@@ -362,6 +429,20 @@ printUsage(int exit_code)
   std::exit(exit_code);
 }
 
+void
+reportConstruction(size_type input_size, double start, size_type start_memory)
+{
+  double seconds = readTimer() - start;
+
+  std::cout << "Indexed " << input_size << " nodes in " << seconds << " seconds (" << (input_size / seconds) << " nodes/second)" << std::endl;
+  std::cout << "Memory usage " << inGigabytes(memoryUsage()) << " GB (" << inGigabytes(start_memory) << " GB before construction)" << std::endl;
+#ifdef GBWT_POOLED_RECORDS
+  // The dynamic records have been compressed, so the pool is no longer needed.
+  std::cout << "Record pool " << inGigabytes(RecordPool::release()) << " GB (released)" << std::endl;
+#endif
+  std::cout << std::endl;
+}
+
 std::vector<size_type>
 startOffsets(const std::string& base_name)
 {
@@ -25,6 +25,7 @@
 
 #include <gbwt/bwtmerge.h>
 
+#include <chrono>
 #include <cstring>
 #include <sys/mman.h>
 
@@ -41,12 +42,156 @@ constexpr BlockArray::size_type BlockArray::BLOCK_MASK;
 
 template<class Producer> constexpr size_type ProducerBuffer<Producer>::BUFFER_SIZE;
 
+constexpr double MergeProgress::DEFAULT_INTERVAL;
+
+constexpr size_type MergeBuffers::WRITE_QUEUE_SIZE;
+
 //------------------------------------------------------------------------------
 
 // Other class variables.
 
 const std::string RankArray::TEMP_FILE_PREFIX = "ranks";
 
+std::atomic<size_type> MergeProgress::sequences(0);
+std::atomic<size_type> MergeProgress::values(0);
+std::atomic<size_type> MergeProgress::bytes_spilled(0);
+std::atomic<size_type> MergeProgress::bytes_in_memory(0);
+std::atomic<size_type> MergeProgress::bytes_read(0);
+std::atomic<size_type> MergeProgress::records(0);
+
+std::mutex              MergeProgress::report_lock;
+std::condition_variable MergeProgress::report_stop;
+std::thread             MergeProgress::reporter;
+std::ostream*           MergeProgress::output = nullptr;
+double                  MergeProgress::report_interval = MergeProgress::DEFAULT_INTERVAL;
+double                  MergeProgress::start_time = 0.0;
+bool                    MergeProgress::stop_reporter = false;
+std::string             MergeProgress::current_phase;
+double                  MergeProgress::prev_time = 0.0;
+size_type               MergeProgress::prev_sequences = 0;
+size_type               MergeProgress::prev_records = 0;
+
+//------------------------------------------------------------------------------
+
+// Stop the reporter thread if the program exits while reporting. Otherwise destroying
+// the joinable thread would terminate the program.
+void
+stopProgressAtExit()
+{
+  MergeProgress::stop();
+}
+
+void
+MergeProgress::start(std::ostream& out, const MergeParameters& parameters, double interval)
+{
+  stop();
+  static bool exit_handler = (std::atexit(stopProgressAtExit) == 0);
+  if(!exit_handler && Verbosity::level >= Verbosity::FULL)
+  {
+    std::cerr << "MergeProgress::start(): Warning: Cannot register the exit handler" << std::endl;
+  }
+
+  sequences = 0; values = 0;
+  bytes_spilled = 0; bytes_in_memory = 0; bytes_read = 0;
+  records = 0;
+  {
+    std::lock_guard<std::mutex> lock(report_lock);
+    output = &out;
+    report_interval = std::max(interval, 0.001);
+    start_time = readTimer();
+    stop_reporter = false;
+    current_phase = "start";
+    prev_time = 0.0; prev_sequences = 0; prev_records = 0;
+    *output << "{\"event\":\"start\",\"time\":0"
+            << ",\"threads\":" << omp_get_max_threads()
+            << ",\"pos_buffer_size\":" << parameters.pos_buffer_size
+            << ",\"thread_buffer_size\":" << parameters.thread_buffer_size
+            << ",\"merge_buffers\":" << parameters.merge_buffers
+            << ",\"chunk_size\":" << parameters.chunk_size
+            << ",\"merge_jobs\":" << parameters.merge_jobs
+            << ",\"ra_memory\":" << parameters.ra_memory << "}" << std::endl;
+  }
+  reporter = std::thread(report);
+}
+
+void
+MergeProgress::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(report_lock);
+    if(output == nullptr) { return; }
+    stop_reporter = true;
+  }
+  report_stop.notify_one();
+  reporter.join();
+
+  std::lock_guard<std::mutex> lock(report_lock);
+  snapshot("stop");
+  output = nullptr;
+}
+
+bool
+MergeProgress::enabled()
+{
+  std::lock_guard<std::mutex> lock(report_lock);
+  return (output != nullptr);
+}
+
+void
+MergeProgress::phase(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(report_lock);
+  if(output == nullptr) { return; }
+  current_phase = name;
+  *output << "{\"event\":\"phase\",\"time\":" << (readTimer() - start_time)
+          << ",\"phase\":\"" << current_phase << "\"}" << std::endl;
+}
+
+void
+MergeProgress::job(size_type job, size_type job_records, double seconds)
+{
+  std::lock_guard<std::mutex> lock(report_lock);
+  if(output == nullptr) { return; }
+  *output << "{\"event\":\"job\",\"time\":" << (readTimer() - start_time)
+          << ",\"phase\":\"" << current_phase << "\""
+          << ",\"job\":" << job
+          << ",\"records\":" << job_records
+          << ",\"seconds\":" << seconds
+          << ",\"records_per_second\":" << (seconds > 0.0 ? job_records / seconds : 0.0) << "}" << std::endl;
+}
+
+void
+MergeProgress::report()
+{
+  std::unique_lock<std::mutex> lock(report_lock);
+  while(true)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(report_interval);
+    if(report_stop.wait_until(lock, deadline, []() { return stop_reporter; })) { return; }
+    snapshot("progress");
+  }
+}
+
+void
+MergeProgress::snapshot(const std::string& event)
+{
+  double now = readTimer() - start_time, elapsed = now - prev_time;
+  size_type sequences_now = sequences.load(std::memory_order_relaxed);
+  size_type records_now = records.load(std::memory_order_relaxed);
+  *output << "{\"event\":\"" << event << "\",\"time\":" << now
+          << ",\"phase\":\"" << current_phase << "\""
+          << ",\"sequences\":" << sequences_now
+          << ",\"sequences_per_second\":" << (elapsed > 0.0 ? (sequences_now - prev_sequences) / elapsed : 0.0)
+          << ",\"values\":" << values.load(std::memory_order_relaxed)
+          << ",\"bytes_spilled\":" << bytes_spilled.load(std::memory_order_relaxed)
+          << ",\"bytes_in_memory\":" << bytes_in_memory.load(std::memory_order_relaxed)
+          << ",\"bytes_read\":" << bytes_read.load(std::memory_order_relaxed)
+          << ",\"records\":" << records_now
+          << ",\"records_per_second\":" << (elapsed > 0.0 ? (records_now - prev_records) / elapsed : 0.0)
+          << ",\"max_memory\":" << memoryUsage() << "}" << std::endl;
+  prev_time = now; prev_sequences = sequences_now; prev_records = records_now;
+}
+
 //------------------------------------------------------------------------------
 
 BlockArray::BlockArray() :
@@ -247,31 +392,36 @@ template<>
 void
 GapArray<BlockArray>::write(const std::string& filename)
 {
-  std::ofstream out(filename, std::ios_base::binary);
-  if(!out)
+  // The iterator is destructive, so we decode the values manually.
+  sdsl::int_vector_buffer<8> out(filename, std::ios::out);
+  std::vector<edge_type> frame; frame.reserve(FrameCode::FRAME_SIZE);
+  edge_type curr(ENDMARKER, 0), prev(ENDMARKER, 0);
+  size_type data_pointer = 0;
+  for(size_type i = 0; i < this->size(); i++)
   {
-    std::cerr << "GapArray::write(): Cannot open output file " << filename << std::endl;
-    std::exit(EXIT_FAILURE);
+    size_type node_diff = ByteCode::read(this->data, data_pointer);
+    if(node_diff != 0) { curr.second = 0; } // Node changed, set previous offset to 0.
+    curr.first += node_diff;
+    curr.second += ByteCode::read(this->data, data_pointer);
+    frame.push_back(curr);
+    if(frame.size() >= FrameCode::FRAME_SIZE) { GapArray<sdsl::int_vector_buffer<8>>::writeFrame(out, frame, prev); }
   }
-  this->data.serialize(out);
+  if(!(frame.empty())) { GapArray<sdsl::int_vector_buffer<8>>::writeFrame(out, frame, prev); }
   out.close();
 }
 
-template<>
-size_type
-GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
-                            const std::vector<range_type>& node_ranges,
-                            std::vector<size_type>& value_counts)
+bool
+checkNodeRanges(size_type outputs, const std::vector<range_type>& node_ranges)
 {
-  if(filenames.empty())
+  if(outputs == 0)
   {
-    std::cerr << "GapArray::write(): No output files specified" << std::endl;
-    return 0;
+    std::cerr << "GapArray::write(): No outputs specified" << std::endl;
+    return false;
   }
-  if(filenames.size() != node_ranges.size())
+  if(outputs != node_ranges.size())
   {
-    std::cerr << "GapArray::write(): The number of files and node ranges must match" << std::endl;
-    return 0;
+    std::cerr << "GapArray::write(): The number of outputs and node ranges must match" << std::endl;
+    return false;
   }
   size_type expect = 0;
   for(range_type range : node_ranges)
@@ -279,19 +429,30 @@ GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
     if(range.first != expect || range.second < range.first)
     {
       std::cerr << "GapArray::write(): The node ranges are not contiguous" << std::endl;
-      return 0;
+      return false;
     }
     expect = range.second + 1;
   }
   if(node_ranges.back().second >= invalid_node())
   {
     std::cerr << "GapArray::write(): The last range is invalid" << std::endl;
-    return 0;
+    return false;
   }
+  return true;
+}
+
+template<>
+size_type
+GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
+                            const std::vector<range_type>& node_ranges,
+                            std::vector<size_type>& value_counts)
+{
+  if(!checkNodeRanges(filenames.size(), node_ranges)) { return 0; }
   value_counts.clear();
 
   iterator iter(*this);
   size_type total_size = 0;
+  std::vector<edge_type> frame; frame.reserve(FrameCode::FRAME_SIZE);
   for(size_type i = 0; i < filenames.size(); i++)
   {
     size_type count = 0;
@@ -299,9 +460,11 @@ GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
     sdsl::int_vector_buffer<8> out(filenames[i], std::ios::out);
     while(iter->first <= node_ranges[i].second)
     {
-      GapArray<sdsl::int_vector_buffer<8>>::writeValue(out, *iter, prev);
+      frame.push_back(*iter);
+      if(frame.size() >= FrameCode::FRAME_SIZE) { GapArray<sdsl::int_vector_buffer<8>>::writeFrame(out, frame, prev); }
       count++; ++iter;
     }
+    if(!(frame.empty())) { GapArray<sdsl::int_vector_buffer<8>>::writeFrame(out, frame, prev); }
     value_counts.push_back(count);
     total_size += out.size();
     out.close();
@@ -311,6 +474,36 @@ GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
   return total_size;
 }
 
+template<>
+size_type
+GapArray<BlockArray>::write(std::vector<GapArray<std::vector<byte_type>>>& arrays,
+                            const std::vector<range_type>& node_ranges)
+{
+  if(!checkNodeRanges(arrays.size(), node_ranges)) { return 0; }
+
+  iterator iter(*this);
+  size_type total_size = 0;
+  std::vector<edge_type> frame; frame.reserve(FrameCode::FRAME_SIZE);
+  for(size_type i = 0; i < arrays.size(); i++)
+  {
+    GapArray<std::vector<byte_type>>& array = arrays[i];
+    array.data.clear(); array.value_count = 0;
+    edge_type prev(ENDMARKER, 0);
+    while(iter->first <= node_ranges[i].second)
+    {
+      frame.push_back(*iter);
+      if(frame.size() >= FrameCode::FRAME_SIZE) { GapArray<std::vector<byte_type>>::writeFrame(array.data, frame, prev); }
+      array.value_count++; ++iter;
+    }
+    if(!(frame.empty())) { GapArray<std::vector<byte_type>>::writeFrame(array.data, frame, prev); }
+    array.data.shrink_to_fit();
+    total_size += array.bytes();
+  }
+
+  this->clear();
+  return total_size;
+}
+
 void
 open(GapArray<sdsl::int_vector_buffer<8>>& array, const std::string filename, size_type values)
 {
@@ -341,14 +534,14 @@ GapIterator<BlockArray>::read()
 //------------------------------------------------------------------------------
 
 RankArray::RankArray() :
-  value(invalid_edge())
+  buffer_size(PRODUCER_BUFFER_SIZE), value(invalid_edge())
 {
 }
 
 RankArray::~RankArray()
 {
   this->close();
-  for(size_type i = 0; i < this->size(); i++) { TempFile::remove(this->filenames[i]); }
+  for(size_type i = 0; i < this->files(); i++) { TempFile::remove(this->filenames[i]); }
 }
 
 std::pair<std::string, size_type>
@@ -365,20 +558,27 @@ RankArray::addValueCount(size_type file, size_type value_count)
   this->value_counts[file] = value_count;
 }
 
+void
+RankArray::addArray(memory_type&& array)
+{
+  this->arrays.emplace_back(std::move(array));
+}
+
 void
 RankArray::open()
 {
   this->close();
-  this->inputs = std::vector<array_type>(this->size());
-  this->iterators = std::vector<iterator>(this->size());
-  this->buffers = std::vector<ProducerBuffer<iterator>*>(this->size());
+  this->inputs = std::vector<array_type>(this->files());
+  this->iterators = std::vector<iterator>(this->files());
+  this->buffers = std::vector<ProducerBuffer<iterator>*>(this->files());
 
-  for(size_type i = 0; i < this->size(); i++)
+  for(size_type i = 0; i < this->files(); i++)
   {
     gbwt::open(this->inputs[i], this->filenames[i], this->value_counts[i]);
     this->iterators[i] = iterator(this->inputs[i]);
-    this->buffers[i] = new ProducerBuffer<iterator>(this->iterators[i]);
+    this->buffers[i] = new ProducerBuffer<iterator>(this->iterators[i], this->buffer_size);
   }
+  for(memory_type& array : this->arrays) { this->array_iterators.emplace_back(array); }
 
   this->initTree();
 }
@@ -393,19 +593,20 @@ RankArray::close()
   this->buffers.clear();
   this->iterators.clear();
   this->inputs.clear();
+  this->array_iterators.clear();
   this->tournament_tree.clear();
   this->value = invalid_edge();
 }
 
 void RankArray::operator++()
 {
-  // Advance the active file.
+  // Advance the active input.
   size_type pos = this->tournament_tree.back().second;
-  this->buffers[pos]->operator++();
+  this->advance(pos);
 #ifdef GBWT_SAVE_MEMORY
-  this->tournament_tree[pos].first = pack(this->buffers[pos]->operator*());
+  this->tournament_tree[pos].first = pack(this->input(pos));
 #else
-  this->tournament_tree[pos].first = this->buffers[pos]->operator*();
+  this->tournament_tree[pos].first = this->input(pos);
 #endif
 
   // Update the tournament tree.
@@ -441,9 +642,9 @@ RankArray::initTree()
   for(size_type i = 0; i < this->size(); i++)
   {
 #ifdef GBWT_SAVE_MEMORY
-    this->tournament_tree[i].first = pack(this->buffers[i]->operator*());
+    this->tournament_tree[i].first = pack(this->input(i));
 #else
-    this->tournament_tree[i].first = this->buffers[i]->operator*();
+    this->tournament_tree[i].first = this->input(i);
 #endif
   }
   for(size_type i = 0; i < this->leaves; i++) { this->tournament_tree[i].second = i; }
@@ -472,16 +673,19 @@ MergeBuffers::MergeBuffers(size_type expected_size, size_type num_threads, const
   pos_buffers(num_threads), thread_buffers(num_threads),
   merge_buffers(params.merge_buffers),
   job_ranges(node_ranges), ra(node_ranges.size(), nullptr),
-  ra_values(0), ra_bytes(0), final_size(expected_size)
+  ra_values(0), ra_bytes(0), ra_memory(0), final_size(expected_size),
+  writing(false), stop_writer(false), queued_writes(0), write_wait(0.0)
 {
   for(size_type i = 0; i < this->ra.size(); i++)
   {
     this->ra[i] = new RankArray();
   }
+  this->writer = std::thread(&MergeBuffers::writeBuffers, this);
 }
 
 MergeBuffers::~MergeBuffers()
 {
+  this->stopWriter();
   for(size_type i = 0; i < this->ra.size(); i++)
   {
     delete this->ra[i]; this->ra[i] = nullptr;
@@ -504,12 +708,16 @@ MergeBuffers::flush()
     this->merge_buffers[i] = buffer_type(this->merge_buffers[i], this->merge_buffers[i - 1]);
   }
   size_type buffer_values = this->merge_buffers.back().size();
-  this->write(this->merge_buffers.back());
+  this->queueWrite(this->merge_buffers.back());
+  this->waitForWrites();
+  this->stopWriter();
 
   if(Verbosity::level >= Verbosity::EXTENDED)
   {
     std::lock_guard<std::mutex> lock(this->stderr_access);
-    std::cerr << "MergeBuffers::flush(): Wrote " << buffer_values << " values to disk" << std::endl;
+    std::cerr << "MergeBuffers::flush(): Wrote " << buffer_values << " values to the rank array" << std::endl;
+    std::cerr << "MergeBuffers::flush(): Search threads waited " << this->write_wait << " seconds for "
+              << this->queued_writes << " buffer writes" << std::endl;
   }
 }
 
@@ -558,8 +766,69 @@ MergeBuffers::insert(std::vector<edge_type>& pos_buffer, buffer_type& thread_buf
     thread_buffer = buffer_type(thread_buffer, temp_buffer);
   }
 
-  // All slots were full, write the merged buffer to a file.
-  this->write(thread_buffer);
+  // All slots were full, hand the merged buffer over to the writer thread.
+  this->queueWrite(thread_buffer);
+}
+
+void
+MergeBuffers::queueWrite(buffer_type& buffer)
+{
+  if(buffer.empty()) { return; }
+
+  std::unique_lock<std::mutex> lock(this->write_lock);
+  if(this->write_queue.size() >= WRITE_QUEUE_SIZE)
+  {
+    double wait_start = readTimer();
+    this->write_space.wait(lock, [this]() { return (this->write_queue.size() < WRITE_QUEUE_SIZE); });
+    this->write_wait += readTimer() - wait_start;
+  }
+  this->write_queue.emplace();
+  this->write_queue.back().swap(buffer);
+  this->queued_writes++;
+  lock.unlock();
+  this->write_ready.notify_one();
+}
+
+void
+MergeBuffers::waitForWrites()
+{
+  std::unique_lock<std::mutex> lock(this->write_lock);
+  this->write_space.wait(lock, [this]() { return (this->write_queue.empty() && !(this->writing)); });
+}
+
+void
+MergeBuffers::stopWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->write_lock);
+    this->stop_writer = true;
+  }
+  this->write_ready.notify_all();
+  if(this->writer.joinable()) { this->writer.join(); }
+}
+
+void
+MergeBuffers::writeBuffers()
+{
+  while(true)
+  {
+    buffer_type buffer;
+    {
+      std::unique_lock<std::mutex> lock(this->write_lock);
+      this->write_ready.wait(lock, [this]() { return (this->stop_writer || !(this->write_queue.empty())); });
+      if(this->write_queue.empty()) { return; }
+      buffer.swap(this->write_queue.front());
+      this->write_queue.pop();
+      this->writing = true;
+    }
+    this->write_space.notify_all();
+    this->write(buffer);
+    {
+      std::lock_guard<std::mutex> lock(this->write_lock);
+      this->writing = false;
+    }
+    this->write_space.notify_all();
+  }
 }
 
 void
@@ -569,43 +838,77 @@ MergeBuffers::write(buffer_type& buffer)
 
   size_type buffer_values = buffer.size();
 
-  // Get the filenames for each RankArray and write the buffer to the files.
+  // If there is room in the memory budget, encode the buffer first, so that the budget
+  // is charged with the actual size of the arrays instead of the size of the buffer.
+  std::vector<RankArray::memory_type> arrays;
+  {
+    std::lock_guard<std::mutex> lock(this->ra_lock);
+    if(this->ra_memory < this->parameters.raMemoryBytes()) { arrays.resize(this->jobs()); }
+  }
+  size_type buffer_bytes = 0;
+  if(!(arrays.empty())) { buffer_bytes = buffer.write(arrays, this->job_ranges); }
+
+  // Keep the arrays in memory if the rank array still fits in the memory budget.
+  bool in_memory = false;
   std::vector<std::string> filenames;
-  std::vector<size_type> value_counts;
   std::vector<size_type> file_numbers;
   {
     std::lock_guard<std::mutex> lock(this->ra_lock);
+    if(!(arrays.empty()) && this->ra_memory + buffer_bytes <= this->parameters.raMemoryBytes())
+    {
+      in_memory = true;
+      this->ra_memory += buffer_bytes;
+    }
+    else
+    {
+      for(size_type i = 0; i < this->jobs(); i++)
+      {
+        std::string filename;
+        size_type file_num = 0;
+        std::tie(filename, file_num) = this->ra[i]->addFile();
+        filenames.push_back(filename);
+        file_numbers.push_back(file_num);
+      }
+    }
+  }
+
+  // Otherwise write the buffer or the arrays to files.
+  std::vector<size_type> value_counts(this->jobs(), 0);
+  if(arrays.empty()) { buffer_bytes = buffer.write(filenames, this->job_ranges, value_counts); }
+  else if(!in_memory)
+  {
     for(size_type i = 0; i < this->jobs(); i++)
     {
-      std::string filename;
-      size_type file_num = 0;
-      std::tie(filename, file_num) = this->ra[i]->addFile();
-      filenames.push_back(filename);
-      file_numbers.push_back(file_num);
+      arrays[i].write(filenames[i]);
+      value_counts[i] = arrays[i].size();
     }
   }
-  size_type buffer_bytes = buffer.write(filenames, this->job_ranges, value_counts);
 
-  // Set the value counts for each file and compute some statistics.
-  double ra_done, ra_gb;
+  // Add the arrays or set the value counts for each file and compute some statistics.
+  double ra_done, ra_gb, ra_memory_gb;
   {
     std::lock_guard<std::mutex> lock(this->ra_lock);
     for(size_type i = 0; i < this->jobs(); i++)
     {
-      this->ra[i]->addValueCount(file_numbers[i], value_counts[i]);
+      if(in_memory) { this->ra[i]->addArray(std::move(arrays[i])); }
+      else { this->ra[i]->addValueCount(file_numbers[i], value_counts[i]); }
     }
     this->ra_values += buffer_values;
     this->ra_bytes += buffer_bytes + sizeof(size_type);
+    MergeProgress::add(MergeProgress::values, buffer_values);
+    MergeProgress::add((in_memory ? MergeProgress::bytes_in_memory : MergeProgress::bytes_spilled), buffer_bytes);
     ra_done = (100.0 * this->ra_values) / this->final_size;
     ra_gb = inGigabytes(this->ra_bytes);
+    ra_memory_gb = inGigabytes(this->ra_memory);
   }
 
   if(Verbosity::level >= Verbosity::EXTENDED)
   {
     std::lock_guard<std::mutex> lock(this->stderr_access);
-    std::cerr << "MergeBuffers::write(): Thread " << omp_get_thread_num()
-              << ": Wrote " << buffer_values << " values to the rank array" << std::endl;
-    std::cerr << "MergeBuffers::write(): " << ra_done << "% done; RA size " << ra_gb << " GB" << std::endl;
+    std::cerr << "MergeBuffers::write(): Wrote " << buffer_values << " values to the rank array"
+              << (in_memory ? " in memory" : "") << std::endl;
+    std::cerr << "MergeBuffers::write(): " << ra_done << "% done; RA size " << ra_gb << " GB ("
+              << ra_memory_gb << " GB in memory)" << std::endl;
   }
 }
 
@@ -26,6 +26,9 @@
 #include <gbwt/dynamic_gbwt.h>
 #include <gbwt/bwtmerge.h>
 
+#include <functional>
+#include <queue>
+
 namespace gbwt
 {
 
@@ -133,37 +136,49 @@ DynamicGBWT::load(std::istream& in)
   this->header.setVersion();  // Update to the current version.
   this->bwt.resize(this->effective());
 
+  // Decompression is split between threads by record ranges.
+  std::vector<range_type> blocks;
+  if(this->effective() > 0)
+  {
+    blocks = Range::partition(range_type(0, this->effective() - 1), 4 * omp_get_max_threads());
+  }
+
   // Read and decompress the BWT.
   {
     RecordArray array;
     array.load(in);
-    size_type offset = 0;
-    for(comp_type comp = 0; comp < this->effective(); comp++)
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_type block = 0; block < blocks.size(); block++)
     {
-      size_type limit = array.limit(comp);
-      DynamicRecord& current = this->bwt[comp];
-      current.clear();
-
-      // Decompress the outgoing edges.
-      current.outgoing.resize(ByteCode::read(array.data, offset));
-      node_type prev = 0;
-      for(edge_type& outedge : current.outgoing)
+      size_type offset = array.start(blocks[block].first);
+      for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
       {
-        outedge.first = ByteCode::read(array.data, offset) + prev;
-        prev = outedge.first;
-        outedge.second = ByteCode::read(array.data, offset);
-      }
+        size_type limit = array.limit(comp);
+        DynamicRecord& current = this->bwt[comp];
+        current.clear();
+
+        // Decompress the outgoing edges.
+        current.outgoing.resize(ByteCode::read(array.data, offset));
+        node_type prev = 0;
+        for(edge_type& outedge : current.outgoing)
+        {
+          outedge.first = ByteCode::read(array.data, offset) + prev;
+          prev = outedge.first;
+          outedge.second = ByteCode::read(array.data, offset);
+        }
 
-      // Decompress the body.
-      if(current.outdegree() > 0)
-      {
-        Run decoder(current.outdegree());
-        while(offset < limit)
+        // Decompress the body.
+        if(current.outdegree() > 0)
         {
-          run_type run = decoder.read(array.data, offset);
-          current.body.push_back(run);
-          current.body_size += run.second;
+          Run decoder(current.outdegree());
+          while(offset < limit)
+          {
+            run_type run = decoder.read(array.data, offset);
+            current.body.push_back(run);
+            current.body_size += run.second;
+          }
         }
+        offset = limit;
       }
     }
   }
@@ -172,14 +187,21 @@ DynamicGBWT::load(std::istream& in)
   {
     DASamples samples;
     samples.load(in);
-    SampleIterator sample_iter(samples);
-    for(SampleRangeIterator range_iter(samples); !(range_iter.end()); ++range_iter)
+    sdsl::sd_vector<>::select_1_type offset_select(&(samples.sampled_offsets));
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_type block = 0; block < blocks.size(); block++)
     {
-      DynamicRecord& current = this->bwt[range_iter.record()];
-      while(!(sample_iter.end()) && sample_iter.offset() < range_iter.limit())
+      for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
       {
-        current.ids.push_back(sample_type(sample_iter.offset() - range_iter.start(), *sample_iter));
-        ++sample_iter;
+        if(!(samples.isSampled(comp))) { continue; }
+        DynamicRecord& current = this->bwt[comp];
+        size_type start = samples.start(comp), limit = samples.limit(samples.record_rank(comp));
+        for(size_type i = samples.sample_rank(start); i < samples.size(); i++)
+        {
+          size_type sample_offset = offset_select(i + 1);
+          if(sample_offset >= limit) { break; }
+          current.ids.push_back(sample_type(sample_offset - start, samples.array[i]));
+        }
       }
     }
   }
@@ -329,21 +351,45 @@ DynamicGBWT::recode()
 void
 DynamicGBWT::rebuildIncoming()
 {
-  // Clear the existing incoming edges.
-  for(comp_type comp = 0; comp < this->effective(); comp++) { this->bwt[comp].incoming.clear(); }
+  if(this->effective() == 0) { return; }
+  std::vector<range_type> blocks = Range::partition(range_type(0, this->effective() - 1), 4 * omp_get_max_threads());
 
-  // Rebuild them from record bodies and outgoing edges.
-  for(comp_type comp = 0; comp < this->effective(); comp++)
+  // Collect the edges from each block of records as (successor, (predecessor, count)),
+  // sorted by successor. Within a successor, the predecessors are in sorted order.
+  typedef std::pair<comp_type, edge_type> incoming_type;
+  std::vector<std::vector<incoming_type>> edges(blocks.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
+    {
+      DynamicRecord& current = this->bwt[comp];
+      current.incoming.clear();
+      std::vector<size_type> counts(current.outdegree());
+      for(run_type run : current.body) { counts[run.first] += run.second; }
+      for(rank_type outrank = 0; outrank < current.outdegree(); outrank++)
+      {
+        if(current.successor(outrank) != ENDMARKER)
+        {
+          edges[block].push_back(incoming_type(this->toComp(current.successor(outrank)), edge_type(this->toNode(comp), counts[outrank])));
+        }
+      }
+    }
+    std::stable_sort(edges[block].begin(), edges[block].end(),
+      [](const incoming_type& a, const incoming_type& b) -> bool { return (a.first < b.first); });
+  }
+
+  // Each block of successors takes its edges from every predecessor block in order.
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    DynamicRecord& current = this->bwt[comp];
-    std::vector<size_type> counts(current.outdegree());
-    for(run_type run : current.body) { counts[run.first] += run.second; }
-    for(rank_type outrank = 0; outrank < current.outdegree(); outrank++)
+    for(const std::vector<incoming_type>& source : edges)
     {
-      if(current.successor(outrank) != ENDMARKER)
+      auto iter = std::lower_bound(source.begin(), source.end(), incoming_type(blocks[block].first, edge_type(0, 0)),
+        [](const incoming_type& a, const incoming_type& b) -> bool { return (a.first < b.first); });
+      for(; iter != source.end() && iter->first <= blocks[block].second; ++iter)
       {
-        DynamicRecord& successor = this->record(current.successor(outrank));
-        successor.addIncoming(edge_type(this->toNode(comp), counts[outrank]));
+        this->bwt[iter->first].incoming.push_back(iter->second);
       }
     }
   }
@@ -352,23 +398,35 @@ DynamicGBWT::rebuildIncoming()
 void
 DynamicGBWT::rebuildOutgoing()
 {
-  for(comp_type comp = 0; comp < this->effective(); comp++)
+  if(this->effective() == 0) { return; }
+
+  // Each edge (predecessor, curr) is only updated from the record of curr, so the blocks
+  // write to disjoint edges.
+  std::vector<range_type> blocks = Range::partition(range_type(0, this->effective() - 1), 4 * omp_get_max_threads());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    node_type curr = this->toNode(comp);
-    DynamicRecord& current = this->record(curr);
-    size_type offset = 0;
-    for(rank_type inrank = 0; inrank < current.indegree(); inrank++)
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
     {
-      DynamicRecord& predecessor = this->record(current.predecessor(inrank));
-      rank_type outrank = predecessor.edgeTo(curr);
-      if(outrank >= predecessor.outdegree())
+      node_type curr = this->toNode(comp);
+      DynamicRecord& current = this->record(curr);
+      size_type offset = 0;
+      for(rank_type inrank = 0; inrank < current.indegree(); inrank++)
       {
-        std::cerr << "DynamicGBWT::rebuildOutgoing(): Outgoing edge from " << current.predecessor(inrank)
-                  << " to " << curr << " not found" << std::endl;
-        std::exit(EXIT_FAILURE);
+        DynamicRecord& predecessor = this->record(current.predecessor(inrank));
+        rank_type outrank = predecessor.edgeTo(curr);
+        if(outrank >= predecessor.outdegree())
+        {
+          #pragma omp critical
+          {
+            std::cerr << "DynamicGBWT::rebuildOutgoing(): Outgoing edge from " << current.predecessor(inrank)
+                      << " to " << curr << " not found" << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        predecessor.offset(outrank) = offset;
+        offset += current.count(inrank);
       }
-      predecessor.offset(outrank) = offset;
-      offset += current.count(inrank);
     }
   }
 }
@@ -393,71 +451,117 @@ swapBody(DynamicRecord& record, RunMerger& merger)
   - Add sample (offset, id) if iteration % sample_interval == 0 or next == ENDMARKER.
   - Insert the 'next' node into position 'offset' in the body.
   - Set 'offset' to rank(next) within the record.
-  - Update the predecessor count of 'curr' in the incoming edges of 'next'.
+  - Record the number of sequences going from 'curr' to each 'next' as a deferred
+    increment ((next, curr), count) to the incoming edges of 'next'.
 
   We do not maintain incoming edges to the endmarker, because it can be expensive
   and because searching with the endmarker does not work in a multi-string BWT.
+
+  The ranges only write to the record of 'curr', so they can be processed in parallel.
+  The deferred increments are applied afterwards.
 */
 
+typedef std::pair<edge_type, size_type> increment_type;
+
 void
-updateRecords(DynamicGBWT& gbwt, std::vector<Sequence>& seqs, size_type iteration, size_type sample_interval)
+updateRecord(DynamicGBWT& gbwt, std::vector<Sequence>& seqs, range_type range, size_type iteration, size_type sample_interval,
+             std::vector<increment_type>& increments)
 {
-  for(size_type i = 0; i < seqs.size(); )
+  node_type curr = seqs[range.first].curr;
+  DynamicRecord& current = gbwt.record(curr);
+  RunMerger new_body(current.outdegree());
+  std::vector<size_type> inserted(current.outdegree(), 0);
+  record_vector<sample_type> new_samples;
+  record_vector<run_type>::iterator iter = current.body.begin();
+  record_vector<sample_type>::iterator sample_iter = current.ids.begin();
+  size_type insert_count = 0;
+  for(size_type i = range.first; i <= range.second; i++)
   {
-    node_type curr = seqs[i].curr;
-    DynamicRecord& current = gbwt.record(curr);
-    RunMerger new_body(current.outdegree());
-    std::vector<sample_type> new_samples;
-    std::vector<run_type>::iterator iter = current.body.begin();
-    std::vector<sample_type>::iterator sample_iter = current.ids.begin();
-    size_type insert_count = 0;
-    while(i < seqs.size() && seqs[i].curr == curr)
+    rank_type outrank = current.edgeToLinear(seqs[i].next);
+    if(outrank >= current.outdegree())  // Add edge (curr, next) if it does not exist.
     {
-      rank_type outrank = current.edgeToLinear(seqs[i].next);
-      if(outrank >= current.outdegree())  // Add edge (curr, next) if it does not exist.
-      {
-        current.outgoing.push_back(edge_type(seqs[i].next, 0));
-        new_body.addEdge();
-      }
-      while(new_body.size() < seqs[i].offset)  // Add old runs until 'offset'.
-      {
-        if(iter->second <= seqs[i].offset - new_body.size()) { new_body.insert(*iter); ++iter; }
-        else
-        {
-          run_type temp(iter->first, seqs[i].offset - new_body.size());
-          new_body.insert(temp);
-          iter->second -= temp.second;
-        }
-      }
-      // Add old samples until 'offset'.
-      while(sample_iter != current.ids.end() && sample_iter->first + insert_count < seqs[i].offset)
-      {
-        new_samples.push_back(sample_type(sample_iter->first + insert_count, sample_iter->second));
-        ++sample_iter;
-      }
-      if(iteration % sample_interval == 0 || seqs[i].next == ENDMARKER)  // Sample sequence id.
-      {
-        new_samples.push_back(sample_type(seqs[i].offset, seqs[i].id));
-      }
-      seqs[i].offset = new_body.counts[outrank]; // rank(next) within the record.
-      new_body.insert(outrank); insert_count++;
-      if(seqs[i].next != ENDMARKER)  // The endmarker does not have incoming edges.
-      {
-        gbwt.record(seqs[i].next).increment(curr);
-      }
-      i++;
+      current.outgoing.push_back(edge_type(seqs[i].next, 0));
+      new_body.addEdge(); inserted.push_back(0);
     }
-    while(iter != current.body.end()) // Add the rest of the old body.
+    while(new_body.size() < seqs[i].offset)  // Add old runs until 'offset'.
     {
-      new_body.insert(*iter); ++iter;
+      if(iter->second <= seqs[i].offset - new_body.size()) { new_body.insert(*iter); ++iter; }
+      else
+      {
+        run_type temp(iter->first, seqs[i].offset - new_body.size());
+        new_body.insert(temp);
+        iter->second -= temp.second;
+      }
     }
-    while(sample_iter != current.ids.end()) // Add the rest of the old samples.
+    // Add old samples until 'offset'.
+    while(sample_iter != current.ids.end() && sample_iter->first + insert_count < seqs[i].offset)
     {
       new_samples.push_back(sample_type(sample_iter->first + insert_count, sample_iter->second));
       ++sample_iter;
     }
-    swapBody(current, new_body);
-    current.ids.swap(new_samples);
+    if(iteration % sample_interval == 0 || seqs[i].next == ENDMARKER)  // Sample sequence id.
+    {
+      new_samples.push_back(sample_type(seqs[i].offset, seqs[i].id));
+    }
+    seqs[i].offset = new_body.counts[outrank]; // rank(next) within the record.
+    new_body.insert(outrank); insert_count++;
+    inserted[outrank]++;
+  }
+  while(iter != current.body.end()) // Add the rest of the old body.
+  {
+    new_body.insert(*iter); ++iter;
+  }
+  while(sample_iter != current.ids.end()) // Add the rest of the old samples.
+  {
+    new_samples.push_back(sample_type(sample_iter->first + insert_count, sample_iter->second));
+    ++sample_iter;
+  }
+  swapBody(current, new_body);
+  current.ids.swap(new_samples);
+
+  for(rank_type outrank = 0; outrank < current.outdegree(); outrank++)
+  {
+    node_type next = current.successor(outrank);
+    if(inserted[outrank] > 0 && next != ENDMARKER)  // The endmarker does not have incoming edges.
+    {
+      increments.push_back(increment_type(edge_type(next, curr), inserted[outrank]));
+    }
+  }
+}
+
+void
+updateRecords(DynamicGBWT& gbwt, std::vector<Sequence>& seqs, size_type iteration, size_type sample_interval)
+{
+  if(seqs.empty()) { return; }
+
+  // Determine the ranges of sequences sharing the same 'curr' node.
+  std::vector<size_type> range_starts;
+  for(size_type i = 0; i < seqs.size(); i++)
+  {
+    if(i == 0 || seqs[i].curr != seqs[i - 1].curr) { range_starts.push_back(i); }
+  }
+  range_starts.push_back(seqs.size());
+
+  // Update the records, collecting the increments separately for each block.
+  bool parallel = (seqs.size() >= DynamicGBWT::PARALLEL_UPDATE_THRESHOLD && omp_get_max_threads() > 1);
+  std::vector<range_type> blocks = Range::partition(range_type(0, range_starts.size() - 2), (parallel ? 4 * omp_get_max_threads() : 1));
+  std::vector<std::vector<increment_type>> increments(blocks.size());
+  #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    for(size_type i = blocks[block].first; i <= blocks[block].second; i++)
+    {
+      updateRecord(gbwt, seqs, range_type(range_starts[i], range_starts[i + 1] - 1), iteration, sample_interval, increments[block]);
+    }
+  }
+
+  // Apply the deferred increments to the incoming edges.
+  for(const std::vector<increment_type>& block_increments : increments)
+  {
+    for(const increment_type& increment : block_increments)
+    {
+      gbwt.record(increment.first.first).increment(increment.first.second, increment.second);
+    }
   }
   gbwt.header.size += seqs.size();
 }
@@ -502,7 +606,7 @@ nextPosition(std::vector<Sequence>& seqs, const DynamicGBWT& source)
   {
     node_type curr = seqs[i].curr;
     const DynamicRecord& current = source.record(curr);
-    std::vector<run_type>::const_iterator iter = current.body.begin();
+    record_vector<run_type>::const_iterator iter = current.body.begin();
     std::vector<edge_type> result(current.outgoing);
     size_type record_offset = iter->second; result[iter->first].second += iter->second;
     while(i < seqs.size() && seqs[i].curr == curr)
@@ -522,12 +626,17 @@ nextPosition(std::vector<Sequence>& seqs, const DynamicGBWT& source)
   Sort the sequences for the next iteration and remove the ones that have reached the endmarker.
   Note that sorting by (next, curr, offset) now is equivalent to sorting by (curr, offset) in the
   next interation.
+
+  The sequences are sorted by curr, and updateRecords() has set the offsets of the sequences
+  with the same (curr, next) to increasing ranks. Hence a stable radix sort by next is enough
+  for large batches.
 */
 
 void
 sortSequences(std::vector<Sequence>& seqs)
 {
-  sequentialSort(seqs.begin(), seqs.end());
+  if(seqs.size() < SequenceRadixSort::RADIX) { sequentialSort(seqs.begin(), seqs.end()); }
+  else { SequenceRadixSort::sort(seqs); }
   size_type head = 0;
   while(head < seqs.size() && seqs[head].next == ENDMARKER) { head++; }
   if(head > 0)
@@ -614,7 +723,7 @@ advancePosition(std::vector<Sequence>& seqs, const DynamicGBWT& source)
   {
     node_type curr = seqs[i].next;
     const DynamicRecord& current = source.record(curr);
-    std::vector<run_type>::const_iterator iter = current.body.begin();
+    record_vector<run_type>::const_iterator iter = current.body.begin();
     size_type offset = iter->second;
     while(i < seqs.size() && seqs[i].next == curr)
     {
@@ -1017,6 +1126,28 @@ mergeMetadata(DynamicGBWT& index, const GBWTType& source)
   }
 }
 
+void
+mergeMetadata(DynamicGBWT& index, const std::vector<const DynamicGBWT*>& sources)
+{
+  if(!(index.hasMetadata())) { return; }
+  std::vector<const Metadata*> source_metadata(1, &(index.metadata));
+  for(const DynamicGBWT* source : sources)
+  {
+    if(!(source->hasMetadata()))
+    {
+      if(Verbosity::level >= Verbosity::BASIC)
+      {
+        std::cerr << "DynamicGBWT::merge(): Clearing metadata: no metadata in the other GBWT" << std::endl;
+      }
+      index.clearMetadata();
+      return;
+    }
+    source_metadata.push_back(&(source->metadata));
+  }
+  Metadata merged(source_metadata, false, true); // Different samples, same contigs.
+  index.metadata.swap(merged);
+}
+
 void
 DynamicGBWT::merge(const GBWT& source, size_type batch_size, size_type sample_interval)
 {
@@ -1081,37 +1212,63 @@ DynamicGBWT::merge(const GBWT& source, size_type batch_size, size_type sample_in
 //------------------------------------------------------------------------------
 
 /*
-  Builds the rank array of 'right' relative to 'left'. When the rank array RA is sorted, we
-  know that there will be RA[i] characters from left_BWT before right_BWT[i].
+  Builds the rank array of source 'source_id' relative to the index and the other sources.
+  The value for each position is its final offset in the merged record: the number of
+  positions before it in the index, in the other sources, and in the source itself. When
+  the rank array is sorted, the values for each node are therefore in the same order as
+  the positions in the source.
 
   We assume that 'buffers' has been set to use the same number of threads as OpenMP. The
-  sequences from 'right' will get identifiers after those from 'left'.
+  sequences from the source will get identifiers after those from the index and from the
+  earlier sources.
 */
 
 void
-buildRA(const DynamicGBWT& left, const DynamicGBWT& right, MergeBuffers& buffers)
+buildRA(const DynamicGBWT& index, const std::vector<const DynamicGBWT*>& sources, size_type source_id, MergeBuffers& buffers)
 {
+  const DynamicGBWT& right = *(sources[source_id]);
   DecompressedRecord right_endmarker = right.endmarker();
+  size_type sequence_offset = index.sequences();
+  for(size_type i = 0; i < source_id; i++) { sequence_offset += sources[i]->sequences(); }
 
   #pragma omp parallel for schedule(dynamic, buffers.parameters.chunk_size)
   for(size_type sequence = 0; sequence < right.sequences(); sequence++)
   {
-    // The new sequence will be after all existing sequences in 'left'.
+    // The new sequence will be after all existing sequences in the index and the earlier
+    // sources and before all sequences in the later sources.
     size_type thread = omp_get_thread_num();
-    buffers.insert(edge_type(ENDMARKER, left.sequences()), thread);
+    buffers.insert(edge_type(ENDMARKER, sequence_offset + sequence), thread);
 
     // Computing LF() at the endmarker can be expensive, so we do it using the incoming
     // edges at the destination node instead.
     edge_type right_pos = right_endmarker.LF(sequence);
-    edge_type left_pos(right_pos.first, left.record(right_pos.first).countUntil(ENDMARKER));
+    edge_type left_pos(right_pos.first, index.record(right_pos.first).countUntil(ENDMARKER));
+    std::vector<edge_type> other_pos(sources.size(), edge_type(right_pos.first, 0));
+    for(size_type i = 0; i < source_id; i++)
+    {
+      if(sources[i]->contains(right_pos.first))
+      {
+        other_pos[i].second = sources[i]->record(right_pos.first).countUntil(ENDMARKER);
+      }
+    }
 
     // Main loop. We can assume that the positions are always valid.
     while(right_pos.first != ENDMARKER)
     {
-      buffers.insert(left_pos, thread);
+      size_type rank = right_pos.second + left_pos.second;
+      for(size_type i = 0; i < sources.size(); i++)
+      {
+        if(i != source_id) { rank += other_pos[i].second; }
+      }
+      buffers.insert(edge_type(right_pos.first, rank), thread);
       right_pos = right.LF(right_pos);
-      left_pos = edge_type(right_pos.first, left.fullLF(left_pos, right_pos.first));
+      left_pos = edge_type(right_pos.first, index.fullLF(left_pos, right_pos.first));
+      for(size_type i = 0; i < sources.size(); i++)
+      {
+        if(i != source_id) { other_pos[i] = edge_type(right_pos.first, sources[i]->fullLF(other_pos[i], right_pos.first)); }
+      }
     }
+    MergeProgress::add(MergeProgress::sequences, 1);
   }
 
   buffers.flush();
@@ -1153,58 +1310,81 @@ mergeOutgoing(const std::vector<edge_type>& left, const std::vector<edge_type>&
   Recode the run from 'source' using 'outgoing' as the list of outgoing edges.
 */
 
+template<class RecordType>
 run_type
-recodeRun(run_type run, const DynamicRecord& source, const std::vector<edge_type>& outgoing)
+recodeRun(run_type run, const RecordType& source, const std::vector<edge_type>& outgoing)
 {
   run.first = edgeTo(source.successor(run.first), outgoing);
   return run;
 }
 
 /*
-  Merges 'right' into 'left' using the rank array. We need the node identifier for finding
-  the correct range in the rank array and the number of sequences in 'left' for updating the
-  samples from 'right'.
+  Merges the 'right' records into 'left' using the rank arrays. A null pointer means that the
+  corresponding source does not contain the node. We need the node identifier for finding the
+  correct range in the rank arrays and the identifier of the first sequence from each source
+  for updating the samples from the sources.
 */
 
 void
-mergeRecords(DynamicRecord& left, const DynamicRecord& right, ProducerBuffer<RankArray>& ra, node_type node, size_type left_sequences)
+mergeRecords(DynamicRecord& left, const std::vector<DynamicRecord const*>& right, std::vector<std::unique_ptr<ProducerBuffer<RankArray>>>& ra,
+             node_type node, const std::vector<size_type>& sequence_offsets)
 {
   // Rebuild the record using these structures.
-  std::vector<edge_type> new_outgoing = mergeOutgoing(left.outgoing, right.outgoing);
+  std::vector<edge_type> new_outgoing = left.outgoing;
+  for(const DynamicRecord* record : right)
+  {
+    if(record != nullptr) { new_outgoing = mergeOutgoing(new_outgoing, record->outgoing); }
+  }
   RunMerger new_body(new_outgoing.size());
-  std::vector<sample_type> new_samples;
-
-  // Rank array contains the number of elements from 'left' before each element from 'right'.
-  auto left_iter = left.body.begin(); auto right_iter = right.body.begin();
-  auto left_sample_iter = left.ids.begin(); auto right_sample_iter = right.ids.begin();
-  run_type left_run(0, 0), right_run(0, 0);
+  record_vector<sample_type> new_samples;
+
+  // Rank arrays contain the final offset of each element from 'right'.
+  auto left_iter = left.body.begin();
+  auto left_sample_iter = left.ids.begin();
+  run_type left_run(0, 0);
+  std::vector<size_type> right_runs(right.size(), 0), right_samples(right.size(), 0), right_counts(right.size(), 0);
+  std::vector<run_type> right_run(right.size(), run_type(0, 0));
   size_type insert_count = 0;
-  while(!(ra.end()) && ra->first == node)
+  while(true)
   {
+    // Find the source with the next value.
+    size_type next = right.size();
+    for(size_type i = 0; i < right.size(); i++)
+    {
+      if(ra[i]->end() || (*(ra[i]))->first != node) { continue; }
+      if(next >= right.size() || (*(ra[i]))->second < (*(ra[next]))->second) { next = i; }
+    }
+    if(next >= right.size()) { break; }
+    size_type offset = (*(ra[next]))->second;
+    const DynamicRecord& source = *(right[next]);
+
     // Add runs from 'left'.
-    while(new_body.size() < ra->second + insert_count)
+    while(new_body.size() < offset)
     {
       if(left_run.second == 0) { left_run = recodeRun(*left_iter, left, new_outgoing); ++left_iter; }
-      size_type insert_length = std::min(static_cast<size_type>(left_run.second), ra->second + insert_count - new_body.size());
+      size_type insert_length = std::min(static_cast<size_type>(left_run.second), offset - new_body.size());
       new_body.insert(run_type(left_run.first, insert_length));
       left_run.second -= insert_length;
     }
     // Add samples from 'left'.
-    while(left_sample_iter != left.ids.end() && left_sample_iter->first < ra->second)
+    while(left_sample_iter != left.ids.end() && left_sample_iter->first + insert_count < offset)
     {
       new_samples.emplace_back(left_sample_iter->first + insert_count, left_sample_iter->second);
       ++left_sample_iter;
     }
-    // Add a single value and the possible sample from 'right'.
-    if(right_run.second == 0) { right_run = recodeRun(*right_iter, right, new_outgoing); ++right_iter; }
-    new_body.insert(right_run.first);
-    if(right_sample_iter != right.ids.end() && right_sample_iter->first == insert_count)
+    // Add a single value and the possible sample from the source.
+    if(right_run[next].second == 0)
     {
-      new_samples.emplace_back(ra->second + insert_count, right_sample_iter->second + left_sequences);
-      ++right_sample_iter;
+      right_run[next] = recodeRun(source.body[right_runs[next]], source, new_outgoing); right_runs[next]++;
     }
-    right_run.second--; insert_count++;
-    ++ra;
+    new_body.insert(right_run[next].first);
+    if(right_samples[next] < source.ids.size() && source.ids[right_samples[next]].first == right_counts[next])
+    {
+      new_samples.emplace_back(offset, source.ids[right_samples[next]].second + sequence_offsets[next]);
+      right_samples[next]++;
+    }
+    right_run[next].second--; right_counts[next]++; insert_count++;
+    ++(*(ra[next]));
   }
 
   // Add the remaining runs from 'left'.
@@ -1228,65 +1408,168 @@ mergeRecords(DynamicRecord& left, const DynamicRecord& right, ProducerBuffer<Ran
 
 //------------------------------------------------------------------------------
 
+/*
+  Partition the records into at most 'jobs' ranges with approximately equal total weight.
+  Record sizes are highly skewed, so ranges with equal numbers of records would give some
+  jobs most of the work. Returns ranges of record identifiers.
+*/
+std::vector<range_type>
+partitionByWeight(const std::vector<size_type>& weights, size_type jobs)
+{
+  size_type total = 0;
+  for(size_type weight : weights) { total += weight; }
+
+  std::vector<range_type> result;
+  if(total == 0) { return Range::partition(range_type(0, weights.size() - 1), jobs); }
+
+  // Close a range when the cumulative weight reaches the next multiple of total / jobs.
+  jobs = Range::bound(jobs, 1, weights.size());
+  size_type cumulative = 0, range_start = 0;
+  for(comp_type comp = 0; comp < weights.size(); comp++)
+  {
+    cumulative += weights[comp];
+    bool last = (comp + 1 == weights.size());
+    if(last || (result.size() + 1 < jobs && cumulative * jobs >= (result.size() + 1) * total))
+    {
+      result.push_back(range_type(range_start, comp));
+      range_start = comp + 1;
+    }
+  }
+  return result;
+}
+
+/*
+  Partition the nodes of the index into at most 'jobs' ranges with approximately equal total
+  record size in the index and the sources. Returns node ranges.
+*/
+std::vector<range_type>
+mergeJobRanges(const DynamicGBWT& index, const std::vector<const DynamicGBWT*>& sources, size_type jobs)
+{
+  std::vector<size_type> weights(index.effective());
+  for(comp_type comp = 0; comp < index.effective(); comp++)
+  {
+    node_type node = index.toNode(comp);
+    weights[comp] = index.nodeSize(node);
+    for(const DynamicGBWT* source : sources)
+    {
+      if(source->contains(node)) { weights[comp] += source->nodeSize(node); }
+    }
+  }
+
+  std::vector<range_type> result = partitionByWeight(weights, jobs);
+  for(range_type& range : result)
+  {
+    range.first = index.toNode(range.first);
+    range.second = index.toNode(range.second);
+  }
+  return result;
+}
+
 void
 DynamicGBWT::merge(const DynamicGBWT& source, const MergeParameters& parameters)
+{
+  this->merge(std::vector<const DynamicGBWT*>(1, &source), parameters);
+}
+
+void
+DynamicGBWT::merge(const std::vector<const DynamicGBWT*>& inputs, const MergeParameters& parameters)
 {
   double start = readTimer();
 
-  if(source.empty())
+  std::vector<const DynamicGBWT*> sources;
+  size_type total_size = 0, total_sequences = 0;
+  for(const DynamicGBWT* source : inputs)
+  {
+    if(source->empty()) { continue; }
+    sources.push_back(source);
+    total_size += source->size(); total_sequences += source->sequences();
+  }
+  if(sources.empty())
   {
     if(Verbosity::level >= Verbosity::FULL)
     {
-      std::cerr << "DynamicGBWT::merge(): The input GBWT is empty" << std::endl;
+      std::cerr << "DynamicGBWT::merge(): The input GBWTs are empty" << std::endl;
     }
     return;
   }
 
-  // The merged index is bidirectional only if both indexes are bidirectional.
-  if(!(source.bidirectional())) { this->header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
-
+  // The merged index is bidirectional only if all indexes are bidirectional.
   // Increase alphabet size and decrease offset if necessary.
-  this->resize(source.header.offset, source.sigma());
-
-  // Determine the node ranges for merge jobs.
-  std::vector<range_type> node_ranges = Range::partition(range_type(0, this->effective() - 1), parameters.merge_jobs);
-  for(range_type& range : node_ranges)
+  for(const DynamicGBWT* source : sources)
   {
-    range.first = this->toNode(range.first);
-    range.second = this->toNode(range.second);
+    if(!(source->bidirectional())) { this->header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
+    this->resize(source->header.offset, source->sigma());
   }
 
-  // Build the rank array.
+  // Determine the node ranges for merge jobs.
+  std::vector<range_type> node_ranges = mergeJobRanges(*this, sources, parameters.merge_jobs);
+
+  // Build the rank arrays. The sources share the memory budget for the rank arrays.
+  MergeProgress::phase("search");
   double ra_start = readTimer();
-  MergeBuffers mb(source.size(), omp_get_max_threads(), parameters, node_ranges);
-  buildRA(*this, source, mb);
+  std::vector<std::unique_ptr<MergeBuffers>> mb;
+  size_type ra_memory = parameters.raMemoryBytes();
+  for(size_type source_id = 0; source_id < sources.size(); source_id++)
+  {
+    MergeParameters source_parameters = parameters;
+    source_parameters.setRAMemory(ra_memory / MEGABYTE);
+    mb.emplace_back(new MergeBuffers(sources[source_id]->size(), omp_get_max_threads(), source_parameters, node_ranges));
+    buildRA(*this, sources, source_id, *(mb.back()));
+    ra_memory -= std::min(ra_memory, mb.back()->ra_memory);
+  }
   if(Verbosity::level >= Verbosity::BASIC)
   {
     double seconds = readTimer() - ra_start;
-    std::cerr << "DynamicGBWT::merge(): Rank array built in " << seconds << " seconds" << std::endl;
+    std::cerr << "DynamicGBWT::merge(): Rank arrays built in " << seconds << " seconds" << std::endl;
   }
 
   // Merge the records.
   double merge_start = readTimer();
-  #pragma omp parallel for schedule(static)
+  std::vector<size_type> sequence_offsets(sources.size(), this->sequences());
+  for(size_type i = 1; i < sources.size(); i++)
+  {
+    sequence_offsets[i] = sequence_offsets[i - 1] + sources[i - 1]->sequences();
+  }
+  size_type buffer_size = producerBufferSize(sources.size()); // Each job reads all rank arrays.
+  MergeProgress::phase("merge");
+  #pragma omp parallel for schedule(dynamic, 1)
   for(size_type job = 0; job < node_ranges.size(); job++)
   {
-    ProducerBuffer<RankArray> ra(*(mb.ra[job]));
+    double job_start = readTimer();
+    size_type job_records = 0;
+    std::vector<std::unique_ptr<ProducerBuffer<RankArray>>> ra;
+    for(size_type i = 0; i < sources.size(); i++)
+    {
+      RankArray& array = *(mb[i]->ra[job]);
+      array.buffer_size = buffer_size;
+      ra.emplace_back(new ProducerBuffer<RankArray>(array, buffer_size));
+    }
+    std::vector<DynamicRecord const*> records(sources.size(), nullptr);
     for(node_type node = node_ranges[job].first; node <= node_ranges[job].second; node++)
     {
-      if(!(source.contains(node))) { continue; }
-      mergeRecords(this->record(node), source.record(node), ra, node, this->sequences());
+      bool found = false;
+      for(size_type i = 0; i < sources.size(); i++)
+      {
+        records[i] = (sources[i]->contains(node) ? &(sources[i]->record(node)) : nullptr);
+        found |= (records[i] != nullptr);
+      }
+      if(!found) { continue; }
+      mergeRecords(this->record(node), records, ra, node, sequence_offsets);
+      if(this->record(node).outdegree() > 0) { job_records++; }
     }
+    MergeProgress::add(MergeProgress::records, job_records);
+    MergeProgress::job(job, job_records, readTimer() - job_start);
   }
   if(Verbosity::level >= Verbosity::BASIC)
   {
     double seconds = readTimer() - merge_start;
     std::cerr << "DynamicGBWT::merge(): Records merged in " << seconds << " seconds" << std::endl;
   }
+  mb.clear();
 
   // Merge the headers. Note that we need the original header for merging the records.
-  this->header.size += source.size();
-  this->header.sequences += source.sequences();
+  this->header.size += total_size;
+  this->header.sequences += total_sequences;
 
   // Rebuild the incoming edges from the record bodies and the outgoing edges. Then rebuild
   // the offsets in the outgoing edges from the incoming edges.
@@ -1294,114 +1577,571 @@ DynamicGBWT::merge(const DynamicGBWT& source, const MergeParameters& parameters)
   {
     std::cerr << "DynamicGBWT::merge(): Rebuilding the edges" << std::endl;
   }
+  MergeProgress::phase("rebuild");
+  double rebuild_start = readTimer();
   this->rebuildIncoming();
   this->rebuildOutgoing();
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - rebuild_start;
+    std::cerr << "DynamicGBWT::merge(): Edges rebuilt in " << seconds << " seconds" << std::endl;
+  }
 
   // Merge the metadata.
-  mergeMetadata(*this, source);
+  mergeMetadata(*this, sources);
 
   if(Verbosity::level >= Verbosity::BASIC)
   {
     double seconds = readTimer() - start;
-    std::cerr << "DynamicGBWT::merge(): Inserted " << source.sequences() << " sequences of total length "
-              << source.size() << " in " << seconds << " seconds" << std::endl;
+    std::cerr << "DynamicGBWT::merge(): Inserted " << total_sequences << " sequences of total length "
+              << total_size << " from " << sources.size() << " indexes in " << seconds << " seconds" << std::endl;
   }
 }
 
 //------------------------------------------------------------------------------
 
-size_type
-DynamicGBWT::tryLocate(node_type node, size_type i) const
+/*
+  A compressed GBWT used as a merge source. Compressed records do not store incoming
+  edges, so we build them from the outgoing edges. For each record, the incoming edges
+  are (predecessor, offset of the first position from it) in sorted order, and we also
+  store the size of the record. This allows computing countBefore() and fullLF() as with
+  DynamicRecord and DynamicGBWT. As usual, we do not store incoming edges for the endmarker.
+*/
+
+struct CompressedSource
 {
-  const DynamicRecord& record = this->record(node);
-  for(sample_type sample : record.ids)
+  const GBWT*            index;
+  std::vector<size_type> limits; // Incoming edges to record 'comp' are in [limits[comp], limits[comp + 1]).
+  std::vector<edge_type> incoming;
+  std::vector<size_type> sizes;
+
+  explicit CompressedSource(const GBWT& source);
+
+  size_type size(node_type node) const
   {
-    if(sample.first == i) { return sample.second; }
-    if(sample.first > i) { break; }
+    return (this->index->contains(node) ? this->sizes[this->index->toComp(node)] : 0);
   }
-  return invalid_sequence();
-}
-
-// FIXME This should really have a common implementation with GBWT::locate(state).
-std::vector<size_type>
-DynamicGBWT::locate(SearchState state) const
-{
-  std::vector<size_type> result;
-  if(!(this->contains(state))) { return result; }
 
-  // Initialize BWT positions for each offset in the range.
-  std::vector<edge_type> positions(state.size());
-  for(size_type i = state.range.first; i <= state.range.second; i++)
+  // Number of positions in the record of 'to' with predecessor < 'from'.
+  size_type countBefore(node_type to, node_type from) const
   {
-    positions[i - state.range.first] = edge_type(state.node, i);
+    if(!(this->index->contains(to)) || to == ENDMARKER) { return 0; }
+    comp_type comp = this->index->toComp(to);
+    auto begin = this->incoming.begin() + this->limits[comp], end = this->incoming.begin() + this->limits[comp + 1];
+    auto iter = std::lower_bound(begin, end, from, [](edge_type edge, node_type node) { return (edge.first < node); });
+    return (iter == end ? this->sizes[comp] : iter->second);
   }
 
-  // Continue with LF() until samples have been found for all sequences.
-  while(!(positions.empty()))
+  // As DynamicGBWT::fullLF().
+  size_type fullLF(edge_type position, node_type to) const
   {
-    size_type tail = 0;
-    node_type curr = invalid_node();
-    const DynamicRecord* current = nullptr;
-    std::vector<sample_type>::const_iterator sample;
-    edge_type LF_result;
-    range_type LF_range;
+    if(!(this->index->contains(to))) { return 0; }
+    if(this->index->contains(position.first))
+    {
+      size_type result = this->index->LF(position, to);
+      if(result != invalid_offset()) { return result; }
+    }
+    return this->countBefore(to, position.first);
+  }
+};
 
-    for(size_type i = 0; i < positions.size(); i++)
+CompressedSource::CompressedSource(const GBWT& source) :
+  index(&source),
+  limits(source.effective() + 1, 0), sizes(source.effective(), 0)
+{
+  // Decode the outgoing edges and the record sizes in parallel. The blocks are in order, so
+  // the incoming edges to each record will be sorted by predecessor.
+  std::vector<range_type> blocks = Range::partition(range_type(0, source.effective() - 1), 4 * omp_get_max_threads());
+  std::vector<std::vector<std::pair<comp_type, edge_type>>> edges(blocks.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
     {
-      if(positions[i].first != curr)  // Node changed.
-      {
-        curr = positions[i].first; current = &(this->record(curr));
-        sample = current->nextSample(positions[i].second);
-        LF_range.first = positions[i].second;
-        LF_result = current->runLF(positions[i].second, LF_range.second);
-      }
-      while(sample != current->ids.end() && sample->first < positions[i].second)  // Went past the sample.
-      {
-        ++sample;
-      }
-      if(sample == current->ids.end() || sample->first > positions[i].second) // Not sampled.
-      {
-        if(positions[i].second > LF_range.second) // Went past the existing LF() result.
-        {
-          LF_range.first = positions[i].second;
-          LF_result = current->runLF(positions[i].second, LF_range.second);
-        }
-        positions[tail] = edge_type(LF_result.first, LF_result.second + positions[i].second - LF_range.first);
-        tail++;
-      }
-      else  // Found a sample.
+      node_type from = source.toNode(comp);
+      CompressedRecord record = source.record(from);
+      this->sizes[comp] = record.size();
+      for(edge_type edge : record.outgoing)
       {
-        result.push_back(sample->second);
+        if(edge.first == ENDMARKER) { continue; }
+        edges[block].push_back(std::make_pair(source.toComp(edge.first), edge_type(from, edge.second)));
       }
     }
-    positions.resize(tail);
-    sequentialSort(positions.begin(), positions.end());
   }
 
-  removeDuplicates(result, false);
-  return result;
+  // Store the incoming edges.
+  for(const std::vector<std::pair<comp_type, edge_type>>& block : edges)
+  {
+    for(const std::pair<comp_type, edge_type>& edge : block) { this->limits[edge.first + 1]++; }
+  }
+  for(comp_type comp = 0; comp < source.effective(); comp++) { this->limits[comp + 1] += this->limits[comp]; }
+  this->incoming.resize(this->limits.back());
+  std::vector<size_type> tails(this->limits.begin(), this->limits.end() - 1);
+  for(std::vector<std::pair<comp_type, edge_type>>& block : edges)
+  {
+    for(const std::pair<comp_type, edge_type>& edge : block)
+    {
+      this->incoming[tails[edge.first]] = edge.second; tails[edge.first]++;
+    }
+    block = std::vector<std::pair<comp_type, edge_type>>();
+  }
 }
 
-//------------------------------------------------------------------------------
+/*
+  Builds the rank array of source 'source_id' relative to the other sources. The values are
+  final offsets in the merged records, as in buildRA() for DynamicGBWT. The sequences from
+  the source will get identifiers starting from 'sequence_offset'.
+*/
 
 void
-printStatistics(const DynamicGBWT& gbwt, const std::string& name)
+buildRA(const std::vector<CompressedSource>& sources, size_type source_id, size_type sequence_offset, MergeBuffers& buffers)
 {
-  printHeader("Dynamic GBWT"); std::cout << name;
-  if(gbwt.bidirectional()) { std::cout << " (bidirectional)"; }
-  std::cout << std::endl;
-  printHeader("Total length"); std::cout << gbwt.size() << std::endl;
-  printHeader("Sequences"); std::cout << gbwt.sequences() << std::endl;
-  printHeader("Alphabet size"); std::cout << gbwt.sigma() << std::endl;
-  printHeader("Effective"); std::cout << gbwt.effective() << std::endl;
-  printHeader("Runs"); std::cout << gbwt.runs() << std::endl;
-  printHeader("DA samples"); std::cout << gbwt.samples() << std::endl;
-  if(gbwt.hasMetadata())
-  {
-    printHeader("Metadata"); std::cout << gbwt.metadata << std::endl;
-  }
-  std::cout << std::endl;
-}
+  const GBWT& right = *(sources[source_id].index);
+
+  #pragma omp parallel for schedule(dynamic, buffers.parameters.chunk_size)
+  for(size_type sequence = 0; sequence < right.sequences(); sequence++)
+  {
+    size_type thread = omp_get_thread_num();
+    buffers.insert(edge_type(ENDMARKER, sequence_offset + sequence), thread);
+
+    // The new sequence will be after all sequences in the earlier sources and before all
+    // sequences in the later sources.
+    edge_type right_pos = right.start(sequence);
+    std::vector<edge_type> other_pos(sources.size(), edge_type(right_pos.first, 0));
+    for(size_type i = 0; i < source_id; i++)
+    {
+      other_pos[i].second = sources[i].countBefore(right_pos.first, ENDMARKER + 1);
+    }
+
+    // Main loop. We can assume that the positions are always valid.
+    while(right_pos.first != ENDMARKER)
+    {
+      size_type rank = right_pos.second;
+      for(size_type i = 0; i < sources.size(); i++)
+      {
+        if(i != source_id) { rank += other_pos[i].second; }
+      }
+      buffers.insert(edge_type(right_pos.first, rank), thread);
+      right_pos = right.LF(right_pos);
+      if(right_pos.first == ENDMARKER) { break; }
+      for(size_type i = 0; i < sources.size(); i++)
+      {
+        if(i != source_id) { other_pos[i] = edge_type(right_pos.first, sources[i].fullLF(other_pos[i], right_pos.first)); }
+      }
+    }
+    MergeProgress::add(MergeProgress::sequences, 1);
+  }
+
+  buffers.flush();
+}
+
+/*
+  Merged records from a range of nodes. The samples are (offset, id) with offsets relative
+  to the concatenation of the sampled records in the range.
+*/
+
+struct MergedRecords
+{
+  std::vector<byte_type>  data;
+  std::vector<size_type>  offsets;
+  std::vector<range_type> sampled_records, samples;
+  size_type               sample_offset = 0;
+};
+
+/*
+  Returns the samples in the given record of the source.
+*/
+
+std::vector<sample_type>
+recordSamples(const CompressedSource& source, node_type node)
+{
+  std::vector<sample_type> result;
+  if(!(source.index->contains(node))) { return result; }
+  comp_type comp = source.index->toComp(node);
+  size_type limit = source.sizes[comp];
+  sample_type sample = source.index->da_samples.nextSample(comp, 0);
+  while(sample.first < limit)
+  {
+    result.push_back(sample);
+    sample = source.index->da_samples.nextSample(comp, sample.first + 1);
+  }
+  return result;
+}
+
+/*
+  Merges the records of the node from all sources and appends the compressed record to the
+  result. The first source is the base, and the rank arrays are for the other sources. We
+  also need the record identifier in the merged index for the samples. Returns false if
+  the merged record is empty.
+*/
+
+bool
+mergeRecords(const std::vector<CompressedSource>& sources, std::vector<std::unique_ptr<ProducerBuffer<RankArray>>>& ra,
+             comp_type comp, node_type node, const std::vector<size_type>& sequence_offsets, MergedRecords& result)
+{
+  // Decode the records and determine the outgoing edges. The offset for each successor is
+  // the number of positions from smaller nodes in the successor in all sources.
+  std::vector<CompressedRecord> records(sources.size());
+  std::vector<std::vector<sample_type>> samples(sources.size());
+  DynamicRecord merged;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    if(!(sources[i].index->contains(node))) { continue; }
+    records[i] = sources[i].index->record(node);
+    samples[i] = recordSamples(sources[i], node);
+    merged.outgoing = mergeOutgoing(merged.outgoing, records[i].outgoing);
+  }
+  result.offsets.push_back(result.data.size());
+  if(merged.outdegree() == 0) { merged.writeBWT(result.data); return false; }
+  for(edge_type& edge : merged.outgoing)
+  {
+    edge.second = 0;
+    if(edge.first == ENDMARKER) { continue; }
+    for(const CompressedSource& source : sources) { edge.second += source.countBefore(edge.first, node); }
+  }
+  RunMerger new_body(merged.outdegree());
+  std::vector<sample_type> new_samples;
+
+  // Rank arrays contain the final offset of each element from the other sources. Iterators
+  // cannot be used with empty records.
+  std::vector<std::unique_ptr<CompressedRecordIterator>> iters(sources.size());
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    if(records[i].outdegree() > 0) { iters[i].reset(new CompressedRecordIterator(records[i])); }
+  }
+  const CompressedRecord& left = records[0];
+  CompressedRecordIterator* left_iter = iters[0].get();
+  auto left_sample_iter = samples[0].begin();
+  run_type left_run(0, 0);
+  std::vector<size_type> right_samples(sources.size(), 0), right_counts(sources.size(), 0);
+  std::vector<run_type> right_run(sources.size(), run_type(0, 0));
+  size_type insert_count = 0;
+  while(true)
+  {
+    // Find the source with the next value.
+    size_type next = sources.size();
+    for(size_type i = 1; i < sources.size(); i++)
+    {
+      if(ra[i - 1]->end() || (*(ra[i - 1]))->first != node) { continue; }
+      if(next >= sources.size() || (*(ra[i - 1]))->second < (*(ra[next - 1]))->second) { next = i; }
+    }
+    if(next >= sources.size()) { break; }
+    size_type offset = (*(ra[next - 1]))->second;
+
+    // Add runs from 'left'.
+    while(new_body.size() < offset)
+    {
+      if(left_run.second == 0) { left_run = recodeRun(**left_iter, left, merged.outgoing); ++(*left_iter); }
+      size_type insert_length = std::min(static_cast<size_type>(left_run.second), offset - new_body.size());
+      new_body.insert(run_type(left_run.first, insert_length));
+      left_run.second -= insert_length;
+    }
+    // Add samples from 'left'.
+    while(left_sample_iter != samples[0].end() && left_sample_iter->first + insert_count < offset)
+    {
+      new_samples.emplace_back(left_sample_iter->first + insert_count, left_sample_iter->second);
+      ++left_sample_iter;
+    }
+    // Add a single value and the possible sample from the source.
+    if(right_run[next].second == 0)
+    {
+      right_run[next] = recodeRun(**(iters[next]), records[next], merged.outgoing); ++(*(iters[next]));
+    }
+    new_body.insert(right_run[next].first);
+    if(right_samples[next] < samples[next].size() && samples[next][right_samples[next]].first == right_counts[next])
+    {
+      new_samples.emplace_back(offset, samples[next][right_samples[next]].second + sequence_offsets[next]);
+      right_samples[next]++;
+    }
+    right_run[next].second--; right_counts[next]++; insert_count++;
+    ++(*(ra[next - 1]));
+  }
+
+  // Add the remaining runs from 'left'.
+  if(left_run.second > 0) { new_body.insert(left_run); }
+  while(left_iter != nullptr && !(left_iter->end()))
+  {
+    new_body.insert(recodeRun(**left_iter, left, merged.outgoing)); ++(*left_iter);
+  }
+  // Add the remaining samples from 'left'.
+  while(left_sample_iter != samples[0].end())
+  {
+    new_samples.emplace_back(left_sample_iter->first + insert_count, left_sample_iter->second);
+    ++left_sample_iter;
+  }
+
+  // Compress the record and store the samples.
+  swapBody(merged, new_body);
+  merged.writeBWT(result.data);
+  if(!(new_samples.empty()))
+  {
+    for(sample_type sample : new_samples)
+    {
+      result.samples.push_back(range_type(result.sample_offset + sample.first, sample.second));
+    }
+    result.sampled_records.push_back(range_type(comp, merged.size()));
+    result.sample_offset += merged.size();
+  }
+  return true;
+}
+
+GBWT
+mergeCompressed(const std::vector<const GBWT*>& inputs, const MergeParameters& parameters)
+{
+  double start = readTimer();
+
+  std::vector<const GBWT*> indexes;
+  for(const GBWT* source : inputs)
+  {
+    if(!(source->empty())) { indexes.push_back(source); }
+  }
+  if(indexes.empty())
+  {
+    if(Verbosity::level >= Verbosity::FULL)
+    {
+      std::cerr << "mergeCompressed(): The input GBWTs are empty" << std::endl;
+    }
+    return GBWT();
+  }
+  if(indexes.size() == 1) { return *(indexes.front()); }
+
+  // Merge the headers. The merged index is bidirectional only if all indexes are bidirectional.
+  GBWTHeader header = indexes.front()->header;
+  header.sequences = 0; header.size = 0;
+  header.unset(GBWTHeader::FLAG_METADATA);
+  for(const GBWT* source : indexes)
+  {
+    header.sequences += source->sequences();
+    header.size += source->size();
+    header.offset = std::min(header.offset, source->header.offset);
+    header.alphabet_size = std::max(header.alphabet_size, source->header.alphabet_size);
+    if(!(source->bidirectional())) { header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
+  }
+  size_type records = header.alphabet_size - header.offset;
+  auto to_node = [&header](comp_type comp) -> node_type { return (comp == 0 ? comp : comp + header.offset); };
+
+  // Build the incoming edges.
+  MergeProgress::phase("incoming");
+  double incoming_start = readTimer();
+  std::vector<CompressedSource> sources;
+  sources.reserve(indexes.size());
+  for(const GBWT* source : indexes) { sources.emplace_back(*source); }
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - incoming_start;
+    std::cerr << "mergeCompressed(): Incoming edges built in " << seconds << " seconds" << std::endl;
+  }
+
+  // Determine the node ranges for merge jobs.
+  std::vector<size_type> weights(records, 0);
+  for(comp_type comp = 0; comp < records; comp++)
+  {
+    for(const CompressedSource& source : sources) { weights[comp] += source.size(to_node(comp)); }
+  }
+  std::vector<range_type> comp_ranges = partitionByWeight(weights, parameters.merge_jobs);
+  weights = std::vector<size_type>();
+  std::vector<range_type> node_ranges = comp_ranges;
+  for(range_type& range : node_ranges)
+  {
+    range.first = to_node(range.first);
+    range.second = to_node(range.second);
+  }
+
+  // Build the rank arrays for all sources except the first one. The sources share the memory
+  // budget for the rank arrays.
+  MergeProgress::phase("search");
+  double ra_start = readTimer();
+  std::vector<size_type> sequence_offsets(sources.size(), 0);
+  for(size_type i = 1; i < sources.size(); i++)
+  {
+    sequence_offsets[i] = sequence_offsets[i - 1] + indexes[i - 1]->sequences();
+  }
+  std::vector<std::unique_ptr<MergeBuffers>> mb;
+  size_type ra_memory = parameters.raMemoryBytes();
+  for(size_type source_id = 1; source_id < sources.size(); source_id++)
+  {
+    MergeParameters source_parameters = parameters;
+    source_parameters.setRAMemory(ra_memory / MEGABYTE);
+    mb.emplace_back(new MergeBuffers(indexes[source_id]->size(), omp_get_max_threads(), source_parameters, node_ranges));
+    buildRA(sources, source_id, sequence_offsets[source_id], *(mb.back()));
+    ra_memory -= std::min(ra_memory, mb.back()->ra_memory);
+  }
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - ra_start;
+    std::cerr << "mergeCompressed(): Rank arrays built in " << seconds << " seconds" << std::endl;
+  }
+
+  // Merge the records.
+  double merge_start = readTimer();
+  std::vector<MergedRecords> merged(node_ranges.size());
+  size_type buffer_size = producerBufferSize(mb.size()); // Each job reads all rank arrays.
+  MergeProgress::phase("merge");
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type job = 0; job < node_ranges.size(); job++)
+  {
+    double job_start = readTimer();
+    size_type job_records = 0;
+    std::vector<std::unique_ptr<ProducerBuffer<RankArray>>> ra;
+    for(size_type i = 0; i < mb.size(); i++)
+    {
+      RankArray& array = *(mb[i]->ra[job]);
+      array.buffer_size = buffer_size;
+      ra.emplace_back(new ProducerBuffer<RankArray>(array, buffer_size));
+    }
+    for(comp_type comp = comp_ranges[job].first; comp <= comp_ranges[job].second; comp++)
+    {
+      if(mergeRecords(sources, ra, comp, to_node(comp), sequence_offsets, merged[job])) { job_records++; }
+    }
+    MergeProgress::add(MergeProgress::records, job_records);
+    MergeProgress::job(job, job_records, readTimer() - job_start);
+  }
+  mb.clear();
+  sources.clear();
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - merge_start;
+    std::cerr << "mergeCompressed(): Records merged in " << seconds << " seconds" << std::endl;
+  }
+
+  // Concatenate the records and the samples from the merge jobs.
+  MergeProgress::phase("assemble");
+  RecordArray bwt(records);
+  std::vector<size_type> offsets;
+  std::vector<range_type> sampled_records, samples;
+  size_type sample_offset = 0;
+  for(MergedRecords& job : merged)
+  {
+    for(size_type offset : job.offsets) { offsets.push_back(bwt.data.size() + offset); }
+    bwt.data.insert(bwt.data.end(), job.data.begin(), job.data.end());
+    sampled_records.insert(sampled_records.end(), job.sampled_records.begin(), job.sampled_records.end());
+    for(range_type sample : job.samples) { samples.push_back(range_type(sample_offset + sample.first, sample.second)); }
+    sample_offset += job.sample_offset;
+    job = MergedRecords();
+  }
+  bwt.buildIndex(offsets);
+  DASamples da_samples(records, sampled_records, samples);
+  GBWT result(header, std::move(bwt), std::move(da_samples));
+
+  // Merge the metadata.
+  bool has_metadata = true;
+  for(const GBWT* source : indexes) { has_metadata &= source->hasMetadata(); }
+  if(has_metadata)
+  {
+    std::vector<const Metadata*> source_metadata;
+    for(const GBWT* source : indexes) { source_metadata.push_back(&(source->metadata)); }
+    result.metadata = Metadata(source_metadata, false, true); // Different samples, same contigs.
+    result.addMetadata();
+  }
+  else if(indexes.front()->hasMetadata() && Verbosity::level >= Verbosity::BASIC)
+  {
+    std::cerr << "mergeCompressed(): Clearing metadata: no metadata in some sources" << std::endl;
+  }
+
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "mergeCompressed(): Merged " << header.sequences << " sequences of total length "
+              << header.size << " from " << indexes.size() << " indexes in " << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+size_type
+DynamicGBWT::tryLocate(node_type node, size_type i) const
+{
+  const DynamicRecord& record = this->record(node);
+  for(sample_type sample : record.ids)
+  {
+    if(sample.first == i) { return sample.second; }
+    if(sample.first > i) { break; }
+  }
+  return invalid_sequence();
+}
+
+// FIXME This should really have a common implementation with GBWT::locate(state).
+std::vector<size_type>
+DynamicGBWT::locate(SearchState state) const
+{
+  std::vector<size_type> result;
+  if(!(this->contains(state))) { return result; }
+
+  // Initialize BWT positions for each offset in the range.
+  std::vector<edge_type> positions(state.size());
+  for(size_type i = state.range.first; i <= state.range.second; i++)
+  {
+    positions[i - state.range.first] = edge_type(state.node, i);
+  }
+
+  // Continue with LF() until samples have been found for all sequences.
+  while(!(positions.empty()))
+  {
+    size_type tail = 0;
+    node_type curr = invalid_node();
+    const DynamicRecord* current = nullptr;
+    record_vector<sample_type>::const_iterator sample;
+    edge_type LF_result;
+    range_type LF_range;
+
+    for(size_type i = 0; i < positions.size(); i++)
+    {
+      if(positions[i].first != curr)  // Node changed.
+      {
+        curr = positions[i].first; current = &(this->record(curr));
+        sample = current->nextSample(positions[i].second);
+        LF_range.first = positions[i].second;
+        LF_result = current->runLF(positions[i].second, LF_range.second);
+      }
+      while(sample != current->ids.end() && sample->first < positions[i].second)  // Went past the sample.
+      {
+        ++sample;
+      }
+      if(sample == current->ids.end() || sample->first > positions[i].second) // Not sampled.
+      {
+        if(positions[i].second > LF_range.second) // Went past the existing LF() result.
+        {
+          LF_range.first = positions[i].second;
+          LF_result = current->runLF(positions[i].second, LF_range.second);
+        }
+        positions[tail] = edge_type(LF_result.first, LF_result.second + positions[i].second - LF_range.first);
+        tail++;
+      }
+      else  // Found a sample.
+      {
+        result.push_back(sample->second);
+      }
+    }
+    positions.resize(tail);
+    sequentialSort(positions.begin(), positions.end());
+  }
+
+  removeDuplicates(result, false);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+void
+printStatistics(const DynamicGBWT& gbwt, const std::string& name)
+{
+  printHeader("Dynamic GBWT"); std::cout << name;
+  if(gbwt.bidirectional()) { std::cout << " (bidirectional)"; }
+  std::cout << std::endl;
+  printHeader("Total length"); std::cout << gbwt.size() << std::endl;
+  printHeader("Sequences"); std::cout << gbwt.sequences() << std::endl;
+  printHeader("Alphabet size"); std::cout << gbwt.sigma() << std::endl;
+  printHeader("Effective"); std::cout << gbwt.effective() << std::endl;
+  printHeader("Runs"); std::cout << gbwt.runs() << std::endl;
+  printHeader("DA samples"); std::cout << gbwt.samples() << std::endl;
+  if(gbwt.hasMetadata())
+  {
+    printHeader("Metadata"); std::cout << gbwt.metadata << std::endl;
+  }
+  std::cout << std::endl;
+}
 
 //------------------------------------------------------------------------------
 
@@ -1495,4 +2235,704 @@ GBWTBuilder::flush()
 
 //------------------------------------------------------------------------------
 
+PartitionedGBWTBuilder::PartitionedGBWTBuilder(const std::vector<size_type>& first_ids, size_type node_width, size_type batch_size, size_type sample_interval) :
+  first_ids(first_ids)
+{
+  if(this->first_ids.empty()) { this->first_ids.push_back(0); }
+  if(!std::is_sorted(this->first_ids.begin(), this->first_ids.end()))
+  {
+    std::cerr << "PartitionedGBWTBuilder::PartitionedGBWTBuilder(): Partition boundaries are not sorted" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  for(size_type i = 0; i < this->partitions(); i++)
+  {
+    this->builders.emplace_back(new Partition(node_width, batch_size, sample_interval));
+  }
+}
+
+size_type
+PartitionedGBWTBuilder::partition(node_type node) const
+{
+  auto iter = std::upper_bound(this->first_ids.begin() + 1, this->first_ids.end(), Node::id(node));
+  return (iter - this->first_ids.begin()) - 1;
+}
+
+bool
+PartitionedGBWTBuilder::insert(const vector_type& sequence, bool both_orientations)
+{
+  size_type partition_id = (sequence.empty() ? 0 : this->partition(sequence.front()));
+  for(auto node : sequence)
+  {
+    if(this->partition(node) != partition_id)
+    {
+      if(Verbosity::level >= Verbosity::FULL)
+      {
+        std::cerr << "PartitionedGBWTBuilder::insert(): Sequence spans multiple partitions, skipping" << std::endl;
+      }
+      return false;
+    }
+  }
+
+  Partition& target = *(this->builders[partition_id]);
+  std::lock_guard<std::mutex> lock(target.mtx);
+  target.builder.insert(sequence, both_orientations);
+  return true;
+}
+
+void
+PartitionedGBWTBuilder::finish()
+{
+  // Finish and compress the partitions in parallel.
+  std::vector<GBWT> sources(this->partitions());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type i = 0; i < this->partitions(); i++)
+  {
+    GBWTBuilder& builder = this->builders[i]->builder;
+    builder.finish();
+    sources[i] = GBWT(std::move(builder.index));
+  }
+  this->builders.clear();
+
+  // Merge the nonempty partitions.
+  sources.erase(std::remove_if(sources.begin(), sources.end(), [](const GBWT& source) { return source.empty(); }), sources.end());
+  if(sources.size() == 1) { this->index = std::move(sources.front()); }
+  else { this->index = GBWT(sources); }
+}
+
+//------------------------------------------------------------------------------
+
+// Extract the given sequences from the source in parallel chunks, translate the node ids
+// if necessary, and insert the sequences into a new index in the same order. The chunks
+// are inserted with GBWTBuilder while the next chunk is being extracted.
+GBWT
+rebuildSequences(const GBWT& source, const std::vector<size_type>& path_ids, const std::vector<size_type>* translation,
+                 size_type batch_size, size_type sample_interval)
+{
+  size_type max_node = source.sigma() - 1;
+  if(translation != nullptr && !(translation->empty()))
+  {
+    max_node = Node::encode(*std::max_element(translation->begin(), translation->end()), true);
+  }
+  GBWTBuilder builder(bit_length(max_node), batch_size, sample_interval);
+  size_type chunk_size = 16 * omp_get_max_threads();
+  std::vector<vector_type> chunk;
+  for(size_type chunk_start = 0; chunk_start < path_ids.size(); chunk_start += chunk_size)
+  {
+    size_type chunk_end = std::min(chunk_start + chunk_size, path_ids.size());
+    chunk.resize(chunk_end - chunk_start);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_type i = chunk_start; i < chunk_end; i++)
+    {
+      size_type seq_id = (source.bidirectional() ? Path::encode(path_ids[i], false) : path_ids[i]);
+      vector_type& sequence = chunk[i - chunk_start];
+      sequence = source.extract(seq_id);
+      if(translation != nullptr)
+      {
+        for(auto& node : sequence)
+        {
+          node = Node::encode((*translation)[Node::id(node)], Node::is_reverse(node));
+        }
+      }
+    }
+    for(const vector_type& sequence : chunk) { builder.insert(sequence, source.bidirectional()); }
+  }
+  builder.finish();
+
+  return GBWT(std::move(builder.index));
+}
+
+GBWT
+subset(const GBWT& source, std::vector<size_type> path_ids, size_type batch_size, size_type sample_interval)
+{
+  double start = readTimer();
+
+  removeDuplicates(path_ids, false);
+  size_type paths = (source.bidirectional() ? source.sequences() / 2 : source.sequences());
+  if(path_ids.empty())
+  {
+    if(Verbosity::level >= Verbosity::FULL)
+    {
+      std::cerr << "subset(): No paths to select" << std::endl;
+    }
+    return GBWT();
+  }
+  if(path_ids.back() >= paths)
+  {
+    std::cerr << "subset(): Invalid path id: " << path_ids.back() << std::endl;
+    return GBWT();
+  }
+
+  GBWT result = rebuildSequences(source, path_ids, nullptr, batch_size, sample_interval);
+  if(source.hasMetadata())
+  {
+    result.addMetadata();
+    result.metadata = source.metadata;
+    result.metadata.subset(path_ids);
+  }
+
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "subset(): Selected " << path_ids.size() << " paths (" << result.size() << " nodes) in "
+              << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+std::vector<size_type>
+bfsOrder(const GBWT& index)
+{
+  std::vector<size_type> translation;
+  if(index.empty()) { return translation; }
+
+  // Node ids in the effective alphabet, in the original order.
+  size_type first_id = Node::id(index.toNode(1)), limit_id = Node::id(index.sigma() - 1) + 1;
+  translation = std::vector<size_type>(limit_id, 0);
+
+  // Visit the node ids in BFS order over the edges, starting from the successors of
+  // the endmarker. Both orientations of a node get the same id.
+  std::vector<size_type> order;
+  sdsl::bit_vector visited(limit_id, 0);
+  std::queue<node_type> queue;
+  auto visit = [&](const CompressedRecord& record)
+  {
+    for(const edge_type& edge : record.outgoing)
+    {
+      if(edge.first == ENDMARKER || visited[Node::id(edge.first)]) { continue; }
+      visited[Node::id(edge.first)] = 1;
+      order.push_back(Node::id(edge.first));
+      queue.push(edge.first);
+    }
+  };
+  visit(index.record(ENDMARKER));
+  while(!(queue.empty()))
+  {
+    visit(index.record(queue.front()));
+    queue.pop();
+  }
+
+  // Unreachable ids keep their relative order after the reachable ones.
+  for(size_type id = first_id; id < limit_id; id++)
+  {
+    if(!visited[id]) { order.push_back(id); }
+  }
+  for(size_type i = 0; i < order.size(); i++) { translation[order[i]] = first_id + i; }
+
+  return translation;
+}
+
+GBWT
+renumber(const GBWT& source, const std::vector<size_type>& translation, size_type batch_size, size_type sample_interval)
+{
+  double start = readTimer();
+
+  if(source.empty()) { return GBWT(); }
+  if(translation.size() <= Node::id(source.sigma() - 1))
+  {
+    std::cerr << "renumber(): The translation table does not cover all node ids" << std::endl;
+    return GBWT();
+  }
+
+  std::vector<size_type> path_ids(source.bidirectional() ? source.sequences() / 2 : source.sequences());
+  for(size_type i = 0; i < path_ids.size(); i++) { path_ids[i] = i; }
+  GBWT result = rebuildSequences(source, path_ids, &translation, batch_size, sample_interval);
+  if(source.hasMetadata())
+  {
+    result.addMetadata();
+    result.metadata = source.metadata;
+  }
+
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "renumber(): Rebuilt " << path_ids.size() << " paths (" << result.size() << " nodes) in "
+              << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Direct construction in external memory.
+
+  Let $_j v_0 ... v_{L-1} be sequence j with its endmarker moved to the front. The items are
+  the positions in the concatenation of these strings, and item d in sequence j is in the
+  record of node v_{d-1} (or the endmarker if d == 0). The GBWT orders the items by the
+  reverse prefixes v_{d-1} ... v_0 $_j, where the endmarkers are smaller than the nodes
+  and ordered by sequence id. The BWT stores the successor of each item.
+
+  Prefix doubling: the rank of an item is the number of items with a smaller reverse prefix
+  of length h. The rank for length 2h is determined by the pair (rank of t, rank of t - h).
+  Once the rank of an item is unique, it no longer changes, and the item is skipped in the
+  later steps. Items with the endmarker in the prefix are always unique, so t - h is in
+  the same sequence for the remaining items. The rank file stores (rank << 1) | unique for
+  each item. Each step sorts the pairs for the remaining items and then the new ranks by
+  item in external memory. Finally we sort (rank, node, successor, sample) and write the
+  records in that order.
+*/
+
+void
+forEachSequence(const std::vector<std::string>& text_files, bool both_orientations, const std::function<void(const vector_type&)>& output)
+{
+  vector_type sequence, reverse;
+  for(const std::string& filename : text_files)
+  {
+    text_buffer_type text(filename);
+    if(text.size() > 0 && text[text.size() - 1] != ENDMARKER)
+    {
+      std::cerr << "buildExternal(): The text in " << filename << " must end with an endmarker" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    for(size_type i = 0; i < text.size(); i++)
+    {
+      if(text[i] != ENDMARKER) { sequence.push_back(text[i]); continue; }
+      output(sequence);
+      if(both_orientations)
+      {
+        reversePath(sequence, reverse);
+        output(reverse);
+        reverse.clear();
+      }
+      sequence.clear();
+    }
+  }
+}
+
+// Replaces the ranks of the items with the ranks of their reverse prefixes of length 2h.
+// The new ranks are written to a new temporary file, which replaces rank_file.
+// Returns the number of items without a unique rank.
+size_type
+doublePrefixLength(std::string& rank_file, size_type total_size, size_type h, size_type buffer_size)
+{
+  ExternalSorter<3> pairs(buffer_size);
+  {
+    sdsl::int_vector_buffer<8> curr(rank_file, std::ios::in, MEGABYTE), lag(rank_file, std::ios::in, MEGABYTE);
+    size_type curr_pointer = 0, lag_pointer = 0, lag_items = 0, lag_value = 0;
+    for(size_type item = 0; item < total_size; item++)
+    {
+      size_type value = ByteCode::read(curr, curr_pointer);
+      if(value & 1) { continue; }
+      while(lag_items <= item - h) { lag_value = ByteCode::read(lag, lag_pointer); lag_items++; }
+      pairs.push({ { value >> 1, lag_value >> 1, item } });
+    }
+  }
+  pairs.finish();
+
+  // An item is unique if its pair differs from the previous and the next pairs.
+  ExternalSorter<2> updates(buffer_size);
+  size_type remaining = 0, group_offset = 0, rank = 0;
+  size_type prev_first = 0, prev_second = 0, pending_item = 0, pending_rank = 0;
+  bool has_pending = false, pending_shared = false;
+  for(; !(pairs.end()); ++pairs)
+  {
+    bool same_group = (has_pending && (*pairs)[0] == prev_first);
+    bool same_pair = (same_group && (*pairs)[1] == prev_second);
+    if(!same_group) { group_offset = 0; }
+    if(!same_pair) { rank = (*pairs)[0] + group_offset; }
+    if(has_pending)
+    {
+      bool unique = !(pending_shared || same_pair);
+      updates.push({ { pending_item, (pending_rank << 1) | unique } });
+      if(!unique) { remaining++; }
+    }
+    pending_item = (*pairs)[2]; pending_rank = rank; pending_shared = same_pair; has_pending = true;
+    prev_first = (*pairs)[0]; prev_second = (*pairs)[1]; group_offset++;
+  }
+  if(has_pending)
+  {
+    updates.push({ { pending_item, (pending_rank << 1) | !pending_shared } });
+    if(pending_shared) { remaining++; }
+  }
+  updates.finish();
+
+  // Merge the updates with the old ranks.
+  std::string new_file = TempFile::getName(RankArray::TEMP_FILE_PREFIX);
+  {
+    sdsl::int_vector_buffer<8> in(rank_file, std::ios::in, MEGABYTE), out(new_file, std::ios::out, MEGABYTE);
+    size_type in_pointer = 0;
+    for(size_type item = 0; item < total_size; item++)
+    {
+      size_type value = ByteCode::read(in, in_pointer);
+      if(!(updates.end()) && (*updates)[0] == item) { value = (*updates)[1]; ++updates; }
+      ByteCode::write(out, value);
+    }
+    out.close();
+  }
+  TempFile::remove(rank_file);
+  rank_file = new_file;
+
+  return remaining;
+}
+
+// Writes the record with the given successors. Updates the number of incoming edges to
+// each successor from the records written so far.
+void
+writeExternalRecord(const std::vector<node_type>& successors, std::vector<size_type>& incoming, const GBWTHeader& header,
+                    std::vector<byte_type>& data)
+{
+  std::vector<node_type> edges(successors);
+  removeDuplicates(edges, false);
+
+  DynamicRecord record;
+  for(node_type next : edges)
+  {
+    size_type offset = (next == ENDMARKER ? 0 : incoming[next - header.offset]);
+    record.outgoing.push_back(edge_type(next, offset));
+  }
+  for(node_type next : successors)
+  {
+    rank_type outrank = std::lower_bound(edges.begin(), edges.end(), next) - edges.begin();
+    if(!(record.body.empty()) && record.body.back().first == outrank) { record.body.back().second++; }
+    else { record.body.push_back(run_type(outrank, 1)); }
+    record.body_size++;
+    if(next != ENDMARKER) { incoming[next - header.offset]++; }
+  }
+  record.writeBWT(data);
+}
+
+GBWT
+buildExternal(const std::vector<std::string>& text_files, bool both_orientations, size_type sample_interval, size_type buffer_size)
+{
+  double start = readTimer();
+  if(sample_interval == 0) { sample_interval = ~(size_type)0; }
+
+  // Determine the number of sequences, the alphabet, and the number of occurrences of each node.
+  std::vector<size_type> node_counts;
+  node_type min_node = ~(node_type)0, max_node = 0;
+  size_type sequences = 0, total_size = 0;
+  forEachSequence(text_files, both_orientations, [&](const vector_type& sequence)
+  {
+    sequences++;
+    total_size += sequence.size() + 1;
+    for(node_type node : sequence)
+    {
+      min_node = std::min(min_node, node); max_node = std::max(max_node, node);
+      if(node >= node_counts.size()) { node_counts.resize(std::max(node + 1, 2 * node_counts.size()), 0); }
+      node_counts[node]++;
+    }
+  });
+  if(total_size == 0) { return GBWT(); }
+  if(max_node == 0) { min_node = 1; } // No real nodes, setting offset to 0.
+  node_counts.resize(max_node + 1, 0);
+  node_counts.erase(node_counts.begin(), node_counts.begin() + (min_node - 1));
+  node_counts[0] = 0; // Endmarkers are not included in the counts.
+
+  GBWTHeader header;
+  header.sequences = sequences;
+  header.size = total_size;
+  header.offset = min_node - 1;
+  header.alphabet_size = max_node + 1;
+  if(!both_orientations) { header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
+
+  // Initial ranks by the first node of the prefix. Endmarkers are unique.
+  size_type records = header.alphabet_size - header.offset;
+  std::vector<size_type> counts(records, 0);
+  for(size_type comp = 0, cumulative = header.sequences; comp < records; comp++)
+  {
+    cumulative += node_counts[comp]; counts[comp] = cumulative - node_counts[comp];
+  }
+  std::string rank_file = TempFile::getName(RankArray::TEMP_FILE_PREFIX);
+  {
+    sdsl::int_vector_buffer<8> out(rank_file, std::ios::out, MEGABYTE);
+    size_type seq_id = 0;
+    forEachSequence(text_files, both_orientations, [&](const vector_type& sequence)
+    {
+      ByteCode::write(out, (seq_id << 1) | 1); seq_id++;
+      for(node_type node : sequence)
+      {
+        comp_type comp = node - header.offset;
+        ByteCode::write(out, (counts[comp] << 1) | (node_counts[comp] == 1));
+      }
+    });
+    out.close();
+  }
+  node_counts = std::vector<size_type>();
+
+  // Prefix doubling.
+  for(size_type h = 1; ; h *= 2)
+  {
+    double step_start = readTimer();
+    size_type remaining = doublePrefixLength(rank_file, total_size, h, buffer_size);
+    if(Verbosity::level >= Verbosity::EXTENDED)
+    {
+      double seconds = readTimer() - step_start;
+      std::cerr << "buildExternal(): " << remaining << " items without unique prefixes of length " << (2 * h) << " (" << seconds << " seconds)" << std::endl;
+    }
+    if(remaining == 0) { break; }
+  }
+
+  // Sort the items by rank. Samples are stored as sequence id + 1.
+  ExternalSorter<4> items(buffer_size);
+  {
+    sdsl::int_vector_buffer<8> in(rank_file, std::ios::in, MEGABYTE);
+    size_type rank_pointer = 0, seq_id = 0;
+    forEachSequence(text_files, both_orientations, [&](const vector_type& sequence)
+    {
+      for(size_type d = 0; d <= sequence.size(); d++)
+      {
+        size_type rank = ByteCode::read(in, rank_pointer);
+        node_type curr = (d > 0 ? sequence[d - 1] : ENDMARKER);
+        node_type next = (d < sequence.size() ? sequence[d] : ENDMARKER);
+        size_type sample = ((d + 1) % sample_interval == 0 || next == ENDMARKER ? seq_id + 1 : 0);
+        items.push({ { rank, curr, next, sample } });
+      }
+      seq_id++;
+    });
+  }
+  TempFile::remove(rank_file);
+  items.finish();
+
+  // Write the records and collect the samples. The counts are reused for incoming edges.
+  RecordArray bwt(records);
+  std::vector<size_type> offsets;
+  std::vector<size_type>& incoming = counts;
+  std::fill(incoming.begin(), incoming.end(), 0);
+  std::vector<range_type> sampled_records, samples;
+  std::vector<node_type> successors;
+  size_type sample_offset = 0;
+  while(offsets.size() < records)
+  {
+    comp_type comp = offsets.size();
+    offsets.push_back(bwt.data.size());
+    successors.clear();
+    size_type first_sample = samples.size();
+    while(!(items.end()))
+    {
+      node_type curr = (*items)[1];
+      if((curr == ENDMARKER ? 0 : curr - header.offset) != comp) { break; }
+      if((*items)[3] > 0) { samples.push_back(range_type(sample_offset + successors.size(), (*items)[3] - 1)); }
+      successors.push_back((*items)[2]);
+      ++items;
+    }
+    writeExternalRecord(successors, incoming, header, bwt.data);
+    if(samples.size() > first_sample)
+    {
+      sampled_records.push_back(range_type(comp, successors.size()));
+      sample_offset += successors.size();
+    }
+  }
+  bwt.buildIndex(offsets);
+  DASamples da_samples(records, sampled_records, samples);
+  GBWT result(header, std::move(bwt), std::move(da_samples));
+
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "buildExternal(): Indexed " << result.sequences() << " sequences (" << result.size() << " nodes) in "
+              << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Bulk construction uses the same ordering as buildExternal(), but item i is text position i,
+  and the items are sorted in memory. The current node of item i is text[i - 1], or the
+  endmarker if i starts a sequence, and the successor is text[i]. We keep the items sorted
+  by their current ranks, where the rank of an item is the starting position of its group
+  of equal reverse prefixes. Each step only sorts the groups of size > 1 by the ranks of
+  the items h positions earlier, as in Larsson-Sadakane suffix sorting. The groups are
+  independent, so they are sorted in parallel.
+*/
+
+// Sorts the groups by the ranks of the prefixes of length h that precede the current
+// prefixes and updates the ranks. Replaces the groups with the groups that are still
+// not unique.
+void
+refineGroups(std::vector<size_type>& items, std::vector<size_type>& ranks, std::vector<size_type>& keys,
+             std::vector<range_type>& groups, size_type h)
+{
+  std::vector<range_type> blocks = Range::partition(range_type(0, groups.size() - 1), 4 * omp_get_max_threads());
+
+  // Sort the groups. Keys must be stored separately, as the ranks are not updated yet.
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    std::vector<range_type> buffer;
+    for(size_type group = blocks[block].first; group <= blocks[block].second; group++)
+    {
+      range_type range = groups[group];
+      buffer.clear();
+      for(size_type i = range.first; i <= range.second; i++)
+      {
+        buffer.push_back(range_type(ranks[items[i] - h], items[i]));
+      }
+      sequentialSort(buffer.begin(), buffer.end());
+      for(size_type i = range.first; i <= range.second; i++)
+      {
+        keys[i] = buffer[i - range.first].first; items[i] = buffer[i - range.first].second;
+      }
+    }
+  }
+
+  // Update the ranks and determine the new groups.
+  std::vector<std::vector<range_type>> new_groups(blocks.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    for(size_type group = blocks[block].first; group <= blocks[block].second; group++)
+    {
+      range_type range = groups[group];
+      for(size_type i = range.first; i <= range.second; )
+      {
+        size_type limit = i + 1;
+        while(limit <= range.second && keys[limit] == keys[i]) { limit++; }
+        for(size_type j = i; j < limit; j++) { ranks[items[j]] = i; }
+        if(limit - i > 1) { new_groups[block].push_back(range_type(i, limit - 1)); }
+        i = limit;
+      }
+    }
+  }
+
+  groups.clear();
+  for(const std::vector<range_type>& block_groups : new_groups)
+  {
+    groups.insert(groups.end(), block_groups.begin(), block_groups.end());
+  }
+}
+
+GBWT
+buildBulk(const text_type& text, bool has_both_orientations, size_type sample_interval)
+{
+  double start = readTimer();
+  if(text.size() == 0) { return GBWT(); }
+  if(text[text.size() - 1] != ENDMARKER)
+  {
+    std::cerr << "buildBulk(): The text must end with an endmarker" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if(sample_interval == 0) { sample_interval = ~(size_type)0; }
+
+  // Determine the sequences, the alphabet, and the number of occurrences of each node.
+  std::vector<size_type> sequence_starts(1, 0);
+  node_type min_node = ~(node_type)0, max_node = 0;
+  for(size_type i = 0; i < text.size(); i++)
+  {
+    if(text[i] == ENDMARKER) { sequence_starts.push_back(i + 1); }
+    else { min_node = std::min(min_node, (node_type)text[i]); max_node = std::max(max_node, (node_type)text[i]); }
+  }
+  size_type sequences = sequence_starts.size() - 1;
+  if(max_node == 0) { min_node = 1; } // No real nodes, setting offset to 0.
+
+  GBWTHeader header;
+  header.sequences = sequences;
+  header.size = text.size();
+  header.offset = min_node - 1;
+  header.alphabet_size = max_node + 1;
+  if(!has_both_orientations) { header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
+
+  // Initial ranks by the first node of the prefix. Endmarkers are unique.
+  size_type records = header.alphabet_size - header.offset;
+  std::vector<size_type> counts(records, 0);
+  for(size_type i = 0; i < text.size(); i++)
+  {
+    if(text[i] != ENDMARKER) { counts[text[i] - header.offset]++; }
+  }
+  std::vector<size_type> record_starts(records + 1, 0);
+  record_starts[1] = sequences;
+  for(comp_type comp = 1; comp < records; comp++) { record_starts[comp + 1] = record_starts[comp] + counts[comp]; }
+  std::vector<size_type> items(text.size()), ranks(text.size());
+  for(size_type i = 0, seq_id = 0; i < text.size(); i++)
+  {
+    if(i == sequence_starts[seq_id]) { ranks[i] = seq_id; items[seq_id] = i; seq_id++; continue; }
+    comp_type comp = text[i - 1] - header.offset;
+    ranks[i] = record_starts[comp];
+    items[record_starts[comp] + counts[comp] - 1] = i; counts[comp]--;
+  }
+  std::vector<range_type> groups;
+  for(comp_type comp = 1; comp < records; comp++)
+  {
+    if(record_starts[comp + 1] - record_starts[comp] > 1) { groups.push_back(range_type(record_starts[comp], record_starts[comp + 1] - 1)); }
+  }
+
+  // Prefix doubling.
+  {
+    std::vector<size_type> keys(text.size());
+    for(size_type h = 1; !(groups.empty()); h *= 2)
+    {
+      double step_start = readTimer();
+      refineGroups(items, ranks, keys, groups, h);
+      if(Verbosity::level >= Verbosity::EXTENDED)
+      {
+        double seconds = readTimer() - step_start;
+        std::cerr << "buildBulk(): " << groups.size() << " groups without unique prefixes of length " << (2 * h) << " (" << seconds << " seconds)" << std::endl;
+      }
+    }
+  }
+  ranks = std::vector<size_type>();
+
+  // Write the records and collect the samples. The counts are reused for incoming edges.
+  RecordArray bwt(records);
+  std::vector<size_type> offsets(records);
+  std::vector<size_type>& incoming = counts;
+  std::fill(incoming.begin(), incoming.end(), 0);
+  std::vector<range_type> sampled_records, samples;
+  std::vector<node_type> successors;
+  size_type sample_offset = 0;
+  for(comp_type comp = 0; comp < records; comp++)
+  {
+    offsets[comp] = bwt.data.size();
+    successors.clear();
+    size_type first_sample = samples.size();
+    for(size_type i = record_starts[comp]; i < record_starts[comp + 1]; i++)
+    {
+      size_type item = items[i];
+      node_type next = text[item];
+      size_type seq_id = std::upper_bound(sequence_starts.begin(), sequence_starts.end(), item) - sequence_starts.begin() - 1;
+      if((item - sequence_starts[seq_id] + 1) % sample_interval == 0 || next == ENDMARKER)
+      {
+        samples.push_back(range_type(sample_offset + successors.size(), seq_id));
+      }
+      successors.push_back(next);
+    }
+    writeExternalRecord(successors, incoming, header, bwt.data);
+    if(samples.size() > first_sample)
+    {
+      sampled_records.push_back(range_type(comp, successors.size()));
+      sample_offset += successors.size();
+    }
+  }
+  bwt.buildIndex(offsets);
+  DASamples da_samples(records, sampled_records, samples);
+  GBWT result(header, std::move(bwt), std::move(da_samples));
+
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "buildBulk(): Indexed " << result.sequences() << " sequences (" << result.size() << " nodes) in "
+              << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+GBWT
+buildBulk(const std::vector<std::string>& text_files, bool both_orientations, size_type sample_interval)
+{
+  size_type total_size = 0;
+  node_type max_node = 0;
+  forEachSequence(text_files, both_orientations, [&](const vector_type& sequence)
+  {
+    total_size += sequence.size() + 1;
+    for(node_type node : sequence) { max_node = std::max(max_node, node); }
+  });
+
+  text_type text(total_size, 0, bit_length(max_node));
+  size_type offset = 0;
+  forEachSequence(text_files, both_orientations, [&](const vector_type& sequence)
+  {
+    for(node_type node : sequence) { text[offset] = node; offset++; }
+    text[offset] = ENDMARKER; offset++;
+  });
+
+  return buildBulk(text, both_orientations, sample_interval);
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
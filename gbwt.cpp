@@ -56,6 +56,25 @@ GBWT::GBWT(const DynamicGBWT& source) :
   this->cacheEndmarker();
 }
 
+GBWT::GBWT(DynamicGBWT&& source) :
+  header(source.header),
+  metadata(std::move(source.metadata))
+{
+  // The samples are small, so we build them first while the records are still available.
+  this->da_samples = DASamples(source.bwt);
+  this->bwt = RecordArray(std::move(source.bwt));
+  DynamicGBWT empty;
+  source.swap(empty);
+  this->cacheEndmarker();
+}
+
+GBWT::GBWT(const GBWTHeader& header, RecordArray&& bwt, DASamples&& da_samples) :
+  header(header),
+  bwt(std::move(bwt)), da_samples(std::move(da_samples))
+{
+  this->cacheEndmarker();
+}
+
 GBWT::GBWT(GBWT&& source)
 {
   *this = std::move(source);
@@ -164,59 +183,103 @@ GBWT::copy(const GBWT& source)
 
 //------------------------------------------------------------------------------
 
-GBWT::GBWT(const std::vector<GBWT>& sources)
+/*
+  Merges the headers of the sources for the fast merge. Determines the mapping between source
+  comp values and merged comp values and the origin of each merged record. Returns false if
+  all sources are empty.
+*/
+bool
+mergeHeaders(const std::vector<GBWTHeader const*>& sources, GBWTHeader& merged, std::vector<size_type>& record_offsets, sdsl::int_vector<0>& origins)
 {
-  if(sources.empty()) { return; }
-
   // Merge the headers.
   size_type valid_sources = 0;
   bool is_bidirectional = true;
-  for(const GBWT& source : sources)
+  for(const GBWTHeader* source : sources)
   {
-    if(source.empty()) { continue; }
-    this->header.sequences += source.header.sequences;
-    this->header.size += source.header.size;
+    if(source->size == 0) { continue; }
+    merged.sequences += source->sequences;
+    merged.size += source->size;
     if(valid_sources == 0)
     {
-      this->header.offset = source.header.offset;
-      this->header.alphabet_size = source.header.alphabet_size;
+      merged.offset = source->offset;
+      merged.alphabet_size = source->alphabet_size;
     }
     else
     {
-      this->header.offset = std::min(this->header.offset, source.header.offset);
-      this->header.alphabet_size = std::max(this->header.alphabet_size, source.header.alphabet_size);
+      merged.offset = std::min(merged.offset, source->offset);
+      merged.alphabet_size = std::max(merged.alphabet_size, source->alphabet_size);
     }
-    if(!(source.bidirectional())) { is_bidirectional = false; }
+    if(!(source->get(GBWTHeader::FLAG_BIDIRECTIONAL))) { is_bidirectional = false; }
     valid_sources++;
   }
-  if(valid_sources == 0) { return; }
-  if(is_bidirectional) { this->header.set(GBWTHeader::FLAG_BIDIRECTIONAL); }
-  else { this->header.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
+  if(valid_sources == 0) { return false; }
+  if(is_bidirectional) { merged.set(GBWTHeader::FLAG_BIDIRECTIONAL); }
+  else { merged.unset(GBWTHeader::FLAG_BIDIRECTIONAL); }
 
   // Determine the mapping between source comp values and merged comp values.
-  std::vector<size_type> record_offsets(sources.size());
+  record_offsets = std::vector<size_type>(sources.size());
   for(size_type i = 0; i < sources.size(); i++)
   {
-    record_offsets[i] = sources[i].header.offset - this->header.offset;
+    record_offsets[i] = sources[i]->offset - merged.offset;
   }
 
   // Determine the origin of each record.
-  sdsl::int_vector<0> origins(this->effective(), sources.size(), bit_length(sources.size()));
+  origins = sdsl::int_vector<0>(merged.alphabet_size - merged.offset, sources.size(), bit_length(sources.size()));
   for(size_type source_id = 0; source_id < sources.size(); source_id++)
   {
-    const GBWT& source = sources[source_id];
-    for(comp_type source_comp = 1; source_comp < source.effective(); source_comp++)
+    const GBWTHeader& source = *(sources[source_id]);
+    for(comp_type source_comp = 1; source_comp < source.alphabet_size - source.offset; source_comp++)
     {
       comp_type merged_comp = source_comp + record_offsets[source_id];
       if(origins[merged_comp] != sources.size())
       {
-        std::cerr << "GBWT::GBWT(): Sources " << origins[merged_comp] << " and " << source_id << " both have node " << this->toNode(merged_comp) << std::endl;
+        std::cerr << "mergeHeaders(): Sources " << origins[merged_comp] << " and " << source_id << " both have node " << (merged_comp + merged.offset) << std::endl;
         std::exit(EXIT_FAILURE);
       }
       origins[merged_comp] = source_id;
     }
   }
 
+  return true;
+}
+
+// Merges the metadata for the fast merge if all sources have it.
+void
+mergeMetadata(const std::vector<GBWTHeader const*>& headers, const std::vector<Metadata const*>& sources, GBWTHeader& merged_header, Metadata& merged)
+{
+  bool has_metadata = false, all_metadata = true;
+  for(const GBWTHeader* header : headers)
+  {
+    has_metadata |= header->get(GBWTHeader::FLAG_METADATA);
+    all_metadata &= header->get(GBWTHeader::FLAG_METADATA);
+  }
+  if(has_metadata)
+  {
+    if(all_metadata)
+    {
+      merged = Metadata(sources, true, false); // Same samples, different contigs.
+      merged_header.set(GBWTHeader::FLAG_METADATA);
+    }
+    else if(Verbosity::level >= Verbosity::BASIC)
+    {
+      std::cerr << "GBWT::merge(): All inputs do not have metadata" << std::endl;
+    }
+  }
+}
+
+GBWT::GBWT(const std::vector<GBWT>& sources)
+{
+  if(sources.empty()) { return; }
+
+  // Merge the headers.
+  std::vector<size_type> record_offsets;
+  sdsl::int_vector<0> origins;
+  {
+    std::vector<GBWTHeader const*> headers(sources.size());
+    for(size_type i = 0; i < sources.size(); i++) { headers[i] = &(sources[i].header); }
+    if(!mergeHeaders(headers, this->header, record_offsets, origins)) { return; }
+  }
+
   // Interleave the BWTs.
   {
     std::vector<RecordArray const*> bwt_sources(sources.size());
@@ -241,29 +304,200 @@ GBWT::GBWT(const std::vector<GBWT>& sources)
 
   // Merge the metadata.
   {
-    bool has_metadata = false, all_metadata = true;
+    std::vector<GBWTHeader const*> headers(sources.size());
+    std::vector<Metadata const*> source_metadata(sources.size());
     for(size_type i = 0; i < sources.size(); i++)
     {
-      has_metadata |= sources[i].hasMetadata();
-      all_metadata &= sources[i].hasMetadata();
+      headers[i] = &(sources[i].header); source_metadata[i] = &(sources[i].metadata);
     }
-    if(has_metadata)
+    mergeMetadata(headers, source_metadata, this->header, this->metadata);
+  }
+
+  this->cacheEndmarker();
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Streaming fast merge. The first pass reads everything except the record data from each
+  input and skips the data. The RecordArray of each input only contains the endmarker, but
+  the index covers all records. Then we write the header and the record index for the
+  merged index, and the second pass copies the records from the inputs in the order of
+  the merged node ids. Because the node ids of an input are in the same order in the
+  merged index, each input is read sequentially.
+*/
+
+struct MergeInput
+{
+  std::ifstream in;
+  GBWTHeader    header;
+  RecordArray   bwt;
+  DASamples     da_samples;
+  Metadata      metadata;
+
+  size_type data_size;
+
+  size_type limit(size_type record) const
+  {
+    return (record + 1 < this->bwt.size() ? this->bwt.select(record + 2) : this->data_size);
+  }
+};
+
+void
+openMergeInput(const std::string& filename, MergeInput& input)
+{
+  input.in.open(filename, std::ios_base::binary);
+  if(!(input.in))
+  {
+    std::cerr << "mergeFiles(): Cannot open input file " << filename << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  input.header.load(input.in);
+  if(!(input.header.check()))
+  {
+    std::cerr << "mergeFiles(): Invalid header in " << filename << ": " << input.header << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  input.header.setVersion(); // Update to the current version.
+
+  // Read the endmarker and skip the rest of the data.
+  input.bwt.loadIndex(input.in);
+  input.data_size = input.bwt.index.size();
+  std::streampos data_start = input.in.tellg();
+  if(!(input.bwt.empty()))
+  {
+    input.bwt.data.resize(input.limit(ENDMARKER));
+    DiskIO::read(input.in, input.bwt.data.data(), input.bwt.data.size());
+  }
+  input.in.seekg(data_start + static_cast<std::streamoff>(input.data_size));
+
+  input.da_samples.load(input.in);
+  if(input.header.get(GBWTHeader::FLAG_METADATA)) { input.metadata.load(input.in); }
+  if(!(input.in))
+  {
+    std::cerr << "mergeFiles(): Cannot read the index from " << filename << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Position the stream at the first record after the endmarker.
+  input.in.seekg(data_start + static_cast<std::streamoff>(input.bwt.data.size()));
+}
+
+GBWTHeader
+mergeFiles(const std::vector<std::string>& input_files, const std::string& output_file)
+{
+  double start = readTimer();
+
+  std::vector<MergeInput> inputs(input_files.size());
+  for(size_type i = 0; i < inputs.size(); i++) { openMergeInput(input_files[i], inputs[i]); }
+
+  // Merge the headers and the metadata.
+  GBWTHeader header;
+  std::vector<size_type> record_offsets;
+  sdsl::int_vector<0> origins;
+  Metadata metadata;
+  {
+    std::vector<GBWTHeader const*> headers(inputs.size());
+    std::vector<Metadata const*> input_metadata(inputs.size());
+    for(size_type i = 0; i < inputs.size(); i++)
     {
-      if(all_metadata)
-      {
-        std::vector<const Metadata*> source_metadata(sources.size());
-        for(size_type i = 0; i < sources.size(); i++) { source_metadata[i] = &(sources[i].metadata); }
-        this->metadata = Metadata(source_metadata, true, false); // Same samples, different contigs.
-        this->addMetadata();
-      }
-      else if(Verbosity::level >= Verbosity::BASIC)
+      headers[i] = &(inputs[i].header); input_metadata[i] = &(inputs[i].metadata);
+    }
+    if(mergeHeaders(headers, header, record_offsets, origins))
+    {
+      mergeMetadata(headers, input_metadata, header, metadata);
+    }
+  }
+
+  // Merge the endmarkers and determine the record offsets.
+  RecordArray bwt(origins.size());
+  {
+    std::vector<RecordArray const*> bwt_inputs(inputs.size());
+    for(size_type i = 0; i < inputs.size(); i++) { bwt_inputs[i] = &(inputs[i].bwt); }
+    if(bwt.size() > 0) { RecordArray::mergeEndmarkers(bwt_inputs, bwt.data); }
+  }
+  std::vector<size_type> offsets(origins.size(), 0);
+  size_type data_size = bwt.data.size();
+  for(comp_type comp = 1; comp < origins.size(); comp++)
+  {
+    offsets[comp] = data_size;
+    size_type origin = origins[comp];
+    if(origin >= inputs.size()) { data_size++; continue; } // Empty record, outdegree 0.
+    size_type input_comp = comp - record_offsets[origin];
+    data_size += inputs[origin].limit(input_comp) - inputs[origin].bwt.start(input_comp);
+  }
+  if(bwt.size() > 0)
+  {
+    sdsl::sd_vector_builder builder(data_size, offsets.size());
+    for(size_type offset : offsets) { builder.set(offset); }
+    bwt.index = sdsl::sd_vector<>(builder);
+    sdsl::util::init_support(bwt.select, &(bwt.index));
+  }
+
+  // Merge the samples.
+  DASamples da_samples;
+  if(bwt.size() > 0)
+  {
+    std::vector<DASamples const*> sample_inputs(inputs.size());
+    std::vector<size_type> sequence_counts(inputs.size());
+    for(size_type i = 0; i < inputs.size(); i++)
+    {
+      sample_inputs[i] = &(inputs[i].da_samples);
+      sequence_counts[i] = inputs[i].header.sequences;
+    }
+    da_samples = DASamples(sample_inputs, origins, record_offsets, sequence_counts);
+  }
+
+  // Write the merged index in the same format as GBWT::serialize().
+  std::ofstream out(output_file, std::ios_base::binary);
+  if(!out)
+  {
+    std::cerr << "mergeFiles(): Cannot open output file " << output_file << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  header.serialize(out);
+  bwt.serializeIndex(out, nullptr);
+  DiskIO::write(out, bwt.data.data(), bwt.data.size());
+  std::vector<byte_type> buffer(MEGABYTE);
+  for(comp_type comp = 1; comp < origins.size(); )
+  {
+    // Records from the same input form a contiguous range of bytes in both files.
+    size_type origin = origins[comp];
+    comp_type limit = comp + 1;
+    while(limit < origins.size() && origins[limit] == origin) { limit++; }
+    size_type bytes = (limit < origins.size() ? offsets[limit] : data_size) - offsets[comp];
+    if(origin >= inputs.size()) { std::fill(buffer.begin(), buffer.end(), 0); }
+    while(bytes > 0)
+    {
+      size_type chunk = std::min(bytes, buffer.size());
+      if(origin < inputs.size() && !DiskIO::read(inputs[origin].in, buffer.data(), chunk))
       {
-        std::cerr << "GBWT::merge(): All inputs do not have metadata" << std::endl;
+        std::cerr << "mergeFiles(): Cannot read records from " << input_files[origin] << std::endl;
+        std::exit(EXIT_FAILURE);
       }
+      DiskIO::write(out, buffer.data(), chunk);
+      bytes -= chunk;
     }
+    comp = limit;
+  }
+  da_samples.serialize(out);
+  if(header.get(GBWTHeader::FLAG_METADATA)) { metadata.serialize(out); }
+  out.close();
+  if(out.fail())
+  {
+    std::cerr << "mergeFiles(): Cannot write the index to " << output_file << std::endl;
+    std::exit(EXIT_FAILURE);
   }
 
-  this->cacheEndmarker();
+  if(Verbosity::level >= Verbosity::BASIC)
+  {
+    double seconds = readTimer() - start;
+    std::cerr << "mergeFiles(): Merged " << inputs.size() << " indexes (" << header.size << " nodes) in "
+              << seconds << " seconds" << std::endl;
+  }
+
+  return header;
 }
 
 //------------------------------------------------------------------------------
@@ -271,14 +505,23 @@ GBWT::GBWT(const std::vector<GBWT>& sources)
 size_type
 GBWT::runs() const
 {
-  size_type start = 0, result = 0;
-  for(comp_type comp = 0; comp < this->effective(); comp++)
+  if(this->effective() == 0) { return 0; }
+
+  std::vector<range_type> blocks = Range::partition(range_type(0, this->effective() - 1), 4 * omp_get_max_threads());
+  size_type result = 0;
+  #pragma omp parallel for schedule(dynamic, 1) reduction(+:result)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    size_type limit = this->bwt.limit(comp);
-    CompressedRecord record(this->bwt.data, start, limit);
-    result += record.runs();
-    start = limit;
+    size_type start = this->bwt.start(blocks[block].first);
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
+    {
+      size_type limit = this->bwt.limit(comp);
+      CompressedRecord record(this->bwt.data, start, limit);
+      result += record.runs();
+      start = limit;
+    }
   }
+
   return result;
 }
 
@@ -386,4 +629,88 @@ printStatistics(const GBWT& gbwt, const std::string& name)
 
 //------------------------------------------------------------------------------
 
+GBWTStatistics::GBWTStatistics() :
+  records(0),
+  total_size(0), total_runs(0), total_outdegree(0), total_bytes(0),
+  endmarker_size(0), endmarker_runs(0), endmarker_outdegree(0), endmarker_bytes(0),
+  sampled_records(0), samples(0)
+{
+}
+
+GBWTStatistics::GBWTStatistics(const GBWT& index) :
+  GBWTStatistics()
+{
+  if(index.effective() == 0) { return; }
+
+  std::vector<range_type> blocks = Range::partition(range_type(0, index.effective() - 1), 4 * omp_get_max_threads());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
+  {
+    GBWTStatistics partial;
+    size_type start = index.bwt.start(blocks[block].first);
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
+    {
+      size_type limit = index.bwt.limit(comp);
+      CompressedRecord record(index.bwt.data, start, limit);
+      size_type record_size = 0, record_runs = 0;
+      if(record.outdegree() > 0)
+      {
+        for(CompressedRecordIterator iter(record); !(iter.end()); ++iter)
+        {
+          record_size += iter->second; record_runs++;
+          if(comp > 0) { partial.run_lengths[iter->second]++; }
+        }
+      }
+      if(comp == 0)
+      {
+        partial.endmarker_size = record_size; partial.endmarker_runs = record_runs;
+        partial.endmarker_outdegree = record.outdegree(); partial.endmarker_bytes = limit - start;
+      }
+      else
+      {
+        partial.records++;
+        partial.total_size += record_size; partial.sizes[record_size]++;
+        partial.total_runs += record_runs; partial.runs[record_runs]++;
+        partial.total_outdegree += record.outdegree(); partial.outdegrees[record.outdegree()]++;
+        partial.total_bytes += limit - start; partial.bytes[limit - start]++;
+      }
+      if(index.da_samples.isSampled(comp)) { partial.sampled_records++; }
+      start = limit;
+    }
+    #pragma omp critical
+    {
+      this->merge(partial);
+    }
+  }
+  this->samples = index.da_samples.size();
+}
+
+void
+GBWTStatistics::merge(const GBWTStatistics& another)
+{
+  this->records += another.records;
+  this->total_size += another.total_size;
+  this->total_runs += another.total_runs;
+  this->total_outdegree += another.total_outdegree;
+  this->total_bytes += another.total_bytes;
+  this->endmarker_size += another.endmarker_size;
+  this->endmarker_runs += another.endmarker_runs;
+  this->endmarker_outdegree += another.endmarker_outdegree;
+  this->endmarker_bytes += another.endmarker_bytes;
+  this->sampled_records += another.sampled_records;
+  this->samples += another.samples;
+
+  auto merge_distribution = [](std::map<size_type, size_type>& target, const std::map<size_type, size_type>& source)
+  {
+    for(auto value : source) { target[value.first] += value.second; }
+  };
+  merge_distribution(this->sizes, another.sizes);
+  merge_distribution(this->runs, another.runs);
+  merge_distribution(this->outdegrees, another.outdegrees);
+  merge_distribution(this->bytes, another.bytes);
+  merge_distribution(this->run_lengths, another.run_lengths);
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
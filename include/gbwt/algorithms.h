@@ -192,6 +192,162 @@ bdFind(const GBWTType& index, node_type node)
 
 //------------------------------------------------------------------------------
 
+/*
+  Batched bidirectional search. Each request extends the state forward (or backward if
+  the flag is set) with the given node. The requests are grouped by the record they access,
+  and each record is decoded only once per batch. The results replace the states in the
+  requests. The results are identical to those of bdExtendForward() / bdExtendBackward().
+
+  Template parameters:
+    GBWTType  GBWT, CachedGBWT, or DynamicGBWT
+*/
+
+struct BidirectionalExtension
+{
+  BidirectionalState state;
+  node_type          node;
+  bool               backward;
+
+  BidirectionalExtension() : node(ENDMARKER), backward(false) {}
+  BidirectionalExtension(BidirectionalState bd_state, node_type to, bool extend_backward) :
+    state(bd_state), node(to), backward(extend_backward)
+  {
+  }
+
+  // The record accessed by the extension and the successor node in that record.
+  node_type from() const { return (this->backward ? this->state.backward.node : this->state.forward.node); }
+  node_type to() const { return (this->backward ? Node::reverse(this->node) : this->node); }
+};
+
+template<class GBWTType>
+void
+bdExtend(const GBWTType& index, std::vector<BidirectionalExtension>& requests)
+{
+  // Sort the valid requests by the record they access.
+  std::vector<std::pair<node_type, size_type>> order;
+  order.reserve(requests.size());
+  for(size_type i = 0; i < requests.size(); i++)
+  {
+    BidirectionalExtension& request = requests[i];
+    if(request.state.empty() || !(index.contains(request.to()))) { request.state = BidirectionalState(); }
+    else { order.emplace_back(request.from(), i); }
+  }
+  std::sort(order.begin(), order.end());
+
+  // Decode each record once and serve all requests for it. Backward extension is forward
+  // extension with the flipped state and the reverse node.
+  for(size_type group_start = 0; group_start < order.size(); )
+  {
+    node_type from = order[group_start].first;
+    const auto& record = index.record(from);
+    size_type group_end = group_start;
+    while(group_end < order.size() && order[group_end].first == from)
+    {
+      BidirectionalExtension& request = requests[order[group_end].second];
+      BidirectionalState& state = request.state;
+      node_type to = request.to();
+      if(request.backward) { state.flip(); }
+      size_type reverse_offset = 0;
+      state.forward.range = record.bdLF(state.forward.range, to, reverse_offset);
+      state.forward.node = to;
+      state.backward.range.first += reverse_offset;
+      state.backward.range.second = state.backward.range.first + state.forward.size() - 1;
+      if(request.backward) { state.flip(); }
+      group_end++;
+    }
+    group_start = group_end;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Matching statistics: lengths[i] is the length of the longest prefix of query[i..] that
+  occurs in the indexed paths, and states[i] is the search state for that prefix (or an
+  empty state if the length is 0).
+
+  The algorithm scans the query from right to left using backward extension. When the
+  extension fails, it restarts with forward extension from the current position. The
+  restart stops before the end of the previous match, because the match lengths are
+  monotone: i + lengths[i] <= i + 1 + lengths[i + 1]. A query that mostly matches the
+  paths therefore takes O(|query|) extensions.
+
+  The index must be bidirectional. Otherwise the algorithm returns an empty object.
+
+  Template parameters:
+    GBWTType  GBWT, CachedGBWT, or DynamicGBWT (batches: GBWT or DynamicGBWT)
+*/
+
+struct MatchingStatistics
+{
+  std::vector<size_type>   lengths;
+  std::vector<SearchState> states;
+
+  size_type size() const { return this->lengths.size(); }
+  bool empty() const { return this->lengths.empty(); }
+};
+
+template<class GBWTType>
+MatchingStatistics
+matchingStatistics(const GBWTType& index, const vector_type& query)
+{
+  MatchingStatistics result;
+  if(!(index.bidirectional())) { return result; }
+  result.lengths.resize(query.size(), 0);
+  result.states.resize(query.size());
+
+  // The state matches query[i, end).
+  BidirectionalState state;
+  size_type end = query.size();
+  for(size_type i = query.size(); i > 0; i--)
+  {
+    size_type start = i - 1;
+    if(start + 1 >= end)
+    {
+      state = gbwt::bdFind(index, query[start]);
+      end = (state.empty() ? start : start + 1);
+    }
+    else
+    {
+      BidirectionalState next = gbwt::bdExtendBackward(index, state, query[start]);
+      if(!(next.empty())) { state = next; }
+      else
+      {
+        size_type limit = end;
+        state = gbwt::bdFind(index, query[start]);
+        end = (state.empty() ? start : start + 1);
+        while(!(state.empty()) && end < limit)
+        {
+          next = gbwt::bdExtendForward(index, state, query[end]);
+          if(next.empty()) { break; }
+          state = next; end++;
+        }
+      }
+    }
+    result.lengths[start] = end - start;
+    if(end > start) { result.states[start] = state.forward; }
+  }
+
+  return result;
+}
+
+template<class GBWTType>
+std::vector<MatchingStatistics>
+matchingStatistics(const GBWTType& index, const std::vector<vector_type>& queries)
+{
+  std::vector<MatchingStatistics> result(queries.size());
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type i = 0; i < queries.size(); i++)
+  {
+    result[i] = gbwt::matchingStatistics(index, queries[i]);
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
 /*
   If the parameters are invalid, the locate algorithms return invalid_sequence() or an
   empty vector.
@@ -26,8 +26,11 @@
 #ifndef GBWT_BWTMERGE_H
 #define GBWT_BWTMERGE_H
 
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <queue>
 #include <thread>
 
 #include <gbwt/internal.h>
@@ -41,6 +44,71 @@ namespace gbwt
 
 //------------------------------------------------------------------------------
 
+/*
+  Machine-readable progress reports from the parallel merge algorithms. Between start()
+  and stop(), a reporter thread writes a snapshot of the counters as a JSON line every
+  'interval' seconds. The merge algorithms also write a line when they enter a new phase
+  and when a merge job finishes. The counters are global and shared by all threads. They
+  are always updated, and start() resets them.
+
+  Each line is a JSON object with field "event":
+
+  - "start": merge parameters and the number of search threads.
+  - "phase": the name of the new phase.
+  - "progress": sequences searched and rank array values, bytes spilled to temporary files,
+    bytes kept in memory, and bytes read back from the files; records merged; the rates
+    since the previous snapshot; and the memory high-water mark in bytes.
+  - "job": the number of non-empty records merged by the job, the time, and the rate.
+  - "stop": a final snapshot.
+
+  Every line also contains "time" in seconds since start().
+*/
+
+struct MergeProgress
+{
+  constexpr static double DEFAULT_INTERVAL = 10.0; // Seconds.
+
+  static std::atomic<size_type> sequences;       // Sequences searched in buildRA().
+  static std::atomic<size_type> values;          // Values added to the rank arrays.
+  static std::atomic<size_type> bytes_spilled;   // Rank array bytes written to temporary files.
+  static std::atomic<size_type> bytes_in_memory; // Rank array bytes kept in memory.
+  static std::atomic<size_type> bytes_read;      // Rank array bytes read from temporary files.
+  static std::atomic<size_type> records;         // Non-empty records merged by finished jobs.
+
+  static void add(std::atomic<size_type>& counter, size_type n) { counter.fetch_add(n, std::memory_order_relaxed); }
+
+  // Start reporting to the output. The caller must call stop() before the output is destroyed.
+  // If the program calls std::exit() while reporting, an exit handler stops the reporter.
+  static void start(std::ostream& out, const MergeParameters& parameters, double interval = DEFAULT_INTERVAL);
+  static void stop();
+  static bool enabled();
+
+  // Events. These do nothing if reporting has not been started.
+  static void phase(const std::string& name);
+  static void job(size_type job, size_type records, double seconds);
+
+private:
+  // Main loop of the reporter thread.
+  static void report();
+
+  // Write a snapshot of the counters. The caller must hold the lock.
+  static void snapshot(const std::string& event);
+
+  static std::mutex              report_lock;
+  static std::condition_variable report_stop;
+  static std::thread             reporter;
+  static std::ostream*           output;
+  static double                  report_interval, start_time;
+  static bool                    stop_reporter;
+  static std::string             current_phase;
+
+  // Counter values at the previous snapshot.
+  static double                  prev_time;
+  static size_type               prev_sequences, prev_records;
+};
+
+//------------------------------------------------------------------------------
+
 /*
   Two-level array allocated in 8-megabyte blocks using mmap().
 */
@@ -113,11 +181,28 @@ private:
 
 //------------------------------------------------------------------------------
 
+// Reads from rank array files are reported in MergeProgress.
+template<class ByteArray>
+inline void countRead(const ByteArray&, size_type) {}
+
+inline void
+countRead(const sdsl::int_vector_buffer<8>&, size_type bytes)
+{
+  MergeProgress::add(MergeProgress::bytes_read, bytes);
+}
+
 /*
   A gap-encoded non-decreasing edge_type array, based on any byte array with
   operator[] and member function push_back(). Intended usage is GapArray<BlockArray>
-  in memory and GapArray<sdsl::int_vector_buffer<8>> on disk. Note that the iterator
-  is destructive if the array type is BlockArray.
+  in memory and GapArray<sdsl::int_vector_buffer<8>> on disk. GapArray<std::vector<byte_type>>
+  is used for rank array segments kept in memory. Note that the iterator is destructive if
+  the array type is BlockArray.
+
+  GapArray<BlockArray> encodes each value with ByteCode, as it is built and merged one value
+  at a time. The other array types are only written by GapArray<BlockArray>, and they are
+  read sequentially when merging the rank array. They store the values in frames of
+  FrameCode::FRAME_SIZE values, with the node gaps and the offset gaps in separate FrameCode
+  blocks. Only the last frame may be shorter.
 */
 
 template<class ByteArray>
@@ -205,6 +290,15 @@ public:
     return 0;
   }
 
+  // As above, but the node ranges are written to in-memory arrays.
+  size_type write(std::vector<GapArray<std::vector<byte_type>>>& arrays,
+             const std::vector<range_type>& node_ranges)
+  {
+    std::cerr << "GapArray::write(): Unsupported ByteArray type" << std::endl;
+    this->clear();
+    return 0;
+  }
+
   ByteArray data;
   size_type value_count;
 
@@ -216,6 +310,22 @@ public:
     prev = curr;
   }
 
+  // Writes the values as a frame and clears them.
+  static void writeFrame(ByteArray& data, std::vector<edge_type>& frame, edge_type& prev)
+  {
+    FrameCode::value_type node_gaps[FrameCode::FRAME_SIZE], offset_gaps[FrameCode::FRAME_SIZE];
+    for(size_type i = 0; i < frame.size(); i++)
+    {
+      node_gaps[i] = frame[i].first - prev.first;
+      if(frame[i].first != prev.first) { prev.second = 0; } // Node changed, set previous offset to 0.
+      offset_gaps[i] = frame[i].second - prev.second;
+      prev = frame[i];
+    }
+    FrameCode::write(data, node_gaps, frame.size());
+    FrameCode::write(data, offset_gaps, frame.size());
+    frame.clear();
+  }
+
 private:
   void copy(const GapArray& source)
   {
@@ -236,6 +346,8 @@ template<> void GapArray<BlockArray>::write(const std::string& filename);
 template<> size_type GapArray<BlockArray>::write(const std::vector<std::string>& filenames,
                                             const std::vector<range_type>& node_ranges,
                                             std::vector<size_type>& value_counts);
+template<> size_type GapArray<BlockArray>::write(std::vector<GapArray<std::vector<byte_type>>>& arrays,
+                                            const std::vector<range_type>& node_ranges);
 
 void open(GapArray<sdsl::int_vector_buffer<8>>& array, const std::string filename, size_type values);
 template<> void GapArray<sdsl::int_vector_buffer<8>>::clear();
@@ -249,12 +361,12 @@ public:
   typedef typename GapArray<ByteArray>::size_type size_type;
 
   GapIterator() :
-    array(nullptr), pos(0), data_pointer(0), value(ENDMARKER, 0)
+    array(nullptr), pos(0), data_pointer(0), value(ENDMARKER, 0), frame_offset(0)
   {
   }
 
   GapIterator(GapArray<ByteArray>& data) :
-    array(&data), pos(0), data_pointer(0), value(ENDMARKER, 0)
+    array(&data), pos(0), data_pointer(0), value(ENDMARKER, 0), frame_offset(0)
   {
     this->read();
   }
@@ -288,11 +400,38 @@ public:
   size_type pos, data_pointer;
   edge_type value;
 
+  // Decoded frame.
+  std::vector<edge_type> frame;
+  size_type              frame_offset;
+
 private:
-  // There is a specialized destructive read() for BlockArray.
+  // There is a specialized destructive read() for BlockArray using ByteCode.
   void read()
   {
-    this->readCommon();
+    if(this->end()) { this->value = invalid_edge(); return; }
+    if(this->frame_offset >= this->frame.size()) { this->readFrame(); }
+    this->value = this->frame[this->frame_offset]; this->frame_offset++;
+  }
+
+  void readFrame()
+  {
+    size_type n = std::min(FrameCode::FRAME_SIZE, this->size() - this->pos);
+    FrameCode::value_type node_gaps[FrameCode::FRAME_SIZE], offset_gaps[FrameCode::FRAME_SIZE];
+    size_type frame_start = this->data_pointer;
+    FrameCode::read(this->array->data, this->data_pointer, node_gaps, n);
+    FrameCode::read(this->array->data, this->data_pointer, offset_gaps, n);
+    countRead(this->array->data, this->data_pointer - frame_start);
+
+    this->frame.resize(n);
+    edge_type prev = this->value;
+    for(size_type i = 0; i < n; i++)
+    {
+      if(node_gaps[i] != 0) { prev.second = 0; } // Node changed, set previous offset to 0.
+      prev.first += node_gaps[i];
+      prev.second += offset_gaps[i];
+      this->frame[i] = prev;
+    }
+    this->frame_offset = 0;
   }
 
   void readCommon()
@@ -310,6 +449,8 @@ private:
     this->pos = source.pos;
     this->data_pointer = source.data_pointer;
     this->value = source.value;
+    this->frame = source.frame;
+    this->frame_offset = source.frame_offset;
   }
 };  // class GapIterator
 
@@ -341,6 +482,15 @@ produce(ProducerBuffer<Producer>* buffer)
 
 // FIXME Maybe this should be a parameter?
 constexpr static size_type PRODUCER_BUFFER_SIZE = 8 * MEGABYTE; // Positions.
+constexpr static size_type MIN_PRODUCER_BUFFER_SIZE = 64 * KILOBYTE; // Positions.
+
+// Buffer size for each of the given number of producers read at the same time. The producers
+// share PRODUCER_BUFFER_SIZE positions, but each of them gets at least MIN_PRODUCER_BUFFER_SIZE.
+inline size_type
+producerBufferSize(size_type producers)
+{
+  return std::max(MIN_PRODUCER_BUFFER_SIZE, PRODUCER_BUFFER_SIZE / std::max(producers, size_type(1)));
+}
 
 template<class Producer>
 class ProducerBuffer
@@ -459,7 +609,8 @@ private:
 /*
   A RankArray is a number of temporary files containing GapArrays on disk. Each file is read
   using a separate thread with ProducerBuffer. When the object is deleted, the files are also
-  deleted.
+  deleted. The RankArray may also contain GapArrays in memory, which are read directly. In
+  the tournament tree, the files come before the in-memory arrays.
 
   Iterator value invalid_edge() is equivalent to end().
 */
@@ -470,6 +621,8 @@ public:
   typedef GapArray<sdsl::int_vector_buffer<8>> array_type;
   typedef array_type::size_type                size_type;
   typedef array_type::iterator                 iterator;
+  typedef GapArray<std::vector<byte_type>>     memory_type;
+  typedef memory_type::iterator                memory_iterator;
 
 #ifdef GBWT_SAVE_MEMORY
   // Avoid comparisons by packing the pair of 32-bit values into a 64-bit integer.
@@ -494,6 +647,11 @@ public:
   */
   void addValueCount(size_type file, size_type value_count);
 
+  /*
+    Add an in-memory array. The same restrictions apply as with addFile().
+  */
+  void addArray(memory_type&& array);
+
   // For ProducerBuffer.
   void open();
   void close();
@@ -504,16 +662,21 @@ public:
   void operator++();
   bool end() { return (this->value == invalid_edge()); }
 
-  size_type size() const { return this->filenames.size(); }
+  size_type size() const { return this->files() + this->arrays.size(); }
   size_type empty() const { return (this->size() == 0); }
+  size_type files() const { return this->filenames.size(); }
 
   std::vector<std::string> filenames;
   std::vector<size_type>   value_counts;
+  size_type                buffer_size; // ProducerBuffer size for each file in positions.
 
   std::vector<array_type>                inputs;
   std::vector<iterator>                  iterators;
   std::vector<ProducerBuffer<iterator>*> buffers;
 
+  std::vector<memory_type>     arrays;
+  std::vector<memory_iterator> array_iterators;
+
   // Use a tournament tree instead of a priority queue.
   // The number of leaves is a power of two.
   std::vector<tree_type> tournament_tree;
@@ -523,6 +686,19 @@ public:
   edge_type value;
 
 private:
+  // Input operations.
+  edge_type input(size_type i) const
+  {
+    if(i < this->files()) { return this->buffers[i]->operator*(); }
+    return *(this->array_iterators[i - this->files()]);
+  }
+
+  void advance(size_type i)
+  {
+    if(i < this->files()) { this->buffers[i]->operator++(); }
+    else { ++(this->array_iterators[i - this->files()]); }
+  }
+
   // Tournament tree operations.
   void initTree();
   tree_type smaller(size_type tree_offset) const
@@ -566,10 +742,13 @@ private:
   3) If thread_buffer is small enough, insert() returns.
   4) We merge thread_buffer with the global merge buffers until there is an empty slot
      or we run out of merge buffers.
-  5) If there is an empty slot, we insert thread_buffer there. Otherwise we write it to files
-     and add the files into the RankArrays. In either case, we clear the thread_buffer.
+  5) If there is an empty slot, we insert thread_buffer there. Otherwise we hand it over
+     to the writer thread and clear thread_buffer. The writer thread adds the buffers to
+     the RankArrays, in memory if the rank array stays within the memory budget and as
+     files otherwise. The search thread only waits if the write queue is full.
 
-  Once all elements have been inserted, we need to call flush().
+  Once all elements have been inserted, we need to call flush(). It returns after all
+  buffers have been written and the writer thread has been stopped.
 */
 
 class MergeBuffers
@@ -577,6 +756,9 @@ class MergeBuffers
 public:
   typedef GapArray<BlockArray> buffer_type;
 
+  // Maximum number of buffers waiting for the writer thread.
+  constexpr static size_type WRITE_QUEUE_SIZE = 2;
+
   MergeBuffers(size_type expected_size, size_type num_threads, const MergeParameters& params, const std::vector<range_type>& node_ranges);
   ~MergeBuffers();
 
@@ -595,8 +777,18 @@ public:
   std::vector<range_type> job_ranges;
   std::vector<RankArray*> ra;
   size_type               ra_values, ra_bytes;
+  size_type               ra_memory; // Bytes in memory.
   size_type               final_size;
 
+  // Writer thread.
+  std::mutex              write_lock;
+  std::condition_variable write_ready, write_space; // Is there a buffer to write / space in the queue?
+  std::queue<buffer_type> write_queue;
+  bool                    writing, stop_writer;
+  std::thread             writer;
+  size_type               queued_writes;
+  double                  write_wait; // Total time in seconds search threads waited for the queue.
+
   std::mutex stderr_access;
 
   size_type threads() const { return this->pos_buffers.size(); }
@@ -617,12 +809,160 @@ private:
   void insert(std::vector<edge_type>& pos_buffer, buffer_type& thread_buffer, bool force_merge);
   void write(buffer_type& buffer);
 
+  // Add the buffer to the write queue and clear it.
+  void queueWrite(buffer_type& buffer);
+
+  // Wait until all queued buffers have been written.
+  void waitForWrites();
+
+  // Stop the writer thread.
+  void stopWriter();
+
+  // Main loop of the writer thread.
+  void writeBuffers();
+
   MergeBuffers(const MergeBuffers&) = delete;
   MergeBuffers& operator=(const MergeBuffers&) = delete;
 };
 
 //------------------------------------------------------------------------------
 
+/*
+  External memory sorting for tuples of N integers in lexicographic order. The tuples are
+  buffered in memory, and each full buffer is sorted and written to a temporary file. The
+  first component is gap-encoded and the others are stored with ByteCode. After finish(),
+  the sorter iterates over the tuples in sorted order by merging the files with a priority
+  queue. If all tuples fit in the buffer, they are never written to disk. The files are
+  deleted when the sorter is deleted.
+*/
+
+template<size_type N>
+class ExternalSorter
+{
+public:
+  typedef gbwt::size_type           size_type;
+  typedef std::array<size_type, N>  value_type;
+  typedef std::pair<value_type, size_type> queue_type; // (value, file)
+
+  const static std::string TEMP_FILE_PREFIX;  // "sort"
+
+  explicit ExternalSorter(size_type buffer_size) :
+    capacity(std::max(buffer_size, static_cast<size_type>(1))), values(0), offset(0)
+  {
+  }
+
+  ~ExternalSorter()
+  {
+    this->inputs.clear();
+    for(std::string& filename : this->filenames) { TempFile::remove(filename); }
+  }
+
+  void push(const value_type& value)
+  {
+    this->buffer.push_back(value); this->values++;
+    if(this->buffer.size() >= this->capacity) { this->flush(); }
+  }
+
+  // Call once after all tuples have been inserted.
+  void finish()
+  {
+    if(this->filenames.empty())
+    {
+      parallelQuickSort(this->buffer.begin(), this->buffer.end());
+      this->offset = 0;
+      if(!(this->buffer.empty())) { this->value = this->buffer.front(); }
+      return;
+    }
+
+    this->flush();
+    this->buffer = std::vector<value_type>();
+    this->read_counts = std::vector<size_type>(this->files(), 0);
+    this->data_pointers = std::vector<size_type>(this->files(), 0);
+    this->heads = std::vector<value_type>(this->files());
+    for(size_type file = 0; file < this->files(); file++)
+    {
+      this->inputs.emplace_back(this->filenames[file], std::ios::in, MEGABYTE);
+      if(this->read(file)) { this->queue.push(queue_type(this->heads[file], file)); }
+    }
+    if(!(this->queue.empty())) { this->value = this->queue.top().first; }
+  }
+
+  size_type size() const { return this->values; }
+  bool empty() const { return (this->size() == 0); }
+  size_type files() const { return this->filenames.size(); }
+
+  // Iterator operations.
+  const value_type& operator*() const { return this->value; }
+  const value_type* operator->() const { return &(this->value); }
+  void operator++()
+  {
+    if(this->filenames.empty())
+    {
+      this->offset++;
+      if(this->offset < this->buffer.size()) { this->value = this->buffer[this->offset]; }
+      return;
+    }
+    size_type file = this->queue.top().second;
+    this->queue.pop();
+    if(this->read(file)) { this->queue.push(queue_type(this->heads[file], file)); }
+    if(!(this->queue.empty())) { this->value = this->queue.top().first; }
+  }
+  bool end() const
+  {
+    return (this->filenames.empty() ? this->offset >= this->buffer.size() : this->queue.empty());
+  }
+
+private:
+  std::vector<value_type>                 buffer;
+  size_type                               capacity, values;
+  size_type                               offset; // In the buffer.
+  std::vector<std::string>                filenames;
+  std::vector<size_type>                  value_counts;
+
+  std::vector<sdsl::int_vector_buffer<8>> inputs;
+  std::vector<size_type>                  read_counts, data_pointers;
+  std::vector<value_type>                 heads;
+  std::priority_queue<queue_type, std::vector<queue_type>, std::greater<queue_type>> queue;
+  value_type                              value;
+
+  void flush()
+  {
+    if(this->buffer.empty()) { return; }
+    parallelQuickSort(this->buffer.begin(), this->buffer.end());
+    this->filenames.push_back(TempFile::getName(TEMP_FILE_PREFIX));
+    this->value_counts.push_back(this->buffer.size());
+    sdsl::int_vector_buffer<8> out(this->filenames.back(), std::ios::out, MEGABYTE);
+    size_type prev = 0;
+    for(const value_type& value : this->buffer)
+    {
+      ByteCode::write(out, value[0] - prev); prev = value[0];
+      for(size_type i = 1; i < N; i++) { ByteCode::write(out, value[i]); }
+    }
+    out.close();
+    this->buffer.clear();
+  }
+
+  // Reads the next value from the file to heads[file]. Returns false if there are no more values.
+  bool read(size_type file)
+  {
+    if(this->read_counts[file] >= this->value_counts[file]) { return false; }
+    value_type& head = this->heads[file];
+    size_type prev = (this->read_counts[file] > 0 ? head[0] : 0);
+    head[0] = prev + ByteCode::read(this->inputs[file], this->data_pointers[file]);
+    for(size_type i = 1; i < N; i++) { head[i] = ByteCode::read(this->inputs[file], this->data_pointers[file]); }
+    this->read_counts[file]++;
+    return true;
+  }
+
+  ExternalSorter(const ExternalSorter&) = delete;
+  ExternalSorter& operator=(const ExternalSorter&) = delete;
+};
+
+template<size_type N>
+const std::string ExternalSorter<N>::TEMP_FILE_PREFIX = "sort";
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
 
 #endif // GBWT_BWTMERGE_H
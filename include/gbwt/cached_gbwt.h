@@ -165,6 +165,12 @@ public:
 
   BidirectionalState bdExtendBackward(BidirectionalState state, node_type node) const { return gbwt::bdExtendBackward(*this, state, node); }
 
+  // Batched extension. The results replace the states in the requests.
+  void bdExtend(std::vector<BidirectionalExtension>& requests) const { gbwt::bdExtend(*this, requests); }
+
+  // Matching statistics for the query. Requires a bidirectional index.
+  MatchingStatistics matchingStatistics(const vector_type& query) const { return gbwt::matchingStatistics(*this, query); }
+
 //------------------------------------------------------------------------------
 
   /*
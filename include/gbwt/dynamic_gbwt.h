@@ -26,6 +26,8 @@
 #ifndef GBWT_DYNAMIC_GBWT_H
 #define GBWT_DYNAMIC_GBWT_H
 
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <gbwt/gbwt.h>
@@ -50,6 +52,7 @@ public:
   constexpr static size_type REMOVE_CHUNK_SIZE = 1;             // Sequences.
   constexpr static size_type MERGE_BATCH_SIZE = 2000;           // Sequences.
   constexpr static size_type SAMPLE_INTERVAL = 1024;            // Positions in a sequence.
+  constexpr static size_type PARALLEL_UPDATE_THRESHOLD = 1024;  // Sequences.
 
 //------------------------------------------------------------------------------
 
@@ -121,6 +124,21 @@ public:
   */
   void merge(const DynamicGBWT& source, const MergeParameters& parameters);
 
+  /*
+    Parallel merging of multiple sources in a single pass. The rank arrays for all sources
+    are built relative to this index and the other sources, the records are merged once,
+    and the edges are rebuilt once. The result is the same as when merging the sources one
+    at a time. Empty sources are ignored.
+
+    Each merge job reads the rank arrays of all sources at the same time, using a thread and
+    a file descriptor for every rank array file. The sources share the read buffers, but the
+    number of threads and open files grows with the number of sources. With hundreds of
+    sources, merge them in batches.
+
+    Merges the metadata if all indexes contain it.
+  */
+  void merge(const std::vector<const DynamicGBWT*>& sources, const MergeParameters& parameters);
+
 //------------------------------------------------------------------------------
 
   /*
@@ -200,6 +218,15 @@ public:
 
   BidirectionalState bdExtendBackward(BidirectionalState state, node_type node) const { return gbwt::bdExtendBackward(*this, state, node); }
 
+  // Batched extension. The results replace the states in the requests.
+  void bdExtend(std::vector<BidirectionalExtension>& requests) const { gbwt::bdExtend(*this, requests); }
+
+  // Matching statistics for the query. Requires a bidirectional index.
+  MatchingStatistics matchingStatistics(const vector_type& query) const { return gbwt::matchingStatistics(*this, query); }
+
+  // Matching statistics for a batch of queries in parallel.
+  std::vector<MatchingStatistics> matchingStatistics(const std::vector<vector_type>& queries) const { return gbwt::matchingStatistics(*this, queries); }
+
 //------------------------------------------------------------------------------
 
   /*
@@ -400,6 +427,132 @@ private:
 
 //------------------------------------------------------------------------------
 
+/*
+  A builder for multiple producer threads. Node ids are divided into ranges, and each range
+  is built as an independent DynamicGBWT with its own GBWTBuilder, so the partitions are
+  constructed concurrently. A sequence goes to the partition containing its first node, and
+  all of its nodes must be in the same partition (e.g. paths on the same contig). insert()
+  returns false and does not insert the sequence if it spans multiple partitions. It
+  can be called from multiple threads, and producers only wait for each other when they
+  insert into the same partition. finish() combines the partitions with the fast merge
+  for indexes over disjoint node ranges.
+
+  Partition i contains node ids in [first_ids[i], first_ids[i + 1]), and the first partition
+  also contains all smaller ids. Each partition uses two buffers of 'batch_size' nodes.
+
+  Sequence identifiers are assigned partition by partition. Within a partition, they follow
+  the order in which the insertions were made.
+*/
+
+class PartitionedGBWTBuilder
+{
+public:
+  PartitionedGBWTBuilder(const std::vector<size_type>& first_ids, size_type node_width,
+                         size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE,
+                         size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL);
+
+  size_type partitions() const { return this->first_ids.size(); }
+  size_type partition(node_type node) const;
+
+  // Thread-safe. Returns false if the sequence spans multiple partitions.
+  bool insert(const vector_type& sequence, bool both_orientations = false);
+  void finish();
+
+  GBWT index;
+
+  PartitionedGBWTBuilder(const PartitionedGBWTBuilder&) = delete;
+  PartitionedGBWTBuilder& operator= (const PartitionedGBWTBuilder&) = delete;
+
+private:
+  struct Partition
+  {
+    Partition(size_type node_width, size_type batch_size, size_type sample_interval) :
+      builder(node_width, batch_size, sample_interval)
+    {
+    }
+
+    GBWTBuilder builder;
+    std::mutex  mtx;
+  };
+
+  std::vector<size_type>                  first_ids;
+  std::vector<std::unique_ptr<Partition>> builders;
+}; // class PartitionedGBWTBuilder
+
+//------------------------------------------------------------------------------
+
+/*
+  Build a compressed GBWT containing the given paths from the source. Path identifiers
+  refer to the metadata; in a bidirectional index, both orientations of each path are
+  included. The paths are extracted in parallel in chunks, and each chunk is inserted
+  with GBWTBuilder while the next one is being extracted. If the source has metadata,
+  it is restricted to the selected paths. Returns an empty index on failure.
+*/
+
+GBWT subset(const GBWT& source, std::vector<size_type> path_ids,
+            size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE,
+            size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL);
+
+/*
+  Node renumbering for better memory locality. The translation table maps original node
+  ids (Node::id) to new node ids, and both orientations of a node keep the same id.
+
+    bfsOrder  order the node ids by a breadth-first traversal over the edges, starting
+              from the successors of the endmarker; unreachable ids are placed last
+    renumber  rebuild the index with translated node ids; sequence ids and metadata are
+              unchanged; returns an empty index on failure
+*/
+
+std::vector<size_type> bfsOrder(const GBWT& index);
+GBWT renumber(const GBWT& source, const std::vector<size_type>& translation,
+              size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE,
+              size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL);
+
+/*
+  Build a compressed GBWT directly from the texts in the given files without the dynamic
+  representation. Each text is a concatenation of sequences ending with endmarkers, and
+  the sequences receive identifiers in the order they appear. Set both_orientations to
+  insert the reverse of each sequence after it. The reverse prefixes at each position are
+  sorted by prefix doubling, using external memory sorts with buffers of 'buffer_size'
+  tuples. Memory usage also includes a few integers for each node and each sequence.
+  The result is the same as with DynamicGBWT::insert(). Does not set metadata.
+*/
+
+GBWT buildExternal(const std::vector<std::string>& text_files, bool both_orientations = false,
+                   size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL,
+                   size_type buffer_size = DynamicGBWT::INSERT_BATCH_SIZE);
+
+/*
+  Build a compressed GBWT from a text in memory. The text is a concatenation of sequences
+  ending with endmarkers, as in DynamicGBWT::insert(), and the sequences receive identifiers
+  in the order they appear. The ordering is determined by sorting the reverse prefixes at
+  each position with parallel prefix doubling, which takes O(log n) passes, where n is the
+  length of the longest sequence, instead of O(n) with insertion. This is faster than
+  insertion for a small number of long sequences, but memory usage is three integers per
+  position in addition to the text. The result is the same as with DynamicGBWT::insert().
+  The second version reads the texts from files as in buildExternal(). Does not set metadata.
+*/
+
+GBWT buildBulk(const text_type& text, bool has_both_orientations = false,
+               size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL);
+GBWT buildBulk(const std::vector<std::string>& text_files, bool both_orientations = false,
+               size_type sample_interval = DynamicGBWT::SAMPLE_INTERVAL);
+
+/*
+  Merge compressed GBWTs with possibly overlapping node ids using the parallel algorithm
+  without converting them to the dynamic representation. The sequences from each source
+  receive identifiers after those from the earlier sources, and the result is the same as
+  when merging the dynamic versions of the sources with DynamicGBWT::merge(). Compressed
+  records do not store incoming edges, so they are rebuilt from the outgoing edges using
+  an integer or two for each edge. The merged records are compressed as they are built.
+  Also merges the metadata if all sources contain it. The number of sources is limited in
+  the same way as in DynamicGBWT::merge().
+*/
+
+GBWT mergeCompressed(const std::vector<const GBWT*>& sources, const MergeParameters& parameters);
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
 
 #endif // GBWT_DYNAMIC_GBWT_H
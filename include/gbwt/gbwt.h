@@ -53,12 +53,18 @@ public:
   GBWT(const GBWT& source);
   GBWT(const DynamicGBWT& source);
   GBWT(GBWT&& source);
+
+  // Compresses the source while releasing its records. Leaves the source empty.
+  GBWT(DynamicGBWT&& source);
   ~GBWT();
 
   // Merge the sources, assuming that node ids do not overlap.
   // Also merges the metadata if all indexes contain it.
   explicit GBWT(const std::vector<GBWT>& sources);
 
+  // Assemble the index from components built elsewhere.
+  GBWT(const GBWTHeader& header, RecordArray&& bwt, DASamples&& da_samples);
+
   void swap(GBWT& another);
   GBWT& operator=(const GBWT& source);
   GBWT& operator=(const DynamicGBWT& source);
@@ -148,6 +154,15 @@ public:
 
   BidirectionalState bdExtendBackward(BidirectionalState state, node_type node) const { return gbwt::bdExtendBackward(*this, state, node); }
 
+  // Batched extension. The results replace the states in the requests.
+  void bdExtend(std::vector<BidirectionalExtension>& requests) const { gbwt::bdExtend(*this, requests); }
+
+  // Matching statistics for the query. Requires a bidirectional index.
+  MatchingStatistics matchingStatistics(const vector_type& query) const { return gbwt::matchingStatistics(*this, query); }
+
+  // Matching statistics for a batch of queries in parallel.
+  std::vector<MatchingStatistics> matchingStatistics(const std::vector<vector_type>& queries) const { return gbwt::matchingStatistics(*this, queries); }
+
 //------------------------------------------------------------------------------
 
   /*
@@ -291,6 +306,49 @@ void printStatistics(const GBWT& gbwt, const std::string& name);
 
 //------------------------------------------------------------------------------
 
+/*
+  Fast merge of compressed GBWT files with non-overlapping node ids. The result is the same
+  as when loading the indexes, merging them with GBWT(const std::vector<GBWT>&), and writing
+  the merged index to the output file. The records are streamed from the inputs to the
+  output, but the samples, the metadata, and the record indexes of all inputs are in
+  memory at the same time. Merging the samples also uses 16 bytes per sample for
+  temporary arrays. Memory usage may therefore exceed the size of the largest input.
+  Returns the header of the merged index.
+*/
+
+GBWTHeader mergeFiles(const std::vector<std::string>& input_files, const std::string& output_file);
+
+//------------------------------------------------------------------------------
+
+/*
+  Record statistics for a compressed GBWT, computed in a single parallel pass over the
+  records. The distributions map each value to the number of records with that value,
+  except that the run length distribution counts runs. The endmarker is not included in
+  the distributions or the totals.
+*/
+
+struct GBWTStatistics
+{
+  typedef gbwt::size_type size_type;
+
+  size_type records; // Excluding the endmarker.
+  size_type total_size, total_runs, total_outdegree, total_bytes;
+  size_type endmarker_size, endmarker_runs, endmarker_outdegree, endmarker_bytes;
+  size_type sampled_records, samples;
+
+  std::map<size_type, size_type> sizes, runs, outdegrees, bytes, run_lengths;
+
+  GBWTStatistics();
+  explicit GBWTStatistics(const GBWT& index);
+
+  // Average number of positions per DA sample.
+  double sampleInterval() const { return (this->samples > 0 ? (this->total_size + this->endmarker_size) / static_cast<double>(this->samples) : 0.0); }
+
+  void merge(const GBWTStatistics& another);
+};
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
 
 #endif // GBWT_GBWT_H
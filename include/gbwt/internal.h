@@ -176,6 +176,89 @@ struct ByteCode
 
 //------------------------------------------------------------------------------
 
+/*
+  Frame-of-reference encoding for blocks of up to FRAME_SIZE unsigned integers. A frame
+  starts with a byte containing the bit width w of the largest value, followed by the
+  values packed into ceil(n * w / 8) bytes in LSB order. The number of values n is not
+  stored. Decoding gathers the bytes into 64-bit words and extracts the values from the
+  words, which is much faster than decoding ByteCode one byte at a time.
+*/
+
+struct FrameCode
+{
+  typedef gbwt::size_type value_type;
+  typedef gbwt::byte_type code_type;
+
+  constexpr static size_type FRAME_SIZE = 128;
+  constexpr static size_type WORD_BITS  = 64;
+
+  /*
+    Reads n values into the buffer and updates i to point to the byte after the frame.
+  */
+  template<class ByteArray>
+  static void read(ByteArray& array, size_type& i, value_type* values, size_type n)
+  {
+    size_type width = array[i]; i++;
+    if(width == 0)
+    {
+      for(size_type j = 0; j < n; j++) { values[j] = 0; }
+      return;
+    }
+
+    // Gather the bytes into words. There is an extra zero word at the end.
+    std::uint64_t words[FRAME_SIZE + 1];
+    size_type bytes = (n * width + BYTE_BITS - 1) / BYTE_BITS, word_count = (bytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+    for(size_type word = 0, j = 0; word < word_count; word++)
+    {
+      std::uint64_t value = 0;
+      size_type limit = std::min(j + sizeof(std::uint64_t), bytes);
+      for(size_type shift = 0; j < limit; j++, shift += BYTE_BITS) { value |= static_cast<std::uint64_t>(array[i + j]) << shift; }
+      words[word] = value;
+    }
+    words[word_count] = 0;
+    i += bytes;
+
+    // Extract the values without branches. The high part is shifted in two steps, because
+    // shifting by WORD_BITS is undefined.
+    std::uint64_t mask = (width >= WORD_BITS ? ~static_cast<std::uint64_t>(0) : (static_cast<std::uint64_t>(1) << width) - 1);
+    for(size_type j = 0, bit = 0; j < n; j++, bit += width)
+    {
+      size_type word = bit / WORD_BITS, offset = bit % WORD_BITS;
+      std::uint64_t value = (words[word] >> offset) | ((words[word + 1] << 1) << (WORD_BITS - 1 - offset));
+      values[j] = value & mask;
+    }
+  }
+
+  /*
+    Encodes n <= FRAME_SIZE values and stores them in the array using push_back().
+  */
+  template<class ByteArray>
+  static void write(ByteArray& array, const value_type* values, size_type n)
+  {
+    value_type max_value = 0;
+    for(size_type j = 0; j < n; j++) { max_value |= values[j]; }
+    size_type width = (max_value == 0 ? 0 : bit_length(max_value));
+    array.push_back(width);
+    if(width == 0) { return; }
+
+    std::uint64_t words[FRAME_SIZE + 1];
+    size_type bytes = (n * width + BYTE_BITS - 1) / BYTE_BITS, word_count = (bytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+    for(size_type j = 0; j <= word_count; j++) { words[j] = 0; }
+    for(size_type j = 0, bit = 0; j < n; j++, bit += width)
+    {
+      size_type word = bit / WORD_BITS, offset = bit % WORD_BITS;
+      words[word] |= static_cast<std::uint64_t>(values[j]) << offset;
+      words[word + 1] |= (static_cast<std::uint64_t>(values[j]) >> 1) >> (WORD_BITS - 1 - offset);
+    }
+    for(size_type j = 0; j < bytes; j++)
+    {
+      array.push_back((words[j / sizeof(std::uint64_t)] >> (BYTE_BITS * (j % sizeof(std::uint64_t)))) & 0xFF);
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
 /*
   Run-length encoding using ByteCode. Run lengths and alphabet size are assumed to be > 0.
   If GBWT_SAVE_MEMORY is defined, this will operate on 32-bit integers instead of
@@ -262,10 +345,10 @@ struct Run
 
 struct RunMerger
 {
-  size_type              total_size;
-  run_type               accumulator;
-  std::vector<run_type>  runs;
-  std::vector<size_type> counts;
+  size_type               total_size;
+  run_type                accumulator;
+  record_vector<run_type> runs;
+  std::vector<size_type>  counts;
 
   RunMerger(size_type sigma) : total_size(0), accumulator(0, 0), counts(sigma) {}
 
@@ -328,6 +411,23 @@ struct Sequence
   }
 };
 
+/*
+  Stable LSD radix sort of the sequences by the 'next' node using RADIX_BITS bits per
+  pass. If the sequences with the same (curr, next) are already sorted by offset and the
+  sequences are sorted by curr, the result is sorted by (next, curr, offset). Each pass
+  is parallelized over blocks of sequences when there are at least PARALLEL_THRESHOLD
+  sequences. Passes where all sequences share the same digit are skipped.
+*/
+
+struct SequenceRadixSort
+{
+  constexpr static size_type RADIX_BITS = 8;
+  constexpr static size_type RADIX = static_cast<size_type>(1) << RADIX_BITS;
+  constexpr static size_type PARALLEL_THRESHOLD = 65536; // Sequences.
+
+  static void sort(std::vector<Sequence>& seqs);
+};
+
 //------------------------------------------------------------------------------
 
 /*
@@ -103,6 +103,9 @@ public:
   constexpr static std::uint64_t INITIAL_FLAG_MASK = 0x0000;
 
   Metadata();
+
+  // Equivalent to merging the sources one by one, but builds the dictionaries in a
+  // single pass and remaps the path names in parallel.
   Metadata(std::vector<const Metadata*> sources, bool same_samples, bool same_contigs);
 
   size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr, std::string name = "") const;
@@ -159,6 +162,11 @@ public:
   std::vector<size_type> removeSample(size_type sample_id);
   std::vector<size_type> removeContig(size_type contig_id);
 
+  // Keep only the metadata corresponding to the given paths. Path identifiers must be
+  // sorted and unique. Samples and contigs without any remaining paths are removed.
+  // Without path names, the header is left unchanged.
+  void subset(const std::vector<size_type>& path_ids);
+
   // Merge the metadata from the source into this object.
   // If the objects to be merged both contain sample / contig names, this overides the
   // same_samples / same_contigs flags.
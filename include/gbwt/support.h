@@ -77,6 +77,62 @@ void reversePath(const vector_type& path, text_type& output, size_type& tail);
 
 //------------------------------------------------------------------------------
 
+/*
+  A pool for the vectors in dynamic records. Allocations of up to MAX_POOLED_BYTES bytes
+  are rounded up to a power of two and served from per-thread free lists. The threads
+  exchange blocks in batches of TRANSFER_SIZE with a shared depot, which carves new
+  blocks from slabs of SLAB_SIZE bytes. Freed blocks are reused for allocations of the
+  same size class. Larger allocations use the global operator new. The slabs are kept
+  until release() is called.
+*/
+
+struct RecordPool
+{
+  constexpr static size_type MIN_CLASS_BITS   = 4;  // 16 bytes.
+  constexpr static size_type MAX_CLASS_BITS   = 12; // 4 KiB.
+  constexpr static size_type CLASSES          = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+  constexpr static size_type MAX_POOLED_BYTES = static_cast<size_type>(1) << MAX_CLASS_BITS;
+  constexpr static size_type SLAB_SIZE        = MEGABYTE;
+  constexpr static size_type TRANSFER_SIZE    = 64; // Blocks.
+
+  static void* allocate(size_type bytes);
+  static void deallocate(void* ptr, size_type bytes);
+
+  // Total size of the slabs allocated so far.
+  static size_type reservedBytes();
+
+  // Releases all slabs and returns their total size. Call only when no pooled blocks are
+  // in use, e.g. after the dynamic records have been compressed. The free lists of other
+  // threads are discarded the next time they use the pool.
+  static size_type release();
+};
+
+template<class T>
+struct RecordAllocator
+{
+  typedef T value_type;
+
+  RecordAllocator() noexcept {}
+  template<class U> RecordAllocator(const RecordAllocator<U>&) noexcept {}
+
+  T* allocate(std::size_t n) { return static_cast<T*>(RecordPool::allocate(n * sizeof(T))); }
+  void deallocate(T* ptr, std::size_t n) noexcept { RecordPool::deallocate(ptr, n * sizeof(T)); }
+};
+
+template<class T, class U>
+bool operator==(const RecordAllocator<T>&, const RecordAllocator<U>&) { return true; }
+
+template<class T, class U>
+bool operator!=(const RecordAllocator<T>&, const RecordAllocator<U>&) { return false; }
+
+#ifdef GBWT_POOLED_RECORDS
+template<class T> using record_vector = std::vector<T, RecordAllocator<T>>;
+#else
+template<class T> using record_vector = std::vector<T>;
+#endif
+
+//------------------------------------------------------------------------------
+
 /*
   The part of the BWT corresponding to a single node (the suffixes starting with / the
   prefixes ending with that node).
@@ -92,10 +148,11 @@ struct DynamicRecord
 {
   typedef gbwt::size_type size_type;
 
-  size_type                body_size;
-  std::vector<edge_type>   incoming, outgoing;
-  std::vector<run_type>    body;
-  std::vector<sample_type> ids;
+  size_type                  body_size;
+  record_vector<edge_type>   incoming;
+  std::vector<edge_type>     outgoing;
+  record_vector<run_type>    body;
+  record_vector<sample_type> ids;
 
 //------------------------------------------------------------------------------
 
@@ -179,8 +236,8 @@ struct DynamicRecord
   // The sum of count(inrank) for all 'inrank' with predecessor(inrank) <= 'from'.
   size_type countUntil(node_type from) const;
 
-  // Increment the count of the incoming edge from 'from'.
-  void increment(node_type from);
+  // Increment the count of the incoming edge from 'from' by 'n'.
+  void increment(node_type from, size_type n = 1);
 
   // Add a new incoming edge.
   void addIncoming(edge_type inedge);
@@ -188,7 +245,7 @@ struct DynamicRecord
 //------------------------------------------------------------------------------
 
   // Returns the first sample at offset >= i or ids.end() if there is no sample.
-  std::vector<sample_type>::const_iterator nextSample(size_type i) const;
+  record_vector<sample_type>::const_iterator nextSample(size_type i) const;
 
 };  // struct DynamicRecord
 
@@ -358,6 +415,11 @@ struct RecordArray
   ~RecordArray();
 
   explicit RecordArray(const std::vector<DynamicRecord>& bwt);
+
+  // Compresses the records in parallel chunks and releases each record after compressing
+  // it. The chunks are concatenated after all records have been released, which briefly
+  // needs two copies of the compressed records. Clears the source.
+  explicit RecordArray(std::vector<DynamicRecord>&& bwt);
   RecordArray(const std::vector<RecordArray const*> sources, const sdsl::int_vector<0>& origins, const std::vector<size_type>& record_offsets);
 
   // Set the number of records, build the data manually, and give the offsets to build the index.
@@ -371,6 +433,14 @@ struct RecordArray
   size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr, std::string name = "") const;
   void load(std::istream& in);
 
+  // Serialize / load everything except the data, which follows as raw bytes. The size of
+  // the data is the universe of the index.
+  size_type serializeIndex(std::ostream& out, sdsl::structure_tree_node* child) const;
+  void loadIndex(std::istream& in);
+
+  // Merge the endmarkers of the sources and append the merged record to the data.
+  static void mergeEndmarkers(const std::vector<RecordArray const*>& sources, std::vector<byte_type>& data);
+
   size_type size() const { return this->records; }
   bool empty() const { return (this->size() == 0); }
   bool empty(size_type record) const { return CompressedRecord::emptyRecord(this->data, this->start(record)); }
@@ -412,6 +482,10 @@ struct DASamples
   ~DASamples();
 
   explicit DASamples(const std::vector<DynamicRecord>& bwt);
+
+  // The sampled records are (record, size) in order, and the samples are (offset, id) with
+  // offsets relative to the concatenation of the sampled records.
+  DASamples(size_type records, const std::vector<range_type>& sampled, const std::vector<range_type>& samples);
   DASamples(const std::vector<DASamples const*> sources, const sdsl::int_vector<0>& origins, const std::vector<size_type>& record_offsets, const std::vector<size_type>& sequence_counts);
 
   void swap(DASamples& another);
@@ -452,6 +526,7 @@ struct MergeParameters
   constexpr static size_type MERGE_BUFFERS = 6;
   constexpr static size_type CHUNK_SIZE = 1; // Sequences per thread.
   constexpr static size_type MERGE_JOBS = 4;
+  constexpr static size_type RA_MEMORY = 0; // Megabytes.
 
   constexpr static size_type MAX_BUFFER_SIZE = 16384; // Megabytes.
   constexpr static size_type MAX_MERGE_BUFFERS = 16;
@@ -464,15 +539,20 @@ struct MergeParameters
   void setMergeBuffers(size_type n);
   void setChunkSize(size_type n);
   void setMergeJobs(size_type n);
+  void setRAMemory(size_type megabytes);
 
   // These return the sizes in positions/bytes.
   size_type posBufferPositions() const { return (this->pos_buffer_size * MEGABYTE) / sizeof(edge_type); }
   size_type threadBufferBytes() const { return this->thread_buffer_size * MEGABYTE; }
+  size_type raMemoryBytes() const { return this->ra_memory * MEGABYTE; }
 
   size_type pos_buffer_size, thread_buffer_size;
   size_type merge_buffers;
   size_type chunk_size;
   size_type merge_jobs;
+
+  // Keep the rank array in memory until it exceeds this many megabytes; 0 disables.
+  size_type ra_memory;
 };
 
 //------------------------------------------------------------------------------
@@ -494,6 +574,14 @@ public:
   explicit Dictionary(const std::vector<std::string>& source);
   Dictionary(const Dictionary& first, const Dictionary& second);
 
+  // Merges the sources in a single pass using hashed lookups. Null sources are skipped.
+  // The keys of the first source keep their ids, and the new keys from the other sources
+  // get the next ids in order. Like in repeated pairwise merging, a key is added unless it
+  // is in an earlier source, so duplicate keys within a source are all kept. Sets
+  // mappings[i][j] to the id of key j of sources[i]. For the other sources, that is the
+  // id of the first copy of the key.
+  Dictionary(const std::vector<const Dictionary*>& sources, std::vector<std::vector<size_type>>& mappings);
+
   void swap(Dictionary& another);
   Dictionary& operator=(const Dictionary& source);
   Dictionary& operator=(Dictionary&& source);
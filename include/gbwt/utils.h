@@ -58,6 +58,15 @@ namespace gbwt
 
 #define GBWT_SAVE_MEMORY
 
+/*
+  With GBWT_POOLED_RECORDS, dynamic records allocate their frequently reallocated vectors
+  from a pool (see RecordPool in support.h) instead of the general-purpose allocator. This
+  reduces the allocator overhead during construction, where the body of each updated
+  record is rebuilt in every iteration, but the pool keeps the memory until it is
+  released. The option is off by default. Enable it with `make POOLED_RECORDS=1` or
+  `cmake -DPOOLED_RECORDS=ON`, and use the same setting for the library and its users.
+*/
+
 //------------------------------------------------------------------------------
 
 typedef std::uint64_t size_type;
@@ -175,8 +184,8 @@ std::ostream& operator<<(std::ostream& out, const std::pair<A, B>& data)
   return out << "(" << data.first << ", " << data.second << ")";
 }
 
-template<class A>
-std::ostream& operator<<(std::ostream& out, const std::vector<A>& data)
+template<class A, class Allocator>
+std::ostream& operator<<(std::ostream& out, const std::vector<A, Allocator>& data)
 {
   out << "{ ";
   for(const A& element : data) { out << element << " "; }
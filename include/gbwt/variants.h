@@ -26,7 +26,7 @@
 #ifndef GBWT_VARIANTS_H
 #define GBWT_VARIANTS_H
 
-#include <gbwt/utils.h>
+#include <gbwt/gbwt.h>
 
 #include <functional>
 #include <map>
@@ -349,6 +349,43 @@ void generateHaplotypes(const VariantPaths& variants, const std::set<std::string
 
 //------------------------------------------------------------------------------
 
+/*
+  Concurrent construction from VCF parses. Each contig is built as a separate compressed
+  GBWT with GBWTBuilder, and the contigs are merged with the fast merge, as their node
+  ranges are disjoint. The parses are loaded in input order. A parse is loaded when its
+  file fits in the memory budget together with the contigs in flight, and the contig is
+  started when there are fewer than 'max_jobs' contigs in flight and its estimated memory
+  usage fits in the budget. A budget of 0 bytes means no limit, and a contig that would be
+  alone in flight is always started. The finished contigs count against the budget until
+  they are merged. Each contig is built with an equal share of the OpenMP threads.
+
+  The metadata is the same as in sequential construction with one GBWTBuilder: path names
+  use the contig number as the contig id, the sample and contig names are used if all
+  parses have them, and the sample names come from the first parse. Unresolved overlaps
+  are reported in input order if parameters.check_overlaps is set.
+*/
+
+struct ContigParameters
+{
+  size_type             batch_size, sample_interval;
+  bool                  both_orientations, check_overlaps, skip_overlaps;
+  std::set<std::string> phasing_files;
+};
+
+GBWT buildContigs(const std::vector<std::string>& parse_files, const ContigParameters& parameters,
+                  size_type max_jobs, size_type memory_budget);
+
+/*
+  Estimated memory usage of building the contig: the parse, the construction buffers, and
+  the dynamic index. Each haplotype is assumed to be diploid, to start a new run around each
+  site, and to be sampled once every 'sample_interval' nodes. The vectors in the dynamic
+  index may use up to twice their size due to reallocation.
+*/
+
+size_type estimateContigMemory(const VariantPaths& variants, const ContigParameters& parameters);
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt
 
 #endif // GBWT_VARIANTS_H
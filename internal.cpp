@@ -38,6 +38,13 @@ constexpr size_type ByteCode::DATA_BITS;
 constexpr ByteCode::code_type ByteCode::DATA_MASK;
 constexpr ByteCode::code_type ByteCode::NEXT_BYTE;
 
+constexpr size_type FrameCode::FRAME_SIZE;
+constexpr size_type FrameCode::WORD_BITS;
+
+constexpr size_type SequenceRadixSort::RADIX_BITS;
+constexpr size_type SequenceRadixSort::RADIX;
+constexpr size_type SequenceRadixSort::PARALLEL_THRESHOLD;
+
 //------------------------------------------------------------------------------
 
 template<>
@@ -108,6 +115,64 @@ Sequence::Sequence(node_type node, size_type seq_id, size_type source_pos) :
 {
 }
 
+void
+SequenceRadixSort::sort(std::vector<Sequence>& seqs)
+{
+  if(seqs.size() <= 1) { return; }
+
+  node_type max_node = 0;
+  for(const Sequence& seq : seqs) { max_node = std::max(max_node, seq.next); }
+  size_type passes = (bit_length(max_node) + RADIX_BITS - 1) / RADIX_BITS;
+
+  size_type threads = (seqs.size() >= PARALLEL_THRESHOLD ? omp_get_max_threads() : 1);
+  std::vector<range_type> blocks = Range::partition(range_type(0, seqs.size() - 1), threads);
+  std::vector<std::vector<size_type>> counts(blocks.size(), std::vector<size_type>(RADIX, 0));
+  std::vector<Sequence> buffer(seqs.size());
+
+  for(size_type pass = 0; pass < passes; pass++)
+  {
+    size_type shift = pass * RADIX_BITS;
+
+    // Count the digits in each block.
+    #pragma omp parallel for schedule(static) if(blocks.size() > 1)
+    for(size_type block = 0; block < blocks.size(); block++)
+    {
+      std::vector<size_type>& block_counts = counts[block];
+      std::fill(block_counts.begin(), block_counts.end(), 0);
+      for(size_type i = blocks[block].first; i <= blocks[block].second; i++)
+      {
+        block_counts[(seqs[i].next >> shift) & (RADIX - 1)]++;
+      }
+    }
+
+    // Turn the counts into starting offsets. Skip the pass if all digits are the same.
+    size_type total = 0;
+    bool single_digit = false;
+    for(size_type digit = 0; digit < RADIX; digit++)
+    {
+      size_type digit_start = total;
+      for(size_type block = 0; block < blocks.size(); block++)
+      {
+        size_type temp = counts[block][digit]; counts[block][digit] = total; total += temp;
+      }
+      if(total - digit_start == seqs.size()) { single_digit = true; break; }
+    }
+    if(single_digit) { continue; }
+
+    // Distribute the sequences.
+    #pragma omp parallel for schedule(static) if(blocks.size() > 1)
+    for(size_type block = 0; block < blocks.size(); block++)
+    {
+      std::vector<size_type>& block_counts = counts[block];
+      for(size_type i = blocks[block].first; i <= blocks[block].second; i++)
+      {
+        buffer[block_counts[(seqs[i].next >> shift) & (RADIX - 1)]++] = seqs[i];
+      }
+    }
+    seqs.swap(buffer);
+  }
+}
+
 //------------------------------------------------------------------------------
 
 } // namespace gbwt
@@ -23,9 +23,11 @@
   SOFTWARE.
 */
 
+#include <fstream>
 #include <unistd.h>
 
 #include <gbwt/dynamic_gbwt.h>
+#include <gbwt/bwtmerge.h>
 
 using namespace gbwt;
 
@@ -35,7 +37,7 @@ const std::string tool_name = "GBWT merging";
 
 void printUsage(int exit_code = EXIT_SUCCESS);
 
-enum MergingAlgorithm { ma_insert, ma_fast, ma_parallel };
+enum MergingAlgorithm { ma_insert, ma_fast, ma_stream, ma_parallel, ma_compressed };
 
 std::string algorithmName(MergingAlgorithm algorithm);
 
@@ -47,24 +49,36 @@ main(int argc, char** argv)
   if(argc < 5) { printUsage(); }
 
   size_type batch_size = DynamicGBWT::MERGE_BATCH_SIZE, sample_interval = DynamicGBWT::SAMPLE_INTERVAL;
+  size_type merge_inputs = 0; // All inputs at once.
   MergingAlgorithm algorithm = ma_insert;
   MergeParameters parameters;
-  std::string output;
+  std::string output, progress_file;
+  double progress_interval = MergeProgress::DEFAULT_INTERVAL;
   int c = 0;
-  while((c = getopt(argc, argv, "b:C:fiJ:M:o:pP:s:S:t:T:")) != -1)
+  while((c = getopt(argc, argv, "b:cC:dfiJ:k:l:L:M:o:pP:R:s:S:t:T:")) != -1)
   {
     switch(c)
     {
     case 'b':
       batch_size = std::stoul(optarg); break;
+    case 'c':
+      algorithm = ma_compressed; break;
     case 'C':
       parameters.setChunkSize(std::stoul(optarg)); break;
+    case 'd':
+      algorithm = ma_stream; break;
     case 'f':
       algorithm = ma_fast; break;
     case 'i':
       algorithm = ma_insert; break;
     case 'J':
       parameters.setMergeJobs(std::stoul(optarg)); break;
+    case 'k':
+      merge_inputs = std::stoul(optarg); break;
+    case 'l':
+      progress_interval = std::stod(optarg); break;
+    case 'L':
+      progress_file = optarg; break;
     case 'M':
       parameters.setMergeBuffers(std::stoul(optarg)); break;
     case 'o':
@@ -73,6 +87,8 @@ main(int argc, char** argv)
       algorithm = ma_parallel; break;
     case 'P':
       parameters.setPosBufferSize(std::stoul(optarg)); break;
+    case 'R':
+      parameters.setRAMemory(std::stoul(optarg)); break;
     case 's':
       sample_interval = std::stoul(optarg); break;
     case 'S':
@@ -91,6 +107,11 @@ main(int argc, char** argv)
   size_type input_files = argc - optind;
   size_type total_inserted = 0;
   if(input_files <= 1 || output.empty()) { printUsage(EXIT_FAILURE); }
+  if(!progress_file.empty() && algorithm != ma_parallel && algorithm != ma_compressed)
+  {
+    std::cerr << "merge_gbwt: Progress reports (-L) are only available with -c and -p" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
 
   Version::print(std::cout, tool_name);
 
@@ -102,7 +123,7 @@ main(int argc, char** argv)
     printHeader("Batch size"); std::cout << batch_size << std::endl;
     printHeader("Sample interval"); std::cout << sample_interval << std::endl;
   }
-  else if(algorithm == ma_parallel)
+  else if(algorithm == ma_parallel || algorithm == ma_compressed)
   {
     printHeader("Temp directory"); std::cout << TempFile::temp_dir << std::endl;
     printHeader("Search threads"); std::cout << omp_get_max_threads() << std::endl;
@@ -111,12 +132,33 @@ main(int argc, char** argv)
     printHeader("Merge buffers"); std::cout << parameters.merge_buffers << std::endl;
     printHeader("Chunk size"); std::cout << parameters.chunk_size << std::endl;
     printHeader("Merge jobs"); std::cout << parameters.merge_jobs << std::endl;
+    printHeader("RA memory"); std::cout << parameters.ra_memory << " MB" << std::endl;
+    if(algorithm == ma_parallel && merge_inputs > 0)
+    {
+      printHeader("Inputs per merge"); std::cout << merge_inputs << std::endl;
+    }
+    if(!progress_file.empty())
+    {
+      printHeader("Progress file"); std::cout << progress_file << " (every " << progress_interval << " s)" << std::endl;
+    }
   }
   std::cout << std::endl;
 
   double start = readTimer();
 
-  if(algorithm == ma_fast)
+  // Progress is only reported during the merges, after the inputs of each merge have been loaded.
+  std::ofstream progress;
+  if(!progress_file.empty())
+  {
+    progress.open(progress_file, std::ios_base::out);
+    if(!progress)
+    {
+      std::cerr << "merge_gbwt: Cannot open progress file " << progress_file << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if(algorithm == ma_fast || algorithm == ma_compressed)
   {
     std::vector<GBWT> indexes(argc - optind);
     for(int i = optind; i < argc; i++)
@@ -130,7 +172,16 @@ main(int argc, char** argv)
       printStatistics(indexes[i - optind], input_name);
       total_inserted += indexes[i - optind].size();
     }
-    GBWT merged(indexes);
+    GBWT merged;
+    if(algorithm == ma_fast) { merged = GBWT(indexes); }
+    else
+    {
+      std::vector<const GBWT*> sources;
+      for(const GBWT& index : indexes) { sources.push_back(&index); }
+      if(progress.is_open()) { MergeProgress::start(progress, parameters, progress_interval); }
+      merged = mergeCompressed(sources, parameters);
+      MergeProgress::stop();
+    }
     if(!sdsl::store_to_file(merged, output + GBWT::EXTENSION))
     {
       std::cerr << "merge_gbwt: Cannot write the index to " << (output + GBWT::EXTENSION) << std::endl;
@@ -138,9 +189,18 @@ main(int argc, char** argv)
     }
     printStatistics(merged, output);
   }
+  else if(algorithm == ma_stream)
+  {
+    std::vector<std::string> input_names;
+    for(int i = optind; i < argc; i++) { input_names.push_back(std::string(argv[i]) + GBWT::EXTENSION); }
+    GBWTHeader header = mergeFiles(input_names, output + GBWT::EXTENSION);
+    printHeader("Merged index"); std::cout << header << std::endl;
+    total_inserted = header.size;
+  }
   else
   {
     DynamicGBWT index;
+    std::vector<DynamicGBWT> sources;
     {
       std::string input_name = argv[optind];
       if(!sdsl::load_from_file(index, input_name + DynamicGBWT::EXTENSION))
@@ -168,17 +228,26 @@ main(int argc, char** argv)
       }
       else if(algorithm == ma_parallel)
       {
-        DynamicGBWT next;
-        if(!sdsl::load_from_file(next, input_name + DynamicGBWT::EXTENSION))
+        sources.emplace_back();
+        if(!sdsl::load_from_file(sources.back(), input_name + DynamicGBWT::EXTENSION))
         {
           std::cerr << "merge_gbwt: Cannot load the index from " << (input_name + DynamicGBWT::EXTENSION) << std::endl;
           std::exit(EXIT_FAILURE);
         }
-        printStatistics(next, input_name);
-        index.merge(next, parameters);
-        total_inserted += next.size();
+        printStatistics(sources.back(), input_name);
+        total_inserted += sources.back().size();
       }
       optind++;
+      // Merge the loaded sources in a single pass, if we have enough of them.
+      if(algorithm == ma_parallel && (sources.size() == merge_inputs || optind >= argc))
+      {
+        std::vector<const DynamicGBWT*> source_ptrs;
+        for(const DynamicGBWT& source : sources) { source_ptrs.push_back(&source); }
+        if(progress.is_open()) { MergeProgress::start(progress, parameters, progress_interval); }
+        index.merge(source_ptrs, parameters);
+        MergeProgress::stop();
+        sources.clear();
+      }
     }
     if(!sdsl::store_to_file(index, output + DynamicGBWT::EXTENSION))
     {
@@ -211,6 +280,8 @@ printUsage(int exit_code)
   std::cerr << "  -o X  Use X as the base name for output (required)" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Algorithm choice:" << std::endl;
+  std::cerr << "  -c    Parallel algorithm for compressed indexes" << std::endl;
+  std::cerr << "  -d    Fast algorithm streaming the records from disk (node ids must not overlap)" << std::endl;
   std::cerr << "  -f    Fast algorithm (node ids must not overlap)" << std::endl;
   std::cerr << "  -i    Insertion algorithm (default)" << std::endl;
   std::cerr << "  -p    Parallel algorithm" << std::endl;
@@ -219,11 +290,15 @@ printUsage(int exit_code)
   std::cerr << "  -b N  Insert in batches of N sequences (default: " << DynamicGBWT::MERGE_BATCH_SIZE << ")" << std::endl;
   std::cerr << "  -s N  Sample sequence ids at one out of N positions (default: " << DynamicGBWT::SAMPLE_INTERVAL << "; use 0 for no samples)" << std::endl;
   std::cerr << std::endl;
-  std::cerr << "Parallel algorithm (-p):" << std::endl;
+  std::cerr << "Parallel algorithms (-c, -p):" << std::endl;
   std::cerr << "  -C N  Parallelize search in chunks of N sequences (default: " << MergeParameters::CHUNK_SIZE << ")" << std::endl;
   std::cerr << "  -J N  Run N parallel merge jobs (default: " << MergeParameters::MERGE_JOBS << ")" << std::endl;
+  std::cerr << "  -k N  Load and merge at most N inputs at a time with -p (default: all)" << std::endl;
+  std::cerr << "  -l N  Report progress every N seconds (default: " << MergeProgress::DEFAULT_INTERVAL << ")" << std::endl;
+  std::cerr << "  -L X  Write progress reports of the merge as JSON lines to file X" << std::endl;
   std::cerr << "  -M N  Use N merge buffers (default: " << MergeParameters::MERGE_BUFFERS << ")" << std::endl;
   std::cerr << "  -P N  Use N-megabyte position buffers (default: " << MergeParameters::POS_BUFFER_SIZE << ")" << std::endl;
+  std::cerr << "  -R N  Keep up to N megabytes of the rank array in memory (default: " << MergeParameters::RA_MEMORY << ")" << std::endl;
   std::cerr << "  -S N  Use N search threads (default: " << omp_get_max_threads() << ")" << std::endl;
   std::cerr << "  -t X  Use directory X for temporary files (default: " << TempFile::DEFAULT_TEMP_DIR << ")" << std::endl;
   std::cerr << "  -T N  Use N-megabyte thread buffers (default: " << MergeParameters::THREAD_BUFFER_SIZE << ")" << std::endl;
@@ -242,8 +317,12 @@ std::string algorithmName(MergingAlgorithm algorithm)
     return "insert";
   case ma_fast:
     return "fast";
+  case ma_stream:
+    return "stream";
   case ma_parallel:
     return "parallel";
+  case ma_compressed:
+    return "compressed";
   default:
     return "unknown";
   }
@@ -52,18 +52,218 @@ Metadata::Metadata() :
 {
 }
 
+// Merges the names from the sources that take part in merging them. With the same
+// samples / contigs, that is every source with names. Otherwise the names are merged
+// until the first source without them.
+Dictionary
+mergeNames(const std::vector<const Metadata*>& sources, bool same, std::vector<std::vector<size_type>>& mappings,
+           const std::function<const Dictionary*(const Metadata&)>& get_names)
+{
+  std::vector<const Dictionary*> names(sources.size(), nullptr);
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    names[i] = get_names(*(sources[i]));
+    if(names[i] == nullptr && !same) { break; }
+  }
+  return Dictionary(names, mappings);
+}
+
+// Number of distinct (sample, phase) pairs in the first n paths.
+size_type
+countHaplotypes(const std::vector<PathName>& paths, size_type n)
+{
+  std::vector<std::pair<size_type, size_type>> haplotypes(n);
+  for(size_type i = 0; i < n; i++) { haplotypes[i] = std::make_pair(paths[i].sample, paths[i].phase); }
+  parallelQuickSort(haplotypes.begin(), haplotypes.end());
+  return std::unique(haplotypes.begin(), haplotypes.end()) - haplotypes.begin();
+}
+
+// Updates the number of keys in the merged dictionary with the ids of the source keys.
+// A source key was added to the dictionary if it was mapped to an id not used by the
+// earlier sources.
+void
+updateKeys(size_type& keys, const std::vector<size_type>& mapping)
+{
+  size_type added = 0;
+  for(size_type id : mapping) { if(id >= keys) { added++; } }
+  keys += added;
+}
+
 Metadata::Metadata(std::vector<const Metadata*> sources, bool same_samples, bool same_contigs)  :
   tag(TAG), version(VERSION),
   sample_count(0), haplotype_count(0), contig_count(0),
   flags(0)
 {
   if(sources.empty()) { return; }
+  if(sources.size() == 1)
+  {
+    *this = *(sources.front());
+    return;
+  }
+
+  // Build the merged dictionaries.
+  std::vector<std::vector<size_type>> sample_maps, contig_maps;
+  Dictionary merged_samples = mergeNames(sources, same_samples, sample_maps, [](const Metadata& source) -> const Dictionary*
+  {
+    return (source.hasSampleNames() ? &(source.sample_names) : nullptr);
+  });
+  Dictionary merged_contigs = mergeNames(sources, same_contigs, contig_maps, [](const Metadata& source) -> const Dictionary*
+  {
+    return (source.hasContigNames() ? &(source.contig_names) : nullptr);
+  });
+
+  // Start from the first source.
+  const Metadata& first = *(sources.front());
+  this->tag = first.tag;
+  this->version = first.version;
+  this->sample_count = first.sample_count;
+  this->haplotype_count = first.haplotype_count;
+  this->contig_count = first.contig_count;
+  this->flags = first.flags;
+  if(this->hasPathNames())
+  {
+    size_type total_paths = 0;
+    for(const Metadata* source : sources) { total_paths += source->paths(); }
+    this->path_names.reserve(total_paths);
+    this->path_names.insert(this->path_names.end(), first.path_names.begin(), first.path_names.end());
+  }
+  size_type sample_keys = 0, contig_keys = 0;
+  updateKeys(sample_keys, sample_maps.front());
+  updateKeys(contig_keys, contig_maps.front());
+
+  // The haplotype count is determined from this many paths before it is used the next time.
+  size_type haplotype_paths = 0;
 
-  *this = *(sources.front());
   for(size_type i = 1; i < sources.size(); i++)
   {
-    this->merge(*(sources[i]), same_samples, same_contigs);
+    const Metadata& source = *(sources[i]);
+    size_type source_sample_offset = 0, source_contig_offset = 0;
+    bool merge_sample_names = (this->hasSampleNames() & source.hasSampleNames());
+    bool merge_contig_names = (this->hasContigNames() & source.hasContigNames());
+    bool merge_path_names = (this->hasPathNames() & source.hasPathNames());
+    if(haplotype_paths > 0 && !(merge_sample_names & merge_path_names))
+    {
+      this->haplotype_count = countHaplotypes(this->path_names, haplotype_paths);
+      haplotype_paths = 0;
+    }
+
+    // Merge samples and haplotypes.
+    if(merge_sample_names)
+    {
+      updateKeys(sample_keys, sample_maps[i]);
+      if(!merge_path_names)
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Estimating new haplotype count" << std::endl;
+        }
+        double added_samples = sample_keys - this->sample_count;
+        this->haplotype_count += (added_samples * source.haplotypes()) / source.samples();
+      }
+      this->sample_count = sample_keys;
+    }
+    else if(same_samples)
+    {
+      if(this->samples() != source.samples() || this->haplotypes() != source.haplotypes())
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Sample/haplotype counts do not match" << std::endl;
+        }
+      }
+      if(!(this->hasSampleNames()) && source.hasSampleNames())
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Taking sample names from the source" << std::endl;
+        }
+        updateKeys(sample_keys, sample_maps[i]);
+        this->set(FLAG_SAMPLE_NAMES);
+      }
+    }
+    else
+    {
+      source_sample_offset = this->samples();
+      this->sample_count += source.samples();
+      this->haplotype_count += source.haplotypes();
+      if(this->hasSampleNames())
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Clearing sample names; the source has no sample names" << std::endl;
+        }
+        this->unset(FLAG_SAMPLE_NAMES);
+      }
+    }
+
+    // Merge contigs.
+    if(merge_contig_names)
+    {
+      updateKeys(contig_keys, contig_maps[i]);
+      this->contig_count = contig_keys;
+    }
+    else if(same_contigs)
+    {
+      if(this->contigs() != source.contigs() && Verbosity::level >= Verbosity::FULL)
+      {
+        std::cerr << "Metadata::merge(): Warning: Contig counts do not match" << std::endl;
+      }
+      if(!(this->hasContigNames()) && source.hasContigNames())
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Taking contig names from the source" << std::endl;
+        }
+        updateKeys(contig_keys, contig_maps[i]);
+        this->set(FLAG_CONTIG_NAMES);
+      }
+    }
+    else
+    {
+      source_contig_offset = this->contigs();
+      this->contig_count += source.contigs();
+      if(this->hasContigNames())
+      {
+        if(Verbosity::level >= Verbosity::FULL)
+        {
+          std::cerr << "Metadata::merge(): Warning: Clearing contig names; the source has no contig names" << std::endl;
+        }
+        this->unset(FLAG_CONTIG_NAMES);
+      }
+    }
+
+    // Merge paths.
+    if(merge_path_names)
+    {
+      size_type source_path_offset = this->paths();
+      this->path_names.insert(this->path_names.end(), source.path_names.begin(), source.path_names.end());
+      const std::vector<size_type>& sample_map = sample_maps[i];
+      const std::vector<size_type>& contig_map = contig_maps[i];
+      #pragma omp parallel for schedule(static)
+      for(size_type j = source_path_offset; j < this->paths(); j++)
+      {
+        PathName& path = this->path_names[j];
+        if(merge_sample_names) { path.sample = sample_map[path.sample]; }
+        else { path.sample += source_sample_offset; }
+        if(merge_contig_names) { path.contig = contig_map[path.contig]; }
+        else { path.contig += source_contig_offset; }
+      }
+      if(merge_sample_names) { haplotype_paths = this->paths(); }
+    }
+    else if(this->hasPathNames())
+    {
+      if(Verbosity::level >= Verbosity::FULL)
+      {
+        std::cerr << "Metadata::merge(): Warning: Clearing path names; the source has no path names" << std::endl;
+      }
+      this->clearPathNames();
+    }
   }
+
+  // Determine the final haplotype count and set the names.
+  if(haplotype_paths > 0) { this->haplotype_count = countHaplotypes(this->path_names, haplotype_paths); }
+  if(this->hasSampleNames()) { this->sample_names = std::move(merged_samples); }
+  if(this->hasContigNames()) { this->contig_names = std::move(merged_contigs); }
 }
 
 size_type
@@ -425,138 +625,71 @@ Metadata::removeContig(size_type contig_id)
   return result;
 }
 
-//------------------------------------------------------------------------------
-
 void
-Metadata::merge(const Metadata& source, bool same_samples, bool same_contigs)
+Metadata::subset(const std::vector<size_type>& path_ids)
 {
-  size_type source_sample_offset = 0, source_contig_offset = 0;
-  bool merge_sample_names = (this->hasSampleNames() & source.hasSampleNames());
-  bool merge_contig_names = (this->hasContigNames() & source.hasContigNames());
-  bool merge_path_names = (this->hasPathNames() & source.hasPathNames());
-
-  // Merge samples and haplotypes.
-  if(merge_sample_names)
+  if(!(this->hasPathNames()))
   {
-    this->sample_names = Dictionary(this->sample_names, source.sample_names);
-    if(!merge_path_names)
-    {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Estimating new haplotype count" << std::endl;
-      }
-      double added_samples = this->sample_names.size() - this->sample_count;
-      this->haplotype_count += (added_samples * source.haplotypes()) / source.samples();
-    }
-    this->sample_count = this->sample_names.size();
-  }
-  else if(same_samples)
-  {
-    if(this->samples() != source.samples() || this->haplotypes() != source.haplotypes())
+    if(Verbosity::level >= Verbosity::FULL)
     {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Sample/haplotype counts do not match" << std::endl;
-      }
-    }
-    if(!(this->hasSampleNames()) && source.hasSampleNames())
-    {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Taking sample names from the source" << std::endl;
-      }
-      this->sample_names = source.sample_names;
-      this->set(FLAG_SAMPLE_NAMES);
+      std::cerr << "Metadata::subset(): Warning: Cannot update the header without path names" << std::endl;
     }
+    return;
   }
-  else
+
+  // Select the paths and determine the remaining samples, haplotypes, and contigs.
+  std::vector<PathName> selected;
+  std::set<size_type> samples, contigs;
+  std::set<std::pair<size_type, size_type>> phases;
+  for(size_type path_id : path_ids)
   {
-    source_sample_offset = this->samples();
-    this->sample_count += source.samples();
-    this->haplotype_count += source.haplotypes();
-    if(this->hasSampleNames())
-    {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Clearing sample names; the source has no sample names" << std::endl;
-      }
-      this->clearSampleNames();
-    }
+    if(path_id >= this->paths()) { continue; }
+    const PathName& path = this->path(path_id);
+    selected.push_back(path);
+    samples.insert(path.sample);
+    contigs.insert(path.contig);
+    phases.insert(std::make_pair(path.sample, path.phase));
   }
 
-  // Merge contigs.
-  if(merge_contig_names)
+  // Renumber the samples and contigs.
+  std::vector<size_type> sample_map(this->samples(), 0), contig_map(this->contigs(), 0);
+  std::vector<std::string> sample_names, contig_names;
+  for(size_type sample_id : samples)
   {
-    this->contig_names = Dictionary(this->contig_names, source.contig_names);
-    this->contig_count = this->contig_names.size();
+    if(sample_id >= this->samples()) { continue; }
+    sample_map[sample_id] = sample_names.size();
+    sample_names.push_back(this->sample(sample_id));
   }
-  else if(same_contigs)
+  for(size_type contig_id : contigs)
   {
-    if(this->contigs() != source.contigs() && Verbosity::level >= Verbosity::FULL)
-    {
-      std::cerr << "Metadata::merge(): Warning: Contig counts do not match" << std::endl;
-    }
-    if(!(this->hasContigNames()) && source.hasContigNames())
-    {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Taking contig names from the source" << std::endl;
-      }
-      this->contig_names = source.contig_names;
-      this->set(FLAG_CONTIG_NAMES);
-    }
+    if(contig_id >= this->contigs()) { continue; }
+    contig_map[contig_id] = contig_names.size();
+    contig_names.push_back(this->contig(contig_id));
   }
-  else
+  for(PathName& path : selected)
   {
-    source_contig_offset = this->contigs();
-    this->contig_count += source.contigs();
-    if(this->hasContigNames())
-    {
-      if(Verbosity::level >= Verbosity::FULL)
-      {
-        std::cerr << "Metadata::merge(): Warning: Clearing contig names; the source has no contig names" << std::endl;
-      }
-      this->clearContigNames();
-    }
+    if(path.sample < sample_map.size()) { path.sample = sample_map[path.sample]; }
+    if(path.contig < contig_map.size()) { path.contig = contig_map[path.contig]; }
   }
 
-  // Merge paths.
-  if(merge_path_names)
-  {
-    size_type source_path_offset = this->paths();
-    this->path_names.insert(this->path_names.end(), source.path_names.begin(), source.path_names.end());
-    for(size_type i = source_path_offset; i < this->path_names.size(); i++)
-    {
-      if(merge_sample_names)
-      {
-        this->path_names[i].sample = this->sample(source.sample(this->path_names[i].sample));
-      }
-      else { this->path_names[i].sample += source_sample_offset; }
-      if(merge_contig_names)
-      {
-        this->path_names[i].contig = this->contig(source.contig(this->path_names[i].contig));
-      }
-      else { this->path_names[i].contig += source_contig_offset; }
-    }
-    // Determine the new haplotype count.
-    if(merge_sample_names)
-    {
-      std::set<std::pair<size_type, size_type>> found_haplotypes;
-      for(const PathName& path : this->path_names)
-      {
-        found_haplotypes.emplace(path.sample, path.phase);
-      }
-      this->haplotype_count = found_haplotypes.size();
-    }
-  }
-  else if(this->hasPathNames())
-  {
-    if(Verbosity::level >= Verbosity::FULL)
-    {
-      std::cerr << "Metadata::merge(): Warning: Clearing path names; the source has no path names" << std::endl;
-    }
-    this->clearPathNames();
-  }
+  // Update the metadata.
+  this->path_names.swap(selected);
+  if(this->path_names.empty()) { this->clearPathNames(); }
+  if(this->hasSampleNames()) { this->sample_names = Dictionary(sample_names); }
+  this->sample_count = sample_names.size();
+  this->haplotype_count = phases.size();
+  if(this->hasContigNames()) { this->contig_names = Dictionary(contig_names); }
+  this->contig_count = contig_names.size();
+}
+
+//------------------------------------------------------------------------------
+
+void
+Metadata::merge(const Metadata& source, bool same_samples, bool same_contigs)
+{
+  std::vector<const Metadata*> sources { this, &source };
+  Metadata merged(sources, same_samples, same_contigs);
+  this->swap(merged);
 }
 
 void
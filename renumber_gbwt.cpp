@@ -0,0 +1,148 @@
+/*
+  Copyright (c) 2019 Jouni Siren
+
+  Author: Jouni Siren <jouni.siren@iki.fi>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string>
+#include <unistd.h>
+
+#include <gbwt/dynamic_gbwt.h>
+
+using namespace gbwt;
+
+//------------------------------------------------------------------------------
+
+const std::string tool_name = "GBWT node renumbering";
+const std::string TRANSLATION_EXTENSION = ".trans";
+
+void printUsage(int exit_code = EXIT_SUCCESS);
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char** argv)
+{
+  if(argc < 2) { printUsage(); }
+
+  // Parse command line options.
+  int c = 0;
+  std::string output;
+  size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE / MILLION;
+  while((c = getopt(argc, argv, "b:o:")) != -1)
+  {
+    switch(c)
+    {
+    case 'b':
+      batch_size = std::stoul(optarg); break;
+    case 'o':
+      output = optarg; break;
+    case '?':
+      std::exit(EXIT_FAILURE);
+    default:
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  // Check command line options.
+  if(optind >= argc) { printUsage(EXIT_FAILURE); }
+  std::string base_name = argv[optind];
+  if(output.empty())
+  {
+    std::cerr << "renumber_gbwt: Output name must be specified with option -o" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Initial output.
+  Version::print(std::cout, tool_name);
+  printHeader("Input"); std::cout << base_name << std::endl;
+  printHeader("Output"); std::cout << output << std::endl;
+  printHeader("Batch size"); std::cout << batch_size << " million" << std::endl;
+  std::cout << std::endl;
+
+  double start = readTimer();
+
+  // Load index.
+  GBWT index;
+  if(!sdsl::load_from_file(index, base_name + GBWT::EXTENSION))
+  {
+    std::cerr << "renumber_gbwt: Cannot load the index from " << (base_name + GBWT::EXTENSION) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  printStatistics(index, base_name);
+
+  // Determine the new order and write the translation table.
+  std::vector<size_type> translation = bfsOrder(index);
+  {
+    std::string filename = output + TRANSLATION_EXTENSION;
+    std::ofstream out(filename, std::ios_base::binary);
+    if(!out)
+    {
+      std::cerr << "renumber_gbwt: Cannot open translation file " << filename << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    size_type first_id = (index.effective() > 1 ? Node::id(index.toNode(1)) : translation.size());
+    for(size_type id = first_id; id < translation.size(); id++)
+    {
+      out << id << "\t" << translation[id] << "\n";
+    }
+    out.close();
+  }
+
+  // Rebuild the index.
+  GBWT result = renumber(index, translation, batch_size * MILLION);
+  if(!sdsl::store_to_file(result, output + GBWT::EXTENSION))
+  {
+    std::cerr << "renumber_gbwt: Cannot write the index to " << (output + GBWT::EXTENSION) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  printStatistics(result, output);
+
+  double seconds = readTimer() - start;
+
+  std::cout << "Indexed " << result.size() << " nodes in " << seconds << " seconds ("
+            << (result.size() / seconds) << " nodes/second)" << std::endl;
+  std::cout << "Memory usage " << inGigabytes(memoryUsage()) << " GB" << std::endl;
+  std::cout << std::endl;
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+printUsage(int exit_code)
+{
+  Version::print(std::cerr, tool_name);
+
+  std::cerr << "Usage: renumber_gbwt [options] -o output base_name" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "  -b N  Insert in batches of N million nodes (default: " << (DynamicGBWT::INSERT_BATCH_SIZE / MILLION) << ")" << std::endl;
+  std::cerr << "  -o X  Use X as the base name for output (required)" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Renumbers the nodes in BFS order and rebuilds the GBWT. The translation from" << std::endl;
+  std::cerr << "original node ids to new node ids is written to output" << TRANSLATION_EXTENSION << "." << std::endl;
+  std::cerr << std::endl;
+
+  std::exit(exit_code);
+}
+
+//------------------------------------------------------------------------------
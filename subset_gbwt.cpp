@@ -0,0 +1,233 @@
+/*
+  Copyright (c) 2019 Jouni Siren
+
+  Author: Jouni Siren <jouni.siren@iki.fi>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string>
+#include <unistd.h>
+
+#include <gbwt/dynamic_gbwt.h>
+
+using namespace gbwt;
+
+//------------------------------------------------------------------------------
+
+const std::string tool_name = "GBWT subset";
+
+void printUsage(int exit_code = EXIT_SUCCESS);
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char** argv)
+{
+  if(argc < 3) { printUsage(); }
+
+  // Parse command line options.
+  int c = 0;
+  std::string output;
+  size_type batch_size = DynamicGBWT::INSERT_BATCH_SIZE / MILLION;
+  bool range = false, sample = false, contig = false;
+  while((c = getopt(argc, argv, "b:o:rSC")) != -1)
+  {
+    switch(c)
+    {
+    case 'b':
+      batch_size = std::stoul(optarg); break;
+    case 'o':
+      output = optarg; break;
+    case 'r':
+      range = true; break;
+    case 'S':
+      sample = true; break;
+    case 'C':
+      contig = true; break;
+    case '?':
+      std::exit(EXIT_FAILURE);
+    default:
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  // Check command line options.
+  if(optind + 1 >= argc) { printUsage(EXIT_FAILURE); }
+  if((range & sample) || (range & contig) || (sample & contig))
+  {
+    std::cerr << "subset_gbwt: Options -r, -S, and -C are mutually exclusive" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  std::string base_name = argv[optind]; optind++;
+  if(output.empty())
+  {
+    std::cerr << "subset_gbwt: Output name must be specified with option -o" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  std::vector<size_type> path_ids;
+  std::vector<std::string> keys;
+  if(range)
+  {
+    if(argc != optind + 2) { printUsage(EXIT_FAILURE); }
+    size_type start = std::stoul(argv[optind]); optind++;
+    size_type stop = std::stoul(argv[optind]); optind++;
+    if(stop < start) { printUsage(EXIT_FAILURE); }
+    for(size_type path_id = start; path_id <= stop; path_id++)
+    {
+      path_ids.push_back(path_id);
+    }
+  }
+  else if(sample || contig)
+  {
+    while(optind < argc)
+    {
+      keys.push_back(argv[optind]);
+      optind++;
+    }
+  }
+  else
+  {
+    while(optind < argc)
+    {
+      path_ids.push_back(std::stoul(argv[optind]));
+      optind++;
+    }
+  }
+
+  // Initial output.
+  Version::print(std::cout, tool_name);
+  printHeader("Input"); std::cout << base_name << std::endl;
+  printHeader("Output"); std::cout << output << std::endl;
+  if(range)
+  {
+    printHeader("Range"); std::cout << range_type(path_ids.front(), path_ids.back()) << std::endl;
+  }
+  else if(sample)
+  {
+    printHeader("Samples"); std::cout << keys.size() << std::endl;
+  }
+  else if(contig)
+  {
+    printHeader("Contigs"); std::cout << keys.size() << std::endl;
+  }
+  else
+  {
+    printHeader("Paths"); std::cout << path_ids.size() << std::endl;
+  }
+  printHeader("Batch size"); std::cout << batch_size << " million" << std::endl;
+  std::cout << std::endl;
+
+  double start = readTimer();
+
+  // Load index.
+  GBWT index;
+  if(!sdsl::load_from_file(index, base_name + GBWT::EXTENSION))
+  {
+    std::cerr << "subset_gbwt: Cannot load the index from " << (base_name + GBWT::EXTENSION) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  printStatistics(index, base_name);
+
+  // Determine the paths.
+  if(sample)
+  {
+    if(!(index.hasMetadata()) || !(index.metadata.hasSampleNames()) || !(index.metadata.hasPathNames()))
+    {
+      std::cerr << "subset_gbwt: Option -S requires sample and path names" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    for(const std::string& key : keys)
+    {
+      size_type sample_id = index.metadata.sample(key);
+      std::vector<size_type> paths = index.metadata.pathsForSample(sample_id);
+      if(paths.empty())
+      {
+        std::cerr << "subset_gbwt: No paths for sample " << key << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      path_ids.insert(path_ids.end(), paths.begin(), paths.end());
+    }
+  }
+  else if(contig)
+  {
+    if(!(index.hasMetadata()) || !(index.metadata.hasContigNames()) || !(index.metadata.hasPathNames()))
+    {
+      std::cerr << "subset_gbwt: Option -C requires contig and path names" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    for(const std::string& key : keys)
+    {
+      size_type contig_id = index.metadata.contig(key);
+      std::vector<size_type> paths = index.metadata.pathsForContig(contig_id);
+      if(paths.empty())
+      {
+        std::cerr << "subset_gbwt: No paths for contig " << key << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      path_ids.insert(path_ids.end(), paths.begin(), paths.end());
+    }
+  }
+
+  // Build the subset.
+  GBWT result = subset(index, path_ids, batch_size * MILLION);
+  if(result.empty())
+  {
+    std::cerr << "subset_gbwt: Could not build the subset" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if(!sdsl::store_to_file(result, output + GBWT::EXTENSION))
+  {
+    std::cerr << "subset_gbwt: Cannot write the index to " << (output + GBWT::EXTENSION) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  printStatistics(result, output);
+
+  double seconds = readTimer() - start;
+
+  std::cout << "Indexed " << result.size() << " nodes in " << seconds << " seconds ("
+            << (result.size() / seconds) << " nodes/second)" << std::endl;
+  std::cout << "Memory usage " << inGigabytes(memoryUsage()) << " GB" << std::endl;
+  std::cout << std::endl;
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+printUsage(int exit_code)
+{
+  Version::print(std::cerr, tool_name);
+
+  std::cerr << "Usage: subset_gbwt [options] -o output base_name path1 [path2 ...]" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "  -b N  Insert in batches of N million nodes (default: " << (DynamicGBWT::INSERT_BATCH_SIZE / MILLION) << ")" << std::endl;
+  std::cerr << "  -o X  Use X as the base name for output (required)" << std::endl;
+  std::cerr << "  -r    Select a range of paths (inclusive; requires 2 path ids)" << std::endl;
+  std::cerr << "  -S    Select all paths for the samples with names path1, path2, ..." << std::endl;
+  std::cerr << "  -C    Select all paths for the contigs with names path1, path2, ..." << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Builds a new GBWT containing the selected paths from the input GBWT." << std::endl;
+  std::cerr << std::endl;
+
+  std::exit(exit_code);
+}
+
+//------------------------------------------------------------------------------
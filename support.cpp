@@ -25,6 +25,9 @@
 
 #include <gbwt/internal.h>
 
+#include <atomic>
+#include <mutex>
+
 namespace gbwt
 {
 
@@ -43,6 +46,7 @@ constexpr size_type MergeParameters::THREAD_BUFFER_SIZE;
 constexpr size_type MergeParameters::MERGE_BUFFERS;
 constexpr size_type MergeParameters::CHUNK_SIZE;
 constexpr size_type MergeParameters::MERGE_JOBS;
+constexpr size_type MergeParameters::RA_MEMORY;
 constexpr size_type MergeParameters::MAX_BUFFER_SIZE;
 constexpr size_type MergeParameters::MAX_MERGE_BUFFERS;
 constexpr size_type MergeParameters::MAX_MERGE_JOBS;
@@ -70,6 +74,204 @@ reversePath(const vector_type& path, text_type& output, size_type& tail)
 
 //------------------------------------------------------------------------------
 
+constexpr size_type RecordPool::MIN_CLASS_BITS;
+constexpr size_type RecordPool::MAX_CLASS_BITS;
+constexpr size_type RecordPool::CLASSES;
+constexpr size_type RecordPool::MAX_POOLED_BYTES;
+constexpr size_type RecordPool::SLAB_SIZE;
+constexpr size_type RecordPool::TRANSFER_SIZE;
+
+// Intrusive list of free blocks.
+struct FreeList
+{
+  void*     head;
+  size_type size;
+
+  FreeList() : head(nullptr), size(0) {}
+
+  void push(void* block)
+  {
+    *static_cast<void**>(block) = this->head;
+    this->head = block; this->size++;
+  }
+
+  void* pop()
+  {
+    void* block = this->head;
+    this->head = *static_cast<void**>(block); this->size--;
+    return block;
+  }
+
+  // Move up to n blocks to the other list.
+  void transfer(FreeList& another, size_type n)
+  {
+    while(n > 0 && this->size > 0) { another.push(this->pop()); n--; }
+  }
+};
+
+struct PoolDepot
+{
+  std::mutex             mtx;
+  FreeList               lists[RecordPool::CLASSES];
+  std::vector<char*>     slabs;
+  size_type              reserved;
+  std::atomic<size_type> generation; // Incremented when the slabs are released.
+
+  PoolDepot() : reserved(0), generation(0) {}
+
+  // Refill the list for the given class. Assumes that the mutex is held.
+  void refill(FreeList& list, size_type size_class)
+  {
+    FreeList& source = this->lists[size_class];
+    if(source.size == 0)
+    {
+      size_type block_size = static_cast<size_type>(1) << (size_class + RecordPool::MIN_CLASS_BITS);
+      char* slab = static_cast<char*>(::operator new(RecordPool::SLAB_SIZE));
+      this->slabs.push_back(slab);
+      this->reserved += RecordPool::SLAB_SIZE;
+      for(size_type offset = 0; offset + block_size <= RecordPool::SLAB_SIZE; offset += block_size)
+      {
+        source.push(slab + offset);
+      }
+    }
+    source.transfer(list, RecordPool::TRANSFER_SIZE);
+  }
+
+  // Release the slabs. Assumes that the mutex is held.
+  size_type release()
+  {
+    for(char* slab : this->slabs) { ::operator delete(slab); }
+    this->slabs = std::vector<char*>();
+    for(size_type i = 0; i < RecordPool::CLASSES; i++) { this->lists[i] = FreeList(); }
+    size_type result = this->reserved;
+    this->reserved = 0;
+    this->generation++;
+    return result;
+  }
+};
+
+// The depot is never destroyed, because records may be freed during static destruction.
+PoolDepot&
+poolDepot()
+{
+  static PoolDepot* depot = new PoolDepot();
+  return *depot;
+}
+
+struct LocalPool
+{
+  FreeList  lists[RecordPool::CLASSES];
+  size_type generation;
+
+  LocalPool() : generation(0) {}
+  ~LocalPool();
+
+  // Discard the free lists if the slabs have been released since the last use.
+  FreeList& list(size_type size_class)
+  {
+    size_type current = poolDepot().generation.load(std::memory_order_relaxed);
+    if(this->generation != current)
+    {
+      for(size_type i = 0; i < RecordPool::CLASSES; i++) { this->lists[i] = FreeList(); }
+      this->generation = current;
+    }
+    return this->lists[size_class];
+  }
+};
+
+thread_local LocalPool local_pool;
+thread_local bool      local_pool_destroyed = false;
+
+LocalPool::~LocalPool()
+{
+  PoolDepot& depot = poolDepot();
+  std::lock_guard<std::mutex> lock(depot.mtx);
+  if(this->generation == depot.generation)
+  {
+    for(size_type i = 0; i < RecordPool::CLASSES; i++)
+    {
+      this->lists[i].transfer(depot.lists[i], this->lists[i].size);
+    }
+  }
+  local_pool_destroyed = true;
+}
+
+size_type
+sizeClass(size_type bytes)
+{
+  size_type bits = (bytes <= 1 ? 0 : bit_length(bytes - 1));
+  return (bits <= RecordPool::MIN_CLASS_BITS ? 0 : bits - RecordPool::MIN_CLASS_BITS);
+}
+
+void*
+RecordPool::allocate(size_type bytes)
+{
+  if(bytes > MAX_POOLED_BYTES) { return ::operator new(bytes); }
+
+  size_type size_class = sizeClass(bytes);
+  if(local_pool_destroyed)
+  {
+    PoolDepot& depot = poolDepot();
+    std::lock_guard<std::mutex> lock(depot.mtx);
+    FreeList temp;
+    depot.refill(temp, size_class);
+    void* block = temp.pop();
+    temp.transfer(depot.lists[size_class], temp.size);
+    return block;
+  }
+
+  FreeList& list = local_pool.list(size_class);
+  if(list.size == 0)
+  {
+    PoolDepot& depot = poolDepot();
+    std::lock_guard<std::mutex> lock(depot.mtx);
+    depot.refill(list, size_class);
+  }
+  return list.pop();
+}
+
+void
+RecordPool::deallocate(void* ptr, size_type bytes)
+{
+  if(bytes > MAX_POOLED_BYTES) { ::operator delete(ptr); return; }
+
+  size_type size_class = sizeClass(bytes);
+  if(local_pool_destroyed)
+  {
+    PoolDepot& depot = poolDepot();
+    std::lock_guard<std::mutex> lock(depot.mtx);
+    depot.lists[size_class].push(ptr);
+    return;
+  }
+
+  FreeList& list = local_pool.list(size_class);
+  list.push(ptr);
+  if(list.size >= 2 * TRANSFER_SIZE)
+  {
+    PoolDepot& depot = poolDepot();
+    std::lock_guard<std::mutex> lock(depot.mtx);
+    list.transfer(depot.lists[size_class], TRANSFER_SIZE);
+  }
+}
+
+size_type
+RecordPool::reservedBytes()
+{
+  PoolDepot& depot = poolDepot();
+  std::lock_guard<std::mutex> lock(depot.mtx);
+  return depot.reserved;
+}
+
+size_type
+RecordPool::release()
+{
+  PoolDepot& depot = poolDepot();
+  std::lock_guard<std::mutex> lock(depot.mtx);
+  return depot.release();
+}
+
+//------------------------------------------------------------------------------
+
 rank_type
 edgeTo(node_type to, const std::vector<edge_type>& outgoing)
 {
@@ -182,7 +384,7 @@ DynamicRecord::LF(size_type i) const
 }
 
 template<class Array>
-edge_type LFLoop(Array& result, const std::vector<edge_type>& body, size_type i, size_type& run_end)
+edge_type LFLoop(Array& result, const record_vector<run_type>& body, size_type i, size_type& run_end)
 {
   rank_type last_edge = 0;
   size_type offset = 0;
@@ -219,7 +421,7 @@ DynamicRecord::runLF(size_type i, size_type& run_end) const
 
 // run is *(--iter); offset and result are for the beginning of the run at iter.
 size_type
-LFLoop(std::vector<run_type>::const_iterator& iter, std::vector<run_type>::const_iterator end,
+LFLoop(record_vector<run_type>::const_iterator& iter, record_vector<run_type>::const_iterator end,
        size_type i, rank_type outrank, run_type& run, size_type& offset, size_type& result)
 {
   while(iter != end && offset < i)
@@ -237,7 +439,7 @@ DynamicRecord::LF(size_type i, node_type to) const
   rank_type outrank = this->edgeTo(to);
   if(outrank >= this->outdegree()) { return invalid_offset(); }
 
-  std::vector<run_type>::const_iterator iter = this->body.begin();
+  record_vector<run_type>::const_iterator iter = this->body.begin();
   run_type run(0, 0);
   size_type offset = 0, result = this->offset(outrank);
 
@@ -252,7 +454,7 @@ DynamicRecord::LF(range_type range, node_type to) const
   rank_type outrank = this->edgeTo(to);
   if(outrank >= this->outdegree()) { return Range::empty_range(); }
 
-  std::vector<run_type>::const_iterator iter = this->body.begin();
+  record_vector<run_type>::const_iterator iter = this->body.begin();
   run_type run(0, 0);
   size_type offset = 0, result = this->offset(outrank);
 
@@ -271,7 +473,7 @@ DynamicRecord::bdLF(range_type range, node_type to, size_type& reverse_offset) c
   if(outrank >= this->outdegree()) { return Range::empty_range(); }
 
   // sp = LF(range.first, to)
-  std::vector<run_type>::const_iterator iter = this->body.begin();
+  record_vector<run_type>::const_iterator iter = this->body.begin();
   run_type run(0, 0);
   size_type offset = 0, result = this->offset(outrank);
   size_type sp = LFLoop(iter, this->body.end(), range.first, outrank, run, offset, result);
@@ -376,13 +578,13 @@ DynamicRecord::countUntil(node_type from) const
 }
 
 void
-DynamicRecord::increment(node_type from)
+DynamicRecord::increment(node_type from, size_type n)
 {
   for(rank_type inrank = 0; inrank < this->indegree(); inrank++)
   {
-    if(this->predecessor(inrank) == from) { this->count(inrank)++; return; }
+    if(this->predecessor(inrank) == from) { this->count(inrank) += n; return; }
   }
-  this->addIncoming(edge_type(from, 1));
+  this->addIncoming(edge_type(from, n));
 }
 
 void
@@ -394,10 +596,10 @@ DynamicRecord::addIncoming(edge_type inedge)
 
 //------------------------------------------------------------------------------
 
-std::vector<sample_type>::const_iterator
+record_vector<sample_type>::const_iterator
 DynamicRecord::nextSample(size_type i) const
 {
-  std::vector<sample_type>::const_iterator curr = this->ids.begin();
+  record_vector<sample_type>::const_iterator curr = this->ids.begin();
   while(curr != this->ids.end() && curr->first < i) { ++curr; }
   return curr;
 }
@@ -757,53 +959,88 @@ RecordArray::RecordArray(const std::vector<DynamicRecord>& bwt) :
   this->buildIndex(offsets);
 }
 
+RecordArray::RecordArray(std::vector<DynamicRecord>&& bwt) :
+  records(bwt.size())
+{
+  if(bwt.empty()) { this->buildIndex(std::vector<size_type>()); return; }
+
+  // Compress the chunks in parallel. Offsets are relative to the start of the chunk.
+  std::vector<range_type> chunks = Range::partition(range_type(0, bwt.size() - 1), 4 * omp_get_max_threads());
+  std::vector<std::vector<byte_type>> chunk_data(chunks.size());
+  std::vector<size_type> offsets(bwt.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type chunk = 0; chunk < chunks.size(); chunk++)
+  {
+    for(size_type i = chunks[chunk].first; i <= chunks[chunk].second; i++)
+    {
+      offsets[i] = chunk_data[chunk].size();
+      bwt[i].writeBWT(chunk_data[chunk]);
+      bwt[i] = DynamicRecord();
+    }
+  }
+  bwt = std::vector<DynamicRecord>();
+
+  // Concatenate the chunks and release them.
+  size_type data_size = 0;
+  for(const std::vector<byte_type>& data : chunk_data) { data_size += data.size(); }
+  this->data.reserve(data_size);
+  for(size_type chunk = 0; chunk < chunks.size(); chunk++)
+  {
+    for(size_type i = chunks[chunk].first; i <= chunks[chunk].second; i++) { offsets[i] += this->data.size(); }
+    this->data.insert(this->data.end(), chunk_data[chunk].begin(), chunk_data[chunk].end());
+    chunk_data[chunk] = std::vector<byte_type>();
+  }
+
+  this->buildIndex(offsets);
+}
+
 RecordArray::RecordArray(const std::vector<RecordArray const*> sources, const sdsl::int_vector<0>& origins, const std::vector<size_type>& record_offsets) :
   records(origins.size())
 {
-  size_type data_size = 0;
-  for(auto source : sources) { data_size += source->data.size(); }
+  mergeEndmarkers(sources, this->data);
 
-  // Merge the endmarkers.
-  std::vector<size_type> limits(sources.size(), 0); // Pointers to the end of the current records.
+  // Determine the size of each record and the total size of each block of records.
+  std::vector<size_type> offsets(origins.size(), 0);
+  std::vector<range_type> blocks = Range::partition(range_type(1, origins.size() - 1), 4 * omp_get_max_threads());
+  std::vector<size_type> block_offsets(blocks.size() + 1, 0);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    DynamicRecord merged;
-    for(size_type i = 0; i < sources.size(); i++)
+    size_type block_size = 0;
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
     {
-      if(sources[i]->empty()) { continue; }
-      size_type start = sources[i]->start(ENDMARKER), limit = sources[i]->limit(ENDMARKER);
-      CompressedRecord record(sources[i]->data, start, limit);
-      for(CompressedRecordIterator iter(record); !(iter.end()); ++iter)
-      {
-        run_type run = *iter; run.first += merged.outdegree();
-        merged.body.push_back(run); merged.body_size += run.second;
-      }
-      for(edge_type outedge : record.outgoing)
+      size_type origin = origins[comp];
+      if(origin >= sources.size()) { offsets[comp] = 1; } // Empty record, outdegree 0.
+      else
       {
-        merged.outgoing.push_back(outedge);
+        size_type source_comp = comp - record_offsets[origin];
+        offsets[comp] = sources[origin]->limit(source_comp) - sources[origin]->start(source_comp);
       }
-      limits[i] = limit;
+      block_size += offsets[comp];
     }
-    merged.recode();
-    merged.writeBWT(this->data);
+    block_offsets[block + 1] = block_size;
   }
 
-  // Merge the BWTs.
-  this->data.reserve(data_size + this->data.size());
-  std::vector<size_type> offsets(origins.size(), 0);
-  for(comp_type comp = 1; comp < origins.size(); comp++)
+  // Merge the BWTs. Each block copies its records to its own slice of the data.
+  block_offsets[0] = this->data.size();
+  for(size_type block = 1; block <= blocks.size(); block++) { block_offsets[block] += block_offsets[block - 1]; }
+  this->data.resize(block_offsets.back());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    offsets[comp] = this->data.size();
-    size_type origin = origins[comp];
-    if(origin >= sources.size())
-    {
-      this->data.push_back(0);  // Empty record, outdegree 0.
-      continue;
-    }
-    size_type start = limits[origin], limit = sources[origin]->limit(comp - record_offsets[origin]);
-    limits[origin] = limit;
-    for(size_type i = start; i < limit; i++)
+    size_type offset = block_offsets[block];
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
     {
-      this->data.push_back(sources[origin]->data[i]);
+      size_type record_size = offsets[comp];
+      offsets[comp] = offset;
+      size_type origin = origins[comp];
+      if(origin >= sources.size()) { this->data[offset] = 0; }
+      else
+      {
+        auto start = sources[origin]->data.begin() + sources[origin]->start(comp - record_offsets[origin]);
+        std::copy(start, start + record_size, this->data.begin() + offset);
+      }
+      offset += record_size;
     }
   }
 
@@ -811,6 +1048,28 @@ RecordArray::RecordArray(const std::vector<RecordArray const*> sources, const sd
   this->buildIndex(offsets);
 }
 
+void
+RecordArray::mergeEndmarkers(const std::vector<RecordArray const*>& sources, std::vector<byte_type>& data)
+{
+  DynamicRecord merged;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    if(sources[i]->empty()) { continue; }
+    size_type start = sources[i]->start(ENDMARKER), limit = sources[i]->limit(ENDMARKER);
+    CompressedRecord record(sources[i]->data, start, limit);
+    for(CompressedRecordIterator iter(record); !(iter.end()); ++iter)
+    {
+      run_type run = *iter; run.first += merged.outdegree();
+      merged.body.push_back(run); merged.body_size += run.second;
+    }
+    for(edge_type outedge : record.outgoing)
+    {
+      merged.outgoing.push_back(outedge);
+    }
+  }
+  merged.recode();
+  merged.writeBWT(data);
+}
 
 RecordArray::RecordArray(size_type array_size) :
   records(array_size)
@@ -864,9 +1123,7 @@ RecordArray::serialize(std::ostream& out, sdsl::structure_tree_node* v, std::str
   sdsl::structure_tree_node* child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
   size_type written_bytes = 0;
 
-  written_bytes += sdsl::write_member(this->records, out, child, "records");
-  written_bytes += this->index.serialize(out, child, "index");
-  written_bytes += this->select.serialize(out, child, "select");
+  written_bytes += this->serializeIndex(out, child);
 
   // Serialize the data.
   size_type data_bytes = this->data.size() * sizeof(byte_type);
@@ -880,14 +1137,28 @@ RecordArray::serialize(std::ostream& out, sdsl::structure_tree_node* v, std::str
   return written_bytes;
 }
 
+size_type
+RecordArray::serializeIndex(std::ostream& out, sdsl::structure_tree_node* child) const
+{
+  size_type written_bytes = 0;
+  written_bytes += sdsl::write_member(this->records, out, child, "records");
+  written_bytes += this->index.serialize(out, child, "index");
+  written_bytes += this->select.serialize(out, child, "select");
+  return written_bytes;
+}
+
 void
-RecordArray::load(std::istream& in)
+RecordArray::loadIndex(std::istream& in)
 {
   sdsl::read_member(this->records, in);
-
-  // Read the record index.
   this->index.load(in);
   this->select.load(in, &(this->index));
+}
+
+void
+RecordArray::load(std::istream& in)
+{
+  this->loadIndex(in);
 
   // Read the data.
   this->data.resize(this->index.size());
@@ -972,102 +1243,159 @@ DASamples::DASamples(const std::vector<DynamicRecord>& bwt)
   }
 }
 
+DASamples::DASamples(size_type records, const std::vector<range_type>& sampled, const std::vector<range_type>& samples)
+{
+  // Mark the sampled records.
+  size_type bwt_offsets = 0;
+  this->sampled_records = sdsl::bit_vector(records, 0);
+  for(range_type record : sampled)
+  {
+    this->sampled_records[record.first] = 1;
+    bwt_offsets += record.second;
+  }
+  sdsl::util::init_support(this->record_rank, &(this->sampled_records));
+
+  // Build the bitvectors over BWT offsets.
+  sdsl::sd_vector_builder range_builder(bwt_offsets, sampled.size());
+  size_type offset = 0;
+  for(range_type record : sampled)
+  {
+    range_builder.set(offset);
+    offset += record.second;
+  }
+  this->bwt_ranges = sdsl::sd_vector<>(range_builder);
+  sdsl::util::init_support(this->bwt_select, &(this->bwt_ranges));
+  sdsl::sd_vector_builder offset_builder(bwt_offsets, samples.size());
+  size_type max_sample = 0;
+  for(range_type sample : samples)
+  {
+    offset_builder.set(sample.first);
+    max_sample = std::max(max_sample, sample.second);
+  }
+  this->sampled_offsets = sdsl::sd_vector<>(offset_builder);
+  sdsl::util::init_support(this->sample_rank, &(this->sampled_offsets));
+
+  // Store the samples.
+  this->array = sdsl::int_vector<0>(samples.size(), 0, bit_length(max_sample));
+  for(size_type i = 0; i < samples.size(); i++) { this->array[i] = samples[i].second; }
+}
+
 DASamples::DASamples(const std::vector<DASamples const*> sources, const sdsl::int_vector<0>& origins, const std::vector<size_type>& record_offsets, const std::vector<size_type>& sequence_counts)
 {
-  // Compute statistics and build iterators over the sources.
+  // Compute statistics and build select structures over the sampled offsets in the sources.
   size_type sample_count = 0, total_sequences = 0;
   std::vector<size_type> sequence_offsets(sources.size(), 0);
-  std::vector<SampleIterator> sample_iterators;
-  std::vector<SampleRangeIterator> range_iterators;
+  std::vector<sdsl::sd_vector<>::select_1_type> offset_selects;
   for(size_type i = 0; i < sources.size(); i++)
   {
     sample_count += sources[i]->size();
     sequence_offsets[i] = total_sequences;
     total_sequences += sequence_counts[i];
-    sample_iterators.push_back(SampleIterator(*(sources[i])));
-    range_iterators.push_back(SampleRangeIterator(*(sources[i])));
+    offset_selects.emplace_back(&(sources[i]->sampled_offsets));
   }
 
-  // Compute statistics over the records and mark the sampled nodes.
-  // Note that the endmarker requires special treatment.
-  size_type record_count = 0, bwt_offsets = 0;
-  this->sampled_records = sdsl::bit_vector(origins.size(), 0);
+  // Collect the samples from the endmarkers. The merged endmarker covers all sequences.
   bool sample_endmarker = false;
+  std::vector<size_type> offsets, ids;
+  offsets.reserve(sample_count); ids.reserve(sample_count);
   for(size_type origin = 0; origin < sources.size(); origin++)
   {
-    if(sources[origin]->isSampled(ENDMARKER))
+    const DASamples& source = *(sources[origin]);
+    if(source.records() == 0 || !(source.isSampled(ENDMARKER))) { continue; }
+    sample_endmarker = true;
+    size_type limit = source.limit(0);
+    for(size_type i = 0; i < source.size() && offset_selects[origin](i + 1) < limit; i++)
     {
-      sample_endmarker = true;
-      ++range_iterators[origin];
+      offsets.push_back(offset_selects[origin](i + 1) + sequence_offsets[origin]);
+      ids.push_back(source.array[i] + sequence_offsets[origin]);
     }
   }
-  if(sample_endmarker)
+
+  // Find the sampled records in each block and their total length and number of samples.
+  struct SampledBlock
   {
-    record_count++;
-    bwt_offsets += total_sequences;
-    this->sampled_records[ENDMARKER] = 1;
-  }
-  for(size_type i = 1; i < origins.size(); i++)
+    std::vector<size_type> records;
+    size_type              length, samples;
+  };
+  std::vector<range_type> blocks = Range::partition(range_type(1, origins.size() - 1), 4 * omp_get_max_threads());
+  std::vector<SampledBlock> sampled_blocks(blocks.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    size_type origin = origins[i];
-    if(origin >= sources.size()) { continue; }  // No record.
-    if(sources[origin]->isSampled(i - record_offsets[origin]))
+    SampledBlock& result = sampled_blocks[block];
+    result.length = 0; result.samples = 0;
+    for(comp_type comp = blocks[block].first; comp <= blocks[block].second; comp++)
     {
-      record_count++;
-      bwt_offsets += range_iterators[origin].length();
-      this->sampled_records[i] = 1;
-      ++range_iterators[origin];
+      size_type origin = origins[comp];
+      if(origin >= sources.size()) { continue; }  // No record.
+      const DASamples& source = *(sources[origin]);
+      size_type source_comp = comp - record_offsets[origin];
+      if(!(source.isSampled(source_comp))) { continue; }
+      size_type start = source.start(source_comp), limit = source.limit(source.record_rank(source_comp));
+      result.records.push_back(comp);
+      result.length += limit - start;
+      result.samples += source.sample_rank(limit) - source.sample_rank(start);
     }
   }
-  sdsl::util::init_support(this->record_rank, &(this->sampled_records));
 
-  // Reset the range iterators.
-  range_iterators.clear();
-  for(size_type i = 0; i < sources.size(); i++)
+  // Determine where each block starts in the merged samples.
+  size_type record_count = (sample_endmarker ? 1 : 0), bwt_offsets = (sample_endmarker ? total_sequences : 0);
+  std::vector<size_type> block_starts(blocks.size()), block_samples(blocks.size()), block_records(blocks.size());
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    range_iterators.push_back(SampleRangeIterator(*(sources[i])));
+    block_starts[block] = bwt_offsets; block_samples[block] = offsets.size(); block_records[block] = record_count;
+    bwt_offsets += sampled_blocks[block].length;
+    offsets.resize(offsets.size() + sampled_blocks[block].samples);
+    record_count += sampled_blocks[block].records.size();
   }
+  ids.resize(offsets.size());
 
-  // Build the bitvectors over BWT offsets and store the samples.
-  // The endmarker requires special treatment again.
-  sdsl::sd_vector_builder range_builder(bwt_offsets, record_count);
-  sdsl::sd_vector_builder offset_builder(bwt_offsets, sample_count);
-  this->array = sdsl::int_vector<0>(sample_count, 0, bit_length(total_sequences - 1));
-  size_type record_start = 0, curr = 0;
-  if(sample_endmarker)
+  // Collect the samples from the other records. Each block writes to its own slice.
+  std::vector<size_type> record_starts(record_count, 0);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_type block = 0; block < blocks.size(); block++)
   {
-    range_builder.set(record_start);
-    for(size_type origin = 0; origin < sources.size(); origin++)
+    size_type record_start = block_starts[block], curr = block_samples[block], record = block_records[block];
+    for(comp_type comp : sampled_blocks[block].records)
     {
-      if(!(sources[origin]->isSampled(ENDMARKER))) { continue; }
-      while(!(sample_iterators[origin].end()) && sample_iterators[origin].offset() < range_iterators[origin].limit())
+      size_type origin = origins[comp];
+      const DASamples& source = *(sources[origin]);
+      size_type source_comp = comp - record_offsets[origin];
+      size_type start = source.start(source_comp), limit = source.limit(source.record_rank(source_comp));
+      for(size_type i = source.sample_rank(start); i < source.size(); i++)
       {
-        offset_builder.set((sample_iterators[origin]).offset() + sequence_offsets[origin]);
-        this->array[curr] = *(sample_iterators[origin]) + sequence_offsets[origin]; curr++;
-        ++sample_iterators[origin];
+        size_type sample_offset = offset_selects[origin](i + 1);
+        if(sample_offset >= limit) { break; }
+        offsets[curr] = (sample_offset - start) + record_start;
+        ids[curr] = source.array[i] + sequence_offsets[origin];
+        curr++;
       }
-      ++range_iterators[origin];
+      record_starts[record] = record_start; record++;
+      record_start += limit - start;
     }
-    record_start += total_sequences;
   }
-  for(size_type i = 1; i < origins.size(); i++)
+
+  // Build the structures.
+  this->sampled_records = sdsl::bit_vector(origins.size(), 0);
+  if(sample_endmarker) { this->sampled_records[ENDMARKER] = 1; }
+  for(const SampledBlock& block : sampled_blocks)
   {
-    if(!(this->isSampled(i))) { continue; }
-    size_type origin = origins[i];
-    range_builder.set(record_start);
-    while(!(sample_iterators[origin].end()) && sample_iterators[origin].offset() < range_iterators[origin].limit())
-    {
-      offset_builder.set((sample_iterators[origin].offset() - range_iterators[origin].start()) + record_start);
-      this->array[curr] = *(sample_iterators[origin]) + sequence_offsets[origin]; curr++;
-      ++sample_iterators[origin];
-    }
-    record_start += range_iterators[origin].length();
-    ++range_iterators[origin];
+    for(comp_type comp : block.records) { this->sampled_records[comp] = 1; }
   }
+  sdsl::util::init_support(this->record_rank, &(this->sampled_records));
+
+  sdsl::sd_vector_builder range_builder(bwt_offsets, record_count);
+  for(size_type record_start : record_starts) { range_builder.set(record_start); }
   this->bwt_ranges = sdsl::sd_vector<>(range_builder);
   sdsl::util::init_support(this->bwt_select, &(this->bwt_ranges));
+
+  sdsl::sd_vector_builder offset_builder(bwt_offsets, offsets.size());
+  for(size_type offset : offsets) { offset_builder.set(offset); }
   this->sampled_offsets = sdsl::sd_vector<>(offset_builder);
   sdsl::util::init_support(this->sample_rank, &(this->sampled_offsets));
+
+  this->array = sdsl::int_vector<0>(ids.size(), 0, bit_length(total_sequences - 1));
+  for(size_type i = 0; i < ids.size(); i++) { this->array[i] = ids[i]; }
 }
 
 void
@@ -1216,7 +1544,8 @@ DASamples::limit(size_type rank) const
 
 MergeParameters::MergeParameters() :
   pos_buffer_size(POS_BUFFER_SIZE), thread_buffer_size(THREAD_BUFFER_SIZE),
-  merge_buffers(MERGE_BUFFERS), chunk_size(CHUNK_SIZE), merge_jobs(MERGE_JOBS)
+  merge_buffers(MERGE_BUFFERS), chunk_size(CHUNK_SIZE), merge_jobs(MERGE_JOBS),
+  ra_memory(RA_MEMORY)
 {
 }
 
@@ -1250,6 +1579,12 @@ MergeParameters::setMergeJobs(size_type n)
   this->merge_jobs = Range::bound(n, 1, MAX_MERGE_JOBS);
 }
 
+void
+MergeParameters::setRAMemory(size_type megabytes)
+{
+  this->ra_memory = megabytes;
+}
+
 //------------------------------------------------------------------------------
 
 Dictionary::Dictionary() :
@@ -1349,6 +1684,94 @@ Dictionary::Dictionary(const Dictionary& first, const Dictionary& second)
   }
 }
 
+// FNV-1a hash of a key.
+template<class Iter>
+size_type
+keyHash(Iter pos, Iter lim)
+{
+  size_type hash = 0xCBF29CE484222325;
+  for(; pos != lim; ++pos)
+  {
+    hash = (hash ^ static_cast<unsigned char>(*pos)) * 0x100000001B3;
+  }
+  return hash;
+}
+
+Dictionary::Dictionary(const std::vector<const Dictionary*>& sources, std::vector<std::vector<size_type>>& mappings)
+{
+  mappings = std::vector<std::vector<size_type>>(sources.size());
+  size_type total_size = 0, total_length = 0, nonempty = 0, nonempty_id = 0;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    if(sources[i] == nullptr || sources[i]->empty()) { continue; }
+    total_size += sources[i]->size(); total_length += sources[i]->length();
+    nonempty++; nonempty_id = i;
+  }
+  if(nonempty == 0)
+  {
+    *this = Dictionary();
+    return;
+  }
+  if(nonempty == 1)
+  {
+    *this = *(sources[nonempty_id]);
+    mappings[nonempty_id].resize(this->size());
+    for(size_type j = 0; j < this->size(); j++) { mappings[nonempty_id][j] = j; }
+    return;
+  }
+
+  // Linear probing in a hash table of key ids with load factor at most 0.5.
+  size_type mask = (size_type(1) << bit_length(2 * total_size)) - 1;
+  std::vector<size_type> table(mask + 1, invalid_offset());
+  std::vector<size_type> starts(1, 0);
+  this->data.reserve(total_length);
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    const Dictionary* source = sources[i];
+    if(source == nullptr || source->empty()) { continue; }
+    mappings[i].resize(source->size());
+    size_type source_start = starts.size() - 1;
+    for(size_type j = 0; j < source->size(); j++)
+    {
+      std::vector<char>::const_iterator key_begin = source->data.begin() + source->offsets[j];
+      std::vector<char>::const_iterator key_end = source->data.begin() + source->offsets[j + 1];
+      size_type slot = keyHash(key_begin, key_end) & mask, id = invalid_offset();
+      while(table[slot] != invalid_offset())
+      {
+        size_type candidate = table[slot];
+        if(starts[candidate + 1] - starts[candidate] == static_cast<size_type>(key_end - key_begin) &&
+           std::equal(key_begin, key_end, this->data.begin() + starts[candidate]))
+        {
+          id = candidate; break;
+        }
+        slot = (slot + 1) & mask;
+      }
+      // As in pairwise merging, a key is only compared to the keys from earlier sources.
+      // Duplicate keys within a source are kept, but the keys of the other sources are
+      // mapped to the first copy.
+      if(id == invalid_offset() || id >= source_start)
+      {
+        size_type new_id = starts.size() - 1;
+        this->data.insert(this->data.end(), key_begin, key_end);
+        starts.push_back(this->data.size());
+        if(id == invalid_offset()) { table[slot] = id = new_id; }
+        else if(source_start == 0) { id = new_id; }
+      }
+      mappings[i][j] = id;
+    }
+  }
+
+  this->offsets = sdsl::int_vector<0>(starts.size(), 0, bit_length(this->data.size()));
+  for(size_type i = 0; i < starts.size(); i++) { this->offsets[i] = starts[i]; }
+
+  // Build sorted_ids and check for duplicates.
+  this->sortKeys();
+  if(this->hasDuplicates() && Verbosity::level >= Verbosity::FULL)
+  {
+    std::cerr << "Dictionary::Dictionary(): Warning: The dictionary contains duplicate strings" << std::endl;
+  }
+}
+
 void
 Dictionary::swap(Dictionary& another)
 {
@@ -25,6 +25,7 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <sstream>
 
 #include <gbwt/bwtmerge.h>
 
@@ -36,21 +37,26 @@ namespace
 //------------------------------------------------------------------------------
 
 void
-initLargeArray(std::vector<edge_type>& large_array, size_type seed = 0xDEADBEEF)
+initArray(std::vector<edge_type>& array, size_type values, size_type seed = 0xDEADBEEF)
 {
-  constexpr size_type TOTAL_VALUES = 2 * BlockArray::BLOCK_SIZE;
   constexpr size_type NODES = MILLION;
   constexpr size_type OFFSETS = 1000;
 
-  large_array.clear();
-  large_array.reserve(TOTAL_VALUES);
+  array.clear();
+  array.reserve(values);
   std::mt19937_64 rng(seed);
-  for(size_type i = 0; i < TOTAL_VALUES; i++)
+  for(size_type i = 0; i < values; i++)
   {
-    large_array.emplace_back(rng() % NODES, rng() % OFFSETS);
+    array.emplace_back(rng() % NODES, rng() % OFFSETS);
   }
 }
 
+void
+initLargeArray(std::vector<edge_type>& large_array, size_type seed = 0xDEADBEEF)
+{
+  initArray(large_array, 2 * BlockArray::BLOCK_SIZE, seed);
+}
+
 //------------------------------------------------------------------------------
 
 class BlockArrayTest : public ::testing::Test
@@ -419,6 +425,47 @@ TEST_F(GapArrayTest, MultipleFiles)
   for(std::string& filename : filenames) { TempFile::remove(filename); }
 }
 
+TEST_F(GapArrayTest, Frames)
+{
+  // Multiple frames in files and in memory. The middle range gets about 300 values.
+  initArray(large_array, 300000);
+  std::vector<range_type> node_ranges = { { 0, 499999 }, { 500000, 500999 }, { 501000, invalid_edge().first - 1 } };
+  std::vector<edge_type> correct_values = large_array;
+  sequentialSort(correct_values.begin(), correct_values.end());
+
+  std::vector<std::string> filenames;
+  for(size_type i = 0; i < node_ranges.size(); i++) { filenames.push_back(TempFile::getName("GapArray")); }
+  std::vector<size_type> value_counts;
+  {
+    std::vector<edge_type> buffer = large_array;
+    GapArray<BlockArray> array(buffer);
+    array.write(filenames, node_ranges, value_counts);
+  }
+  std::vector<GapArray<std::vector<byte_type>>> arrays(node_ranges.size());
+  {
+    std::vector<edge_type> buffer = large_array;
+    GapArray<BlockArray> array(buffer);
+    array.write(arrays, node_ranges);
+  }
+
+  auto range_start = correct_values.begin();
+  for(size_type i = 0; i < node_ranges.size(); i++)
+  {
+    auto range_end = range_start;
+    while(range_end != correct_values.end() && range_end->first <= node_ranges[i].second) { ++range_end; }
+    std::vector<edge_type> range_values(range_start, range_end);
+    ASSERT_EQ(value_counts[i], range_values.size()) << "Wrong number of values in file " << i;
+
+    GapArray<sdsl::int_vector_buffer<8>> part;
+    open(part, filenames[i], value_counts[i]);
+    checkArray(part, range_values, "File " + std::to_string(i));
+    checkArray(arrays[i], range_values, "Array " + std::to_string(i));
+    range_start = range_end;
+  }
+
+  for(std::string& filename : filenames) { TempFile::remove(filename); }
+}
+
 TEST_F(GapArrayTest, Large)
 {
   // Create and check GapArray.
@@ -439,12 +486,19 @@ class RankArrayTest : public ::testing::Test
 {
 public:
   std::vector<edge_type> first, second;
+  size_type old_verbosity;
 
-  RankArrayTest()
+  RankArrayTest() :
+    old_verbosity(Verbosity::level)
   {
     Verbosity::set(Verbosity::SILENT);
   }
 
+  ~RankArrayTest()
+  {
+    Verbosity::set(this->old_verbosity);
+  }
+
   void SetUp() override
   {
     this->first = 
@@ -489,13 +543,15 @@ public:
   }
 
   // Note that this sorts correct_values.
-  static void checkBuffer(RankArray& array, std::vector<edge_type>& correct_values, const std::string& test_name)
+  static void checkBuffer(RankArray& array, std::vector<edge_type>& correct_values, const std::string& test_name,
+                          size_type buffer_size = PRODUCER_BUFFER_SIZE)
   {
     parallelQuickSort(correct_values.begin(), correct_values.end());
 
     bool early_end = false;
     size_type wrong_values = 0, end_at = 0;
-    ProducerBuffer<RankArray> buffer(array);
+    array.buffer_size = buffer_size;
+    ProducerBuffer<RankArray> buffer(array, buffer_size);
     for(size_type i = 0; i < correct_values.size(); i++)
     {
       if(buffer.end()) { early_end = true; end_at = i; break; }
@@ -528,6 +584,26 @@ TEST_F(RankArrayTest, BasicTests)
   checkArray(array, correct_values, "Multiple");
 }
 
+TEST_F(RankArrayTest, FilesAndArrays)
+{
+  std::vector<edge_type> correct_values;
+  correct_values.insert(correct_values.end(), first.begin(), first.end());
+  correct_values.insert(correct_values.end(), second.begin(), second.end());
+
+  RankArray array;
+  addFile(array, first);
+  std::vector<edge_type> buffer = second;
+  GapArray<BlockArray> data(buffer);
+  std::vector<RankArray::memory_type> arrays(1);
+  data.write(arrays, std::vector<range_type>(1, range_type(0, 6)));
+  array.addArray(std::move(arrays[0]));
+  ASSERT_EQ(array.files(), 1u) << "Wrong number of files";
+  ASSERT_EQ(array.size(), 2u) << "Wrong number of inputs";
+
+  checkArray(array, correct_values, "First pass");
+  checkArray(array, correct_values, "Second pass");
+}
+
 TEST_F(RankArrayTest, BufferedReading)
 {
   // Empty array.
@@ -551,19 +627,48 @@ TEST_F(RankArrayTest, BufferedReading)
   checkBuffer(array, correct_values, "Multiple");
 }
 
-TEST_F(RankArrayTest, MergeBuffers)
+TEST_F(RankArrayTest, SharedBuffers)
+{
+  EXPECT_EQ(producerBufferSize(1), PRODUCER_BUFFER_SIZE) << "A single producer does not get the full buffer";
+  EXPECT_EQ(producerBufferSize(4), PRODUCER_BUFFER_SIZE / 4) << "The buffer is not shared between the producers";
+  EXPECT_EQ(producerBufferSize(1000000), MIN_PRODUCER_BUFFER_SIZE) << "The buffers are below the minimum size";
+
+  // Multiple files with the minimum buffer size. Each file fills the buffer several times.
+  RankArray array;
+  std::vector<edge_type> correct_values, data;
+  initArray(data, 4 * MIN_PRODUCER_BUFFER_SIZE);
+  addFile(array, data);
+  correct_values.insert(correct_values.end(), data.begin(), data.end());
+  initArray(data, 4 * MIN_PRODUCER_BUFFER_SIZE, 0x42424242);
+  addFile(array, data);
+  correct_values.insert(correct_values.end(), data.begin(), data.end());
+  data.clear();
+  checkBuffer(array, correct_values, "Minimum", MIN_PRODUCER_BUFFER_SIZE);
+}
+
+// Four small inputs of about 300 kilobytes each as rank array values. With a single merge
+// buffer, flush() writes them to the rank array in at least two parts.
+constexpr size_type SMALL_INPUTS = 4;
+constexpr size_type SMALL_INPUT_SIZE = 150000;
+
+void
+checkMergeBuffers(size_type ra_memory, bool small_inputs, size_type& files, size_type& arrays)
 {
   // Merge parameters.
   MergeParameters parameters;
   parameters.setPosBufferSize(1);
   parameters.setThreadBufferSize(4);
-  parameters.setMergeBuffers(2);
+  parameters.setMergeBuffers(small_inputs ? 1 : 2);
   parameters.setMergeJobs(2);
+  parameters.setRAMemory(ra_memory);
 
   // Input data and buffers.
-  std::vector<std::vector<edge_type>> data(2);
-  initLargeArray(data[0]);
-  initLargeArray(data[1], 0x42424242);
+  std::vector<std::vector<edge_type>> data(small_inputs ? SMALL_INPUTS : 2);
+  for(size_type i = 0; i < data.size(); i++)
+  {
+    if(small_inputs) { initArray(data[i], SMALL_INPUT_SIZE, 0xDEADBEEF + i); }
+    else { initLargeArray(data[i], (i == 0 ? 0xDEADBEEF : 0x42424242)); }
+  }
 
   // Determine the node ranges.
   node_type max_node = 0;
@@ -577,7 +682,9 @@ TEST_F(RankArrayTest, MergeBuffers)
   std::vector<range_type> node_ranges = Range::partition(range_type(0, max_node), parameters.merge_jobs);
 
   // Create the merge buffers.
-  MergeBuffers buffers(data[0].size() + data[1].size(), data.size(), parameters, node_ranges);
+  size_type total_size = 0;
+  for(size_type i = 0; i < data.size(); i++) { total_size += data[i].size(); }
+  MergeBuffers buffers(total_size, data.size(), parameters, node_ranges);
 
   // Insert the data.
   #pragma omp parallel for schedule(static)
@@ -599,6 +706,13 @@ TEST_F(RankArrayTest, MergeBuffers)
   }
   parallelQuickSort(correct_values.begin(), correct_values.end());
 
+  // The writer thread must have written all buffers before flush() returns.
+  EXPECT_TRUE(buffers.write_queue.empty()) << "Buffers left in the write queue";
+  EXPECT_GT(buffers.queued_writes, 0u) << "No buffers were handed over to the writer thread";
+  EXPECT_FALSE(buffers.writer.joinable()) << "The writer thread is still running after flush()";
+  EXPECT_EQ(buffers.ra_values, correct_values.size()) << "Wrong number of values written to the rank arrays";
+  EXPECT_LE(buffers.ra_memory, parameters.raMemoryBytes()) << "The in-memory rank arrays exceed the memory budget";
+
   // Test each RankArray separately.
   std::vector<edge_type>::iterator array_iter = correct_values.begin();
   for(size_type i = 0; i < buffers.ra.size(); i++)
@@ -619,6 +733,134 @@ TEST_F(RankArrayTest, MergeBuffers)
     // Skip the values that were missing from the file.
     while(array_iter != correct_values.end() && array_iter->first <= node_ranges[i].second) { ++array_iter; }
   }
+
+  files = 0; arrays = 0;
+  for(size_type i = 0; i < buffers.ra.size(); i++)
+  {
+    files += buffers.ra[i]->files();
+    arrays += buffers.ra[i]->size() - buffers.ra[i]->files();
+  }
+}
+
+TEST_F(RankArrayTest, MergeBuffers)
+{
+  size_type files = 0, arrays = 0;
+  checkMergeBuffers(0, false, files, arrays);
+  EXPECT_GT(files, 0u) << "No files in the rank arrays";
+  EXPECT_EQ(arrays, 0u) << "In-memory arrays in the rank arrays without a memory budget";
+}
+
+TEST_F(RankArrayTest, InMemory)
+{
+  size_type files = 0, arrays = 0;
+  checkMergeBuffers(1024, true, files, arrays);
+  EXPECT_EQ(files, 0u) << "Files in the rank arrays with a sufficient memory budget";
+  EXPECT_GT(arrays, 0u) << "No in-memory arrays in the rank arrays";
+}
+
+TEST_F(RankArrayTest, MemoryBudget)
+{
+  size_type files = 0, arrays = 0;
+  checkMergeBuffers(1, true, files, arrays);
+  EXPECT_GT(files, 0u) << "No files in the rank arrays";
+  EXPECT_GT(arrays, 0u) << "No in-memory arrays in the rank arrays";
+}
+
+TEST_F(RankArrayTest, Progress)
+{
+  std::stringstream out;
+  MergeProgress::start(out, MergeParameters(), 0.01);
+  MergeProgress::phase("search");
+  size_type files = 0, arrays = 0;
+  checkMergeBuffers(0, true, files, arrays);
+  MergeProgress::job(0, 10, 1.0);
+  MergeProgress::stop();
+  EXPECT_FALSE(MergeProgress::enabled()) << "Progress reporting was not stopped";
+
+  EXPECT_EQ(MergeProgress::values.load(), SMALL_INPUTS * SMALL_INPUT_SIZE) << "Wrong number of rank array values reported";
+  EXPECT_GT(MergeProgress::bytes_spilled.load(), 0u) << "No bytes spilled to files were reported";
+  EXPECT_EQ(MergeProgress::bytes_in_memory.load(), 0u) << "Bytes kept in memory were reported without a memory budget";
+  EXPECT_EQ(MergeProgress::bytes_read.load(), MergeProgress::bytes_spilled.load()) << "The rank array files were not read completely";
+
+  std::vector<std::string> lines;
+  std::string line;
+  while(std::getline(out, line)) { lines.push_back(line); }
+  ASSERT_GE(lines.size(), 4u) << "Too few progress lines";
+  bool valid_lines = true;
+  for(const std::string& l : lines) { valid_lines &= (l.front() == '{' && l.back() == '}'); }
+  EXPECT_TRUE(valid_lines) << "Progress lines are not JSON objects";
+  EXPECT_EQ(lines.front().find("{\"event\":\"start\""), 0u) << "The first line is not a start event";
+  EXPECT_EQ(lines.back().find("{\"event\":\"stop\""), 0u) << "The last line is not a stop event";
+  size_type phases = 0, jobs = 0;
+  for(const std::string& l : lines)
+  {
+    if(l.find("{\"event\":\"phase\"") == 0) { phases++; }
+    if(l.find("{\"event\":\"job\"") == 0) { jobs++; }
+  }
+  EXPECT_EQ(phases, 1u) << "Expected 1 phase event, got " << phases;
+  EXPECT_EQ(jobs, 1u) << "Expected 1 job event, got " << jobs;
+}
+
+TEST_F(RankArrayTest, ExitWhileReporting)
+{
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_EXIT(
+  {
+    static std::stringstream out;
+    MergeProgress::start(out, MergeParameters(), 0.01);
+    std::exit(EXIT_FAILURE);
+  }, ::testing::ExitedWithCode(EXIT_FAILURE), "") << "Exiting while reporting progress does not work";
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<std::array<size_type, 3>>
+randomTuples(size_type n, size_type seed)
+{
+  std::mt19937_64 rng(seed);
+  std::vector<std::array<size_type, 3>> result(n);
+  for(auto& tuple : result)
+  {
+    tuple = { { rng() % 100, rng() % 1000, rng() } };
+  }
+  return result;
+}
+
+void
+checkExternalSorter(size_type n, size_type buffer_size, size_type expected_files)
+{
+  std::vector<std::array<size_type, 3>> tuples = randomTuples(n, n + buffer_size);
+  ExternalSorter<3> sorter(buffer_size);
+  for(auto& tuple : tuples) { sorter.push(tuple); }
+  sorter.finish();
+  EXPECT_EQ(sorter.size(), n) << "Wrong number of tuples";
+  EXPECT_EQ(sorter.files(), expected_files) << "Wrong number of files";
+
+  std::sort(tuples.begin(), tuples.end());
+  size_type i = 0, wrong_values = 0;
+  for(; !(sorter.end()); ++sorter, i++)
+  {
+    if(i >= tuples.size()) { break; }
+    if(*sorter != tuples[i]) { wrong_values++; }
+  }
+  EXPECT_EQ(i, n) << "Wrong number of sorted tuples";
+  EXPECT_TRUE(sorter.end()) << "The sorter has too many tuples";
+  EXPECT_EQ(wrong_values, 0u) << wrong_values << " wrong values";
+}
+
+TEST(ExternalSorterTest, InMemory)
+{
+  checkExternalSorter(1000, 2000, 0);
+}
+
+TEST(ExternalSorterTest, Files)
+{
+  checkExternalSorter(1000, 64, 16);
+}
+
+TEST(ExternalSorterTest, Empty)
+{
+  checkExternalSorter(0, 64, 0);
 }
 
 //------------------------------------------------------------------------------
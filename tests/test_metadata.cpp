@@ -24,6 +24,7 @@
 
 #include <gtest/gtest.h>
 
+#include <set>
 #include <sstream>
 
 #include <gbwt/metadata.h>
@@ -41,12 +42,19 @@ public:
   std::vector<std::string> keys, first_keys, second_keys, third_keys;
   std::vector<PathName> paths;
   size_type path_samples, path_haplotypes, path_contigs;
+  size_type old_verbosity;
 
-  MetadataTest()
+  MetadataTest() :
+    old_verbosity(Verbosity::level)
   {
     Verbosity::set(Verbosity::SILENT);
   }
 
+  ~MetadataTest()
+  {
+    Verbosity::set(this->old_verbosity);
+  }
+
   void SetUp() override
   {
     this->keys =
@@ -614,6 +622,55 @@ TEST_F(MetadataTest, RemovePaths)
   }
 }
 
+TEST_F(MetadataTest, SubsetPaths)
+{
+  Metadata metadata;
+  metadata.setSamples(first_keys);
+  metadata.setHaplotypes(path_haplotypes);
+  metadata.setContigs(std::vector<std::string>(second_keys.begin(), second_keys.begin() + path_contigs));
+  for(const PathName& path : paths) { metadata.addPath(path); }
+
+  // Selecting all paths of a sample should be the same as removing the other samples
+  // and the contigs without paths.
+  for(size_type sample = 0; sample < metadata.samples(); sample++)
+  {
+    Metadata curr = metadata;
+    curr.subset(metadata.pathsForSample(sample));
+    ASSERT_TRUE(curr.check()) << "Metadata object is not in a valid state after selecting sample " << sample;
+
+    Metadata correct = metadata;
+    for(size_type removed = metadata.samples(); removed > 0; removed--)
+    {
+      if(removed - 1 != sample) { correct.removeSample(removed - 1); }
+    }
+    for(size_type removed = correct.contigs(); removed > 0; removed--)
+    {
+      if(correct.pathsForContig(removed - 1).empty()) { correct.removeContig(removed - 1); }
+    }
+    EXPECT_EQ(curr, correct) << "Wrong metadata after selecting sample " << sample;
+  }
+
+  // Select paths from one sample and one contig.
+  {
+    Metadata curr = metadata;
+    std::vector<size_type> selected { 6, 7 };
+    curr.subset(selected);
+    ASSERT_TRUE(curr.check()) << "Metadata object is not in a valid state after selecting paths";
+    EXPECT_EQ(curr.samples(), 1u) << "Wrong number of samples after selecting paths";
+    EXPECT_EQ(curr.haplotypes(), 1u) << "Wrong number of haplotypes after selecting paths";
+    EXPECT_EQ(curr.contigs(), 1u) << "Wrong number of contigs after selecting paths";
+    EXPECT_EQ(curr.sample(0), first_keys[2]) << "Wrong sample name after selecting paths";
+    EXPECT_EQ(curr.contig(0), second_keys[0]) << "Wrong contig name after selecting paths";
+    ASSERT_EQ(curr.paths(), selected.size()) << "Wrong number of paths after selecting paths";
+    for(size_type i = 0; i < selected.size(); i++)
+    {
+      PathName expected = paths[selected[i]];
+      expected.sample = 0; expected.contig = 0;
+      EXPECT_EQ(curr.path(i), expected) << "Wrong path name " << i << " after selecting paths";
+    }
+  }
+}
+
 TEST_F(MetadataTest, PathMerging)
 {
   Metadata first_names, first_nonames, third_names, third_nonames;
@@ -638,6 +695,112 @@ TEST_F(MetadataTest, PathMerging)
   comparePaths(first_nonames, third_nonames, false);
 }
 
+TEST_F(MetadataTest, MultipleSources)
+{
+  std::vector<std::vector<std::string>> source_keys { first_keys, second_keys, third_keys };
+  for(size_type mask = 0; mask < 8; mask++)
+  {
+    std::vector<Metadata> sources(source_keys.size());
+    for(size_type i = 0; i < sources.size(); i++)
+    {
+      if(mask & (size_type(1) << i))
+      {
+        sources[i].setSamples(source_keys[i]);
+        sources[i].setContigs(source_keys[i]);
+      }
+      else
+      {
+        sources[i].setSamples(source_keys[i].size());
+        sources[i].setContigs(source_keys[i].size());
+      }
+      sources[i].setHaplotypes(path_haplotypes);
+      for(const PathName& path : paths) { sources[i].addPath(path); }
+    }
+    std::vector<const Metadata*> source_ptrs;
+    for(const Metadata& source : sources) { source_ptrs.push_back(&source); }
+
+    for(bool same : { false, true })
+    {
+      Metadata correct_result = sources.front();
+      for(size_type i = 1; i < sources.size(); i++) { correct_result.merge(sources[i], same, same); }
+      Metadata merged(source_ptrs, same, same);
+      EXPECT_EQ(merged, correct_result) << "Merging " << sources.size() << " sources does not work correctly (mask " << mask << ", " << (same ? "same" : "not_same") << ")";
+    }
+  }
+
+  // Merge all sources by names.
+  std::vector<Metadata> sources(source_keys.size());
+  std::vector<const Metadata*> source_ptrs;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    sources[i].setSamples(source_keys[i]);
+    sources[i].setContigs(source_keys[i]);
+    for(const PathName& path : paths) { sources[i].addPath(path); }
+    source_ptrs.push_back(&(sources[i]));
+  }
+  Metadata merged(source_ptrs, false, false);
+  size_type correct_samples = 6;
+  ASSERT_TRUE(merged.hasSampleNames()) << "Merged metadata object does not have sample names";
+  ASSERT_TRUE(merged.hasPathNames()) << "Merged metadata object does not have path names";
+  EXPECT_EQ(merged.samples(), correct_samples) << "Expected " << correct_samples << " samples, got " << merged.samples();
+  EXPECT_EQ(merged.contigs(), correct_samples) << "Expected " << correct_samples << " contigs, got " << merged.contigs();
+  ASSERT_EQ(merged.paths(), sources.size() * paths.size()) << "Expected " << (sources.size() * paths.size()) << " paths, got " << merged.paths();
+  bool correct_paths = true;
+  std::set<std::pair<size_type, size_type>> haplotypes;
+  for(size_type i = 0; i < merged.paths(); i++)
+  {
+    const Metadata& source = sources[i / paths.size()];
+    PathName path = paths[i % paths.size()];
+    path.sample = merged.sample(source.sample(path.sample));
+    path.contig = merged.contig(source.contig(path.contig));
+    correct_paths &= (merged.path(i) == path);
+    haplotypes.emplace(path.sample, path.phase);
+  }
+  EXPECT_TRUE(correct_paths) << "Path names were not merged correctly";
+  EXPECT_EQ(merged.haplotypes(), static_cast<size_type>(haplotypes.size())) << "Expected " << haplotypes.size() << " haplotypes, got " << merged.haplotypes();
+}
+
+TEST_F(MetadataTest, DuplicateNames)
+{
+  std::vector<std::vector<std::string>> source_keys
+  {
+    { "a", "b" },
+    { "c", "b", "c" }
+  };
+  std::vector<Metadata> sources(source_keys.size());
+  std::vector<const Metadata*> source_ptrs;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    sources[i].setSamples(source_keys[i]);
+    sources[i].setContigs(source_keys[i]);
+    for(size_type j = 0; j < source_keys[i].size(); j++)
+    {
+      PathName path;
+      path.sample = j; path.contig = j; path.phase = 0; path.count = 0;
+      sources[i].addPath(path);
+    }
+    source_ptrs.push_back(&(sources[i]));
+  }
+
+  Metadata correct_result = sources.front();
+  correct_result.merge(sources.back(), false, false);
+  Metadata merged(source_ptrs, false, false);
+  EXPECT_EQ(merged, correct_result) << "The result differs from pairwise merging";
+
+  // Duplicate names in the later source are mapped to the first copy.
+  size_type correct_samples = 4, correct_haplotypes = 3;
+  std::vector<size_type> correct_ids { 0, 1, 2, 1, 2 };
+  EXPECT_EQ(merged.samples(), correct_samples) << "Expected " << correct_samples << " samples, got " << merged.samples();
+  EXPECT_EQ(merged.contigs(), correct_samples) << "Expected " << correct_samples << " contigs, got " << merged.contigs();
+  EXPECT_EQ(merged.haplotypes(), correct_haplotypes) << "Expected " << correct_haplotypes << " haplotypes, got " << merged.haplotypes();
+  ASSERT_EQ(merged.paths(), correct_ids.size()) << "Expected " << correct_ids.size() << " paths, got " << merged.paths();
+  for(size_type i = 0; i < merged.paths(); i++)
+  {
+    EXPECT_EQ(merged.path(i).sample, correct_ids[i]) << "Invalid sample id for path " << i;
+    EXPECT_EQ(merged.path(i).contig, correct_ids[i]) << "Invalid contig id for path " << i;
+  }
+}
+
 TEST_F(MetadataTest, Serialization)
 {
   Metadata original;
@@ -24,6 +24,7 @@
 
 #include <gtest/gtest.h>
 
+#include <gbwt/bwtmerge.h>
 #include <gbwt/cached_gbwt.h>
 #include <gbwt/dynamic_gbwt.h>
 
@@ -41,6 +42,17 @@ namespace
 
 //------------------------------------------------------------------------------
 
+// Sets the verbosity level and restores the old level when going out of scope.
+struct VerbosityGuard
+{
+  size_type old_level;
+
+  explicit VerbosityGuard(size_type level) : old_level(Verbosity::level) { Verbosity::set(level); }
+  ~VerbosityGuard() { Verbosity::set(this->old_level); }
+};
+
+//------------------------------------------------------------------------------
+
 /*
   The test paths were copied from the VG gbwt_helper.cpp unit tests.
 */
@@ -66,9 +78,9 @@ vector_type short_path
   static_cast<vector_type::value_type>(Node::encode(9, false))
 };
 
-// Build a bidirectional GBWT of the paths.
-GBWT
-buildGBWT(const std::vector<vector_type>& paths)
+// Build a bidirectional dynamic GBWT of the paths.
+DynamicGBWT
+buildDynamicGBWT(const std::vector<vector_type>& paths)
 {
   size_type node_width = 1, total_length = 0;
   for(auto& path : paths)
@@ -77,24 +89,37 @@ buildGBWT(const std::vector<vector_type>& paths)
     total_length += 2 * (path.size() + 1);
   }
 
-  Verbosity::set(Verbosity::SILENT);
+  VerbosityGuard verbosity(Verbosity::SILENT);
   GBWTBuilder builder(node_width, total_length);
   for(auto& path : paths) { builder.insert(path, true); }
   builder.finish();
 
-  return GBWT(builder.index);
+  return builder.index;
 }
 
-// Build a bidirectional GBWT with three paths including a duplicate.
+// Build a bidirectional GBWT of the paths.
 GBWT
-getGBWT()
+buildGBWT(const std::vector<vector_type>& paths)
+{
+  return GBWT(buildDynamicGBWT(paths));
+}
+
+// Three paths including a duplicate.
+std::vector<vector_type>
+getPaths()
 {
   std::vector<vector_type> paths
   {
     short_path, alt_path, short_path
   };
+  return paths;
+}
 
-  return buildGBWT(paths);
+// Build a bidirectional GBWT with three paths including a duplicate.
+GBWT
+getGBWT()
+{
+  return buildGBWT(getPaths());
 }
 
 std::vector<vector_type>
@@ -372,4 +397,1004 @@ TEST(CachedGBWTTest, Cache)
 
 //------------------------------------------------------------------------------
 
+// Extend the states from all patterns in both directions with all nodes, including invalid ones.
+std::vector<BidirectionalExtension>
+getExtensions(const GBWT& index)
+{
+  std::vector<BidirectionalExtension> result;
+  for(const vector_type& pattern : getPatterns())
+  {
+    BidirectionalState state = index.bdFind(pattern.front());
+    for(size_type i = 1; i < pattern.size(); i++) { state = index.bdExtendForward(state, pattern[i]); }
+    for(node_type node = 0; node < index.sigma() + 2; node++)
+    {
+      result.emplace_back(state, node, false);
+      result.emplace_back(state, node, true);
+    }
+  }
+  result.emplace_back(BidirectionalState(), index.firstNode(), false);
+  return result;
+}
+
+template<class GBWTType>
+void
+checkBatched(const GBWTType& index, const std::vector<BidirectionalExtension>& requests, const std::string& index_type)
+{
+  std::vector<BidirectionalExtension> batch = requests;
+  index.bdExtend(batch);
+  ASSERT_EQ(batch.size(), requests.size()) << index_type << ": Wrong number of results";
+  for(size_type i = 0; i < requests.size(); i++)
+  {
+    const BidirectionalExtension& request = requests[i];
+    BidirectionalState correct = (request.backward ?
+      index.bdExtendBackward(request.state, request.node) :
+      index.bdExtendForward(request.state, request.node));
+    EXPECT_EQ(batch[i].state, correct) << index_type << ": Wrong result for extending state " << request.state << (request.backward ? " backward" : " forward") << " with node " << request.node;
+  }
+}
+
+TEST(BatchedSearchTest, Bidirectional)
+{
+  DynamicGBWT dynamic_index = buildDynamicGBWT(getPaths());
+  GBWT index(dynamic_index);
+  CachedGBWT cached(index);
+  std::vector<BidirectionalExtension> requests = getExtensions(index);
+
+  checkBatched(index, requests, "GBWT");
+  checkBatched(cached, requests, "CachedGBWT");
+  checkBatched(dynamic_index, requests, "DynamicGBWT");
+}
+
+TEST(BatchedSearchTest, EmptyBatch)
+{
+  GBWT index = getGBWT();
+  std::vector<BidirectionalExtension> requests;
+  index.bdExtend(requests);
+  EXPECT_TRUE(requests.empty()) << "Extending an empty batch created results";
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<vector_type>
+getMatchingQueries()
+{
+  std::vector<vector_type> result;
+  result.push_back(alt_path);
+  result.push_back(short_path);
+
+  // Switch from one path to another.
+  vector_type switched(alt_path.begin(), alt_path.begin() + 3);
+  switched.insert(switched.end(), short_path.begin() + 3, short_path.end());
+  result.push_back(switched);
+
+  // Reverse orientation with a missing node in the middle.
+  vector_type reverse;
+  reversePath(alt_path, reverse);
+  reverse.insert(reverse.begin() + 3, static_cast<vector_type::value_type>(Node::encode(20, false)));
+  result.push_back(reverse);
+
+  // Repeated path and an empty query.
+  vector_type repeated = short_path;
+  repeated.insert(repeated.end(), short_path.begin(), short_path.end());
+  result.push_back(repeated);
+  result.push_back(vector_type());
+
+  return result;
+}
+
+// Determine the correct matching statistics using find().
+template<class GBWTType>
+void
+checkMatchingStatistics(const GBWTType& index, const vector_type& query, const MatchingStatistics& statistics, size_type query_id)
+{
+  ASSERT_EQ(statistics.size(), query.size()) << "Wrong number of matching statistics for query " << query_id;
+  ASSERT_EQ(statistics.states.size(), query.size()) << "Wrong number of search states for query " << query_id;
+  for(size_type i = 0; i < query.size(); i++)
+  {
+    size_type length = 0;
+    SearchState state;
+    while(i + length < query.size())
+    {
+      SearchState next = index.find(query.begin() + i, query.begin() + i + length + 1);
+      if(next.empty()) { break; }
+      state = next; length++;
+    }
+    EXPECT_EQ(statistics.lengths[i], length) << "Wrong match length for query " << query_id << ", offset " << i;
+    EXPECT_EQ(statistics.states[i], state) << "Wrong search state for query " << query_id << ", offset " << i;
+  }
+}
+
+TEST(MatchingStatisticsTest, SingleQueries)
+{
+  DynamicGBWT dynamic_index = buildDynamicGBWT(getPaths());
+  GBWT index(dynamic_index);
+  CachedGBWT cached(index);
+  std::vector<vector_type> queries = getMatchingQueries();
+
+  for(size_type i = 0; i < queries.size(); i++)
+  {
+    checkMatchingStatistics(index, queries[i], index.matchingStatistics(queries[i]), i);
+    checkMatchingStatistics(index, queries[i], cached.matchingStatistics(queries[i]), i);
+    checkMatchingStatistics(index, queries[i], dynamic_index.matchingStatistics(queries[i]), i);
+  }
+}
+
+TEST(MatchingStatisticsTest, Batches)
+{
+  DynamicGBWT dynamic_index = buildDynamicGBWT(getPaths());
+  GBWT index(dynamic_index);
+  std::vector<vector_type> queries = getMatchingQueries();
+
+  std::vector<MatchingStatistics> compressed_results = index.matchingStatistics(queries);
+  std::vector<MatchingStatistics> dynamic_results = dynamic_index.matchingStatistics(queries);
+  ASSERT_EQ(compressed_results.size(), queries.size()) << "Wrong number of results from GBWT";
+  ASSERT_EQ(dynamic_results.size(), queries.size()) << "Wrong number of results from DynamicGBWT";
+  for(size_type i = 0; i < queries.size(); i++)
+  {
+    checkMatchingStatistics(index, queries[i], compressed_results[i], i);
+    checkMatchingStatistics(index, queries[i], dynamic_results[i], i);
+  }
+}
+
+TEST(MatchingStatisticsTest, Unidirectional)
+{
+  DynamicGBWT dynamic_index;
+  text_type text(alt_path.size() + 1, 0, bit_length(Node::encode(9, true)));
+  for(size_type i = 0; i < alt_path.size(); i++) { text[i] = alt_path[i]; }
+  dynamic_index.insert(text);
+  GBWT index(dynamic_index);
+
+  MatchingStatistics statistics = index.matchingStatistics(alt_path);
+  EXPECT_TRUE(statistics.empty()) << "Got matching statistics from a unidirectional index";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(GBWTStatisticsTest, Records)
+{
+  DynamicGBWT dynamic_index = buildDynamicGBWT(getPaths());
+  GBWT index(dynamic_index);
+  GBWTStatistics stats(index);
+
+  GBWTStatistics truth;
+  for(comp_type comp = 1; comp < dynamic_index.effective(); comp++)
+  {
+    const DynamicRecord& record = dynamic_index.record(dynamic_index.toNode(comp));
+    truth.records++;
+    truth.total_size += record.size(); truth.sizes[record.size()]++;
+    truth.total_runs += record.runs(); truth.runs[record.runs()]++;
+    truth.total_outdegree += record.outdegree(); truth.outdegrees[record.outdegree()]++;
+    for(run_type run : record.body) { truth.run_lengths[run.second]++; }
+  }
+  const DynamicRecord& endmarker = dynamic_index.record(ENDMARKER);
+
+  EXPECT_EQ(stats.records, truth.records) << "Wrong number of records";
+  EXPECT_EQ(stats.total_size, truth.total_size) << "Wrong total size";
+  EXPECT_EQ(stats.total_runs, truth.total_runs) << "Wrong total runs";
+  EXPECT_EQ(stats.total_outdegree, truth.total_outdegree) << "Wrong total outdegree";
+  EXPECT_EQ(stats.endmarker_size, endmarker.size()) << "Wrong endmarker size";
+  EXPECT_EQ(stats.endmarker_runs, endmarker.runs()) << "Wrong endmarker runs";
+  EXPECT_EQ(stats.endmarker_outdegree, endmarker.outdegree()) << "Wrong endmarker outdegree";
+  EXPECT_EQ(stats.total_runs + stats.endmarker_runs, index.runs()) << "Runs do not match GBWT::runs()";
+  EXPECT_EQ(stats.total_bytes + stats.endmarker_bytes, index.bwt.data.size()) << "Wrong total bytes";
+  EXPECT_EQ(stats.samples, index.samples()) << "Wrong number of samples";
+
+  EXPECT_EQ(stats.sizes, truth.sizes) << "Wrong size distribution";
+  EXPECT_EQ(stats.runs, truth.runs) << "Wrong run distribution";
+  EXPECT_EQ(stats.outdegrees, truth.outdegrees) << "Wrong outdegree distribution";
+  EXPECT_EQ(stats.run_lengths, truth.run_lengths) << "Wrong run length distribution";
+
+  size_type sampled_records = 0, bytes = 0;
+  for(comp_type comp = 0; comp < index.effective(); comp++)
+  {
+    if(index.da_samples.isSampled(comp)) { sampled_records++; }
+  }
+  for(auto value : stats.bytes) { bytes += value.second; }
+  EXPECT_EQ(stats.sampled_records, sampled_records) << "Wrong number of sampled records";
+  EXPECT_EQ(bytes, stats.records) << "Wrong number of records in the byte distribution";
+}
+
+TEST(GBWTStatisticsTest, Empty)
+{
+  GBWT index;
+  GBWTStatistics stats(index);
+  EXPECT_EQ(stats.records, 0u) << "Empty index has records";
+  EXPECT_EQ(index.runs(), 0u) << "Empty index has runs";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(SubsetTest, Paths)
+{
+  std::vector<vector_type> paths
+  {
+    short_path, alt_path, short_path, alt_path
+  };
+  GBWT index = buildGBWT(paths);
+  index.addMetadata();
+  index.metadata.setSamples(std::vector<std::string>({ "short", "alt" }));
+  index.metadata.setHaplotypes(4);
+  index.metadata.setContigs(std::vector<std::string>({ "chr" }));
+  for(size_type i = 0; i < paths.size(); i++)
+  {
+    PathName path { static_cast<PathName::path_name_type>(i & 1), 0, static_cast<PathName::path_name_type>(i >> 1), 0 };
+    index.metadata.addPath(path);
+  }
+
+  std::vector<size_type> selected { 3, 0, 1 };
+  GBWT result = subset(index, selected);
+  std::vector<vector_type> truth { short_path, alt_path, alt_path };
+  GBWT correct = buildGBWT(truth);
+  ASSERT_EQ(result.sequences(), correct.sequences()) << "Wrong number of sequences";
+  ASSERT_TRUE(result.bidirectional()) << "The subset is not bidirectional";
+  for(size_type i = 0; i < correct.sequences(); i++)
+  {
+    EXPECT_EQ(result.extract(i), correct.extract(i)) << "Wrong sequence " << i;
+  }
+
+  ASSERT_TRUE(result.hasMetadata()) << "The subset has no metadata";
+  Metadata metadata = index.metadata;
+  metadata.subset(std::vector<size_type>({ 0, 1, 3 }));
+  EXPECT_EQ(result.metadata, metadata) << "Wrong metadata";
+}
+
+TEST(SubsetTest, Sample)
+{
+  std::vector<vector_type> paths
+  {
+    short_path, alt_path, short_path, alt_path
+  };
+  GBWT index = buildGBWT(paths);
+  index.addMetadata();
+  index.metadata.setSamples(std::vector<std::string>({ "short", "alt" }));
+  index.metadata.setHaplotypes(4);
+  index.metadata.setContigs(std::vector<std::string>({ "chr" }));
+  for(size_type i = 0; i < paths.size(); i++)
+  {
+    PathName path { static_cast<PathName::path_name_type>(i & 1), 0, static_cast<PathName::path_name_type>(i >> 1), 0 };
+    index.metadata.addPath(path);
+  }
+
+  GBWT result = subset(index, index.metadata.pathsForSample(index.metadata.sample("alt")));
+  ASSERT_EQ(result.sequences(), 4u) << "Wrong number of sequences";
+  for(size_type i = 0; i < result.sequences(); i += 2)
+  {
+    EXPECT_EQ(result.extract(i), alt_path) << "Wrong sequence " << i;
+  }
+  EXPECT_EQ(result.metadata.samples(), 1u) << "Wrong number of samples";
+  EXPECT_EQ(result.metadata.haplotypes(), 2u) << "Wrong number of haplotypes";
+  EXPECT_EQ(result.metadata.sample(0), "alt") << "Wrong sample name";
+  EXPECT_EQ(result.metadata.paths(), 2u) << "Wrong number of paths";
+}
+
+TEST(SubsetTest, InvalidPaths)
+{
+  GBWT index = getGBWT();
+  EXPECT_TRUE(subset(index, std::vector<size_type>()).empty()) << "Got a non-empty subset without paths";
+  EXPECT_TRUE(subset(index, std::vector<size_type>({ 0, 3 })).empty()) << "Got a non-empty subset with an invalid path";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(RenumberTest, BFSOrder)
+{
+  GBWT index = getGBWT();
+  std::vector<size_type> translation = bfsOrder(index);
+  ASSERT_EQ(translation.size(), Node::id(index.sigma() - 1) + 1) << "Wrong translation table size";
+
+  size_type first_id = Node::id(index.toNode(1));
+  std::vector<size_type> ids(translation.begin() + first_id, translation.end());
+  std::sort(ids.begin(), ids.end());
+  bool ok = true;
+  for(size_type i = 0; i < ids.size(); i++) { ok &= (ids[i] == first_id + i); }
+  EXPECT_TRUE(ok) << "The translation is not a permutation of the node ids";
+
+  // The first path starts from the first node in BFS order.
+  std::vector<size_type> starts;
+  for(edge_type edge : index.record(ENDMARKER).outgoing) { starts.push_back(Node::id(edge.first)); }
+  EXPECT_EQ(translation[starts.front()], first_id) << "The first successor of the endmarker did not get the first id";
+}
+
+TEST(RenumberTest, Sequences)
+{
+  GBWT index = getGBWT();
+  index.addMetadata();
+  index.metadata.setSamples(index.sequences() / 2);
+  index.metadata.setHaplotypes(index.sequences() / 2);
+  std::vector<size_type> translation = bfsOrder(index);
+
+  GBWT result = renumber(index, translation);
+  ASSERT_EQ(result.sequences(), index.sequences()) << "Wrong number of sequences";
+  ASSERT_EQ(result.size(), index.size()) << "Wrong total length";
+  EXPECT_TRUE(result.bidirectional()) << "The result is not bidirectional";
+  for(size_type i = 0; i < index.sequences(); i++)
+  {
+    vector_type expected = index.extract(i);
+    for(auto& node : expected) { node = Node::encode(translation[Node::id(node)], Node::is_reverse(node)); }
+    EXPECT_EQ(result.extract(i), expected) << "Wrong sequence " << i;
+  }
+  EXPECT_TRUE(result.hasMetadata()) << "The result has no metadata";
+  EXPECT_EQ(result.metadata, index.metadata) << "Wrong metadata";
+
+  std::vector<size_type> too_short(Node::id(index.sigma() - 1), 0);
+  EXPECT_TRUE(renumber(index, too_short).empty()) << "Renumbering succeeded with an invalid translation table";
+}
+
+//------------------------------------------------------------------------------
+
+// Build an index of many copies of the paths using the given number of threads.
+std::string
+serializedIndex(size_type copies, int threads)
+{
+  std::vector<vector_type> paths;
+  for(size_type i = 0; i < copies; i++)
+  {
+    paths.push_back((i % 3 == 0) ? alt_path : short_path);
+  }
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(threads);
+  GBWT index = buildGBWT(paths);
+  omp_set_num_threads(old_threads);
+
+  std::stringstream out;
+  index.serialize(out);
+  return out.str();
+}
+
+TEST(InsertTest, ParallelUpdate)
+{
+  size_type copies = 2 * DynamicGBWT::PARALLEL_UPDATE_THRESHOLD;
+  EXPECT_EQ(serializedIndex(copies, 4), serializedIndex(copies, 1)) << "Parallel updates produced a different index";
+}
+
+//------------------------------------------------------------------------------
+
+vector_type
+shiftPath(const vector_type& path, size_type shift)
+{
+  vector_type result = path;
+  for(auto& node : result) { node = Node::encode(Node::id(node) + shift, Node::is_reverse(node)); }
+  return result;
+}
+
+// Paths alternating between node ranges [1, 10) and [11, 20).
+std::vector<vector_type>
+getPartitionedPaths(size_type copies)
+{
+  std::vector<vector_type> paths;
+  for(size_type i = 0; i < copies; i++)
+  {
+    const vector_type& path = ((i / 2) % 3 == 0) ? alt_path : short_path;
+    paths.push_back((i % 2 == 0) ? path : shiftPath(path, 10));
+  }
+  return paths;
+}
+
+GBWT
+buildPartitioned(const std::vector<vector_type>& paths, bool parallel)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  PartitionedGBWTBuilder builder({ 0, 10 }, bit_length(Node::encode(20, true)), 64);
+  #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+  for(size_type i = 0; i < paths.size(); i++)
+  {
+    builder.insert(paths[i], true);
+  }
+  builder.finish();
+  return builder.index;
+}
+
+TEST(PartitionedBuilderTest, Partitions)
+{
+  PartitionedGBWTBuilder builder({ 0, 10, 20 }, 8, 64);
+  ASSERT_EQ(builder.partitions(), static_cast<size_type>(3)) << "Wrong number of partitions";
+  EXPECT_EQ(builder.partition(Node::encode(1, false)), static_cast<size_type>(0)) << "Wrong partition for node 1";
+  EXPECT_EQ(builder.partition(Node::encode(9, true)), static_cast<size_type>(0)) << "Wrong partition for node 9";
+  EXPECT_EQ(builder.partition(Node::encode(10, false)), static_cast<size_type>(1)) << "Wrong partition for node 10";
+  EXPECT_EQ(builder.partition(Node::encode(25, true)), static_cast<size_type>(2)) << "Wrong partition for node 25";
+}
+
+TEST(PartitionedBuilderTest, Sequential)
+{
+  std::vector<vector_type> paths = getPartitionedPaths(6);
+  GBWT index = buildPartitioned(paths, false);
+
+  std::vector<vector_type> first, second;
+  for(size_type i = 0; i < paths.size(); i++)
+  {
+    if(i % 2 == 0) { first.push_back(paths[i]); }
+    else { second.push_back(paths[i]); }
+  }
+  std::vector<GBWT> sources { buildGBWT(first), buildGBWT(second) };
+  GBWT expected(sources);
+
+  std::stringstream index_out, expected_out;
+  index.serialize(index_out); expected.serialize(expected_out);
+  EXPECT_EQ(index_out.str(), expected_out.str()) << "The index differs from merged partitions";
+}
+
+TEST(PartitionedBuilderTest, Parallel)
+{
+  std::vector<vector_type> paths = getPartitionedPaths(200);
+  GBWT index = buildPartitioned(paths, true);
+  ASSERT_EQ(index.sequences(), 2 * paths.size()) << "Wrong number of sequences";
+  EXPECT_TRUE(index.bidirectional()) << "The index is not bidirectional";
+
+  std::vector<vector_type> extracted;
+  for(size_type i = 0; i < index.sequences(); i += 2) { extracted.push_back(index.extract(i)); }
+  std::sort(paths.begin(), paths.end());
+  std::sort(extracted.begin(), extracted.end());
+  EXPECT_EQ(extracted, paths) << "Wrong sequences";
+}
+
+TEST(PartitionedBuilderTest, SpanningSequence)
+{
+  std::vector<vector_type> paths = getPartitionedPaths(2);
+  vector_type spanning = alt_path;
+  spanning.push_back(Node::encode(15, false));
+
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  PartitionedGBWTBuilder builder({ 0, 10 }, bit_length(Node::encode(20, true)), 64);
+  for(const vector_type& path : paths)
+  {
+    EXPECT_TRUE(builder.insert(path, true)) << "A sequence within a partition was rejected";
+  }
+  EXPECT_FALSE(builder.insert(spanning, true)) << "A sequence spanning partitions was accepted";
+  builder.finish();
+
+  GBWT expected = buildPartitioned(paths, false);
+  std::stringstream index_out, expected_out;
+  builder.index.serialize(index_out); expected.serialize(expected_out);
+  EXPECT_EQ(index_out.str(), expected_out.str()) << "A sequence spanning partitions was inserted";
+}
+
+//------------------------------------------------------------------------------
+
+// Paths with repeated nodes and shared prefixes and suffixes.
+std::vector<vector_type>
+getExternalPaths()
+{
+  std::vector<vector_type> paths = getPaths();
+  vector_type cycle;
+  for(size_type i = 0; i < 20; i++) { cycle.push_back(Node::encode(1 + i % 3, false)); }
+  paths.push_back(cycle);
+  cycle.back() = Node::encode(9, false);
+  paths.push_back(cycle);
+  paths.push_back(vector_type());
+  paths.push_back(alt_path);
+  return paths;
+}
+
+std::string
+writeText(const std::vector<vector_type>& paths)
+{
+  std::string filename = TempFile::getName("text");
+  text_buffer_type text(filename, std::ios::out, MEGABYTE, bit_length(Node::encode(20, true)));
+  for(const vector_type& path : paths)
+  {
+    for(auto node : path) { text.push_back(node); }
+    text.push_back(ENDMARKER);
+  }
+  text.close();
+  return filename;
+}
+
+std::string
+serializeIndex(const GBWT& index)
+{
+  std::stringstream out;
+  index.serialize(out);
+  return out.str();
+}
+
+void
+checkExternal(bool both_orientations, size_type sample_interval, size_type buffer_size)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  std::vector<vector_type> paths = getExternalPaths();
+  std::string filename = writeText(paths);
+
+  DynamicGBWT dynamic_index;
+  {
+    text_buffer_type text(filename);
+    dynamic_index.insert(text, 0, both_orientations, sample_interval);
+  }
+  GBWT expected(dynamic_index);
+  GBWT index = buildExternal({ filename }, both_orientations, sample_interval, buffer_size);
+  TempFile::remove(filename);
+
+  ASSERT_EQ(index.sequences(), expected.sequences()) << "Wrong number of sequences";
+  for(size_type i = 0; i < index.sequences(); i++)
+  {
+    EXPECT_EQ(index.extract(i), expected.extract(i)) << "Wrong sequence " << i;
+  }
+  EXPECT_EQ(serializeIndex(index), serializeIndex(expected)) << "The index differs from dynamic construction";
+}
+
+TEST(ExternalConstructionTest, InMemory)
+{
+  checkExternal(false, DynamicGBWT::SAMPLE_INTERVAL, 1024);
+  checkExternal(true, DynamicGBWT::SAMPLE_INTERVAL, 1024);
+}
+
+TEST(ExternalConstructionTest, ExternalSort)
+{
+  checkExternal(false, 4, 10);
+  checkExternal(true, 4, 10);
+}
+
+TEST(ExternalConstructionTest, Empty)
+{
+  std::string filename = writeText({});
+  GBWT index = buildExternal({ filename });
+  TempFile::remove(filename);
+  EXPECT_TRUE(index.empty()) << "The index is not empty";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(FastMergeTest, Samples)
+{
+  // Sources with disjoint node ranges and different sample intervals, and an unsampled one.
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  std::vector<GBWT> sources;
+  size_type sequences = 0, samples = 0;
+  for(size_type i = 0; i < 12; i++)
+  {
+    vector_type text;
+    for(size_type copy = 0; copy < 4; copy++)
+    {
+      for(const vector_type& path : getPaths())
+      {
+        vector_type shifted = shiftPath(path, 20 * i);
+        text.insert(text.end(), shifted.begin(), shifted.end());
+        text.push_back(ENDMARKER);
+      }
+    }
+    DynamicGBWT dynamic_index;
+    dynamic_index.insert(text, false, (i == 5 ? 0 : 1 + i % 4));
+    sources.emplace_back(dynamic_index);
+    sequences += sources.back().sequences(); samples += sources.back().samples();
+  }
+
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  GBWT sequential(sources);
+  omp_set_num_threads(4);
+  GBWT index(sources);
+  omp_set_num_threads(old_threads);
+  EXPECT_EQ(serializeIndex(index), serializeIndex(sequential)) << "Parallel merging produced a different index";
+
+  ASSERT_EQ(index.sequences(), sequences) << "Wrong number of sequences";
+  ASSERT_EQ(index.samples(), samples) << "Wrong number of samples";
+  for(size_type source = 0, seq_id = 0; source < sources.size(); source++)
+  {
+    for(size_type i = 0; i < sources[source].sequences(); i++, seq_id++)
+    {
+      EXPECT_EQ(index.extract(seq_id), sources[source].extract(i)) << "Wrong sequence " << seq_id;
+      for(edge_type pos = index.start(seq_id); pos.first != ENDMARKER; pos = index.LF(pos))
+      {
+        size_type sample = index.tryLocate(pos);
+        if(sample != invalid_sequence()) { EXPECT_EQ(sample, seq_id) << "Wrong sample at (" << pos.first << ", " << pos.second << ")"; }
+      }
+      EXPECT_EQ(index.locate(index.start(seq_id)), seq_id) << "Wrong locate() result for sequence " << seq_id;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<GBWT>
+getMergeSources(bool with_metadata)
+{
+  std::vector<GBWT> sources;
+  for(size_type i = 0; i < 4; i++)
+  {
+    if(i == 2) { sources.emplace_back(); continue; } // Empty source.
+    vector_type text;
+    for(const vector_type& path : getPaths())
+    {
+      vector_type shifted = shiftPath(path, 20 * i);
+      text.insert(text.end(), shifted.begin(), shifted.end());
+      text.push_back(ENDMARKER);
+    }
+    DynamicGBWT dynamic_index;
+    dynamic_index.insert(text, false, 1 + i);
+    sources.emplace_back(dynamic_index);
+  }
+  if(with_metadata)
+  {
+    for(size_type i = 0; i < sources.size(); i++)
+    {
+      sources[i].addMetadata();
+      sources[i].metadata.setSamples(std::vector<std::string>({ "sample" + std::to_string(i) }));
+      sources[i].metadata.setHaplotypes(1);
+    }
+  }
+  return sources;
+}
+
+void
+checkFileMerge(const std::vector<GBWT>& sources)
+{
+  std::vector<std::string> input_files;
+  for(const GBWT& source : sources)
+  {
+    input_files.push_back(TempFile::getName("gbwt"));
+    sdsl::store_to_file(source, input_files.back());
+  }
+  std::string output_file = TempFile::getName("gbwt");
+  GBWTHeader header = mergeFiles(input_files, output_file);
+
+  std::vector<GBWT> loaded(sources.size());
+  for(size_type i = 0; i < sources.size(); i++) { sdsl::load_from_file(loaded[i], input_files[i]); }
+  GBWT expected(loaded);
+  EXPECT_EQ(header, expected.header) << "Wrong header";
+  std::ifstream in(output_file, std::ios_base::binary);
+  std::string merged((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  EXPECT_EQ(merged, serializeIndex(expected)) << "The merged file differs from the in-memory merge";
+
+  for(std::string& filename : input_files) { TempFile::remove(filename); }
+  TempFile::remove(output_file);
+}
+
+TEST(FileMergeTest, Indexes)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  checkFileMerge(getMergeSources(false));
+}
+
+TEST(FileMergeTest, Metadata)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  checkFileMerge(getMergeSources(true));
+}
+
+TEST(FileMergeTest, Empty)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  checkFileMerge(std::vector<GBWT>(2));
+}
+
+TEST(FileMergeTest, TruncatedInput)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  std::vector<GBWT> sources = getMergeSources(true);
+  std::vector<std::string> input_files;
+  for(const GBWT& source : sources)
+  {
+    input_files.push_back(TempFile::getName("gbwt"));
+    sdsl::store_to_file(source, input_files.back());
+  }
+
+  // Cut the last input in half.
+  std::string serialized = serializeIndex(sources.back());
+  std::ofstream out(input_files.back(), std::ios_base::binary | std::ios_base::trunc);
+  out.write(serialized.data(), serialized.size() / 2);
+  out.close();
+
+  std::string output_file = TempFile::getName("gbwt");
+  EXPECT_EXIT(mergeFiles(input_files, output_file), ::testing::ExitedWithCode(EXIT_FAILURE), "mergeFiles\\(\\): Cannot read")
+    << "Merging a truncated input did not fail";
+
+  for(std::string& filename : input_files) { TempFile::remove(filename); }
+  TempFile::remove(output_file);
+}
+
+//------------------------------------------------------------------------------
+
+void
+checkBulk(const std::vector<vector_type>& paths, bool both_orientations, size_type sample_interval)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  size_type total_size = 0;
+  for(const vector_type& path : paths) { total_size += path.size() + 1; }
+  text_type text(total_size, 0, bit_length(Node::encode(200, true)));
+  size_type offset = 0;
+  for(const vector_type& path : paths)
+  {
+    for(auto node : path) { text[offset] = node; offset++; }
+    text[offset] = ENDMARKER; offset++;
+  }
+
+  DynamicGBWT dynamic_index;
+  dynamic_index.insert(text, both_orientations, sample_interval);
+  GBWT expected(dynamic_index);
+  GBWT index = buildBulk(text, both_orientations, sample_interval);
+
+  ASSERT_EQ(index.sequences(), expected.sequences()) << "Wrong number of sequences";
+  for(size_type i = 0; i < index.sequences(); i++)
+  {
+    EXPECT_EQ(index.extract(i), expected.extract(i)) << "Wrong sequence " << i;
+  }
+  EXPECT_EQ(serializeIndex(index), serializeIndex(expected)) << "The index differs from dynamic construction";
+}
+
+TEST(BulkConstructionTest, Paths)
+{
+  checkBulk(getExternalPaths(), false, DynamicGBWT::SAMPLE_INTERVAL);
+  checkBulk(getExternalPaths(), true, 4);
+}
+
+TEST(BulkConstructionTest, LongPaths)
+{
+  // A few long paths with repeats and long shared substrings.
+  std::vector<vector_type> paths(3);
+  for(size_type i = 0; i < 500; i++)
+  {
+    paths[0].push_back(Node::encode(1 + i % 7, false));
+    paths[1].push_back(Node::encode(1 + (i % 50 == 49 ? 100 : i % 7), false));
+    paths[2].push_back(Node::encode(1 + (i * i) % 97, false));
+  }
+  checkBulk(paths, false, DynamicGBWT::SAMPLE_INTERVAL);
+  checkBulk(paths, false, 13);
+}
+
+TEST(BulkConstructionTest, Files)
+{
+  VerbosityGuard verbosity(Verbosity::SILENT);
+  std::string filename = writeText(getExternalPaths());
+  GBWT index = buildBulk({ filename }, true, 4);
+  GBWT expected = buildExternal({ filename }, true, 4);
+  TempFile::remove(filename);
+  EXPECT_EQ(serializeIndex(index), serializeIndex(expected)) << "The index differs from external construction";
+}
+
+TEST(BulkConstructionTest, Empty)
+{
+  text_type text;
+  GBWT index = buildBulk(text);
+  EXPECT_TRUE(index.empty()) << "The index is not empty";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(ConsumingConversionTest, SameIndex)
+{
+  // Enough records for several parallel chunks.
+  std::vector<vector_type> paths;
+  for(size_type i = 0; i < 8; i++)
+  {
+    for(const vector_type& path : getExternalPaths()) { paths.push_back(shiftPath(path, 20 * i)); }
+  }
+  DynamicGBWT dynamic_index = buildDynamicGBWT(paths);
+  dynamic_index.addMetadata();
+  dynamic_index.metadata.setHaplotypes(dynamic_index.sequences() / 2);
+
+  GBWT expected(dynamic_index);
+  GBWT index(std::move(dynamic_index));
+  EXPECT_EQ(serializeIndex(index), serializeIndex(expected)) << "The index differs from the copying conversion";
+  EXPECT_EQ(index.metadata, expected.metadata) << "Wrong metadata";
+  EXPECT_TRUE(dynamic_index.empty()) << "The source was not cleared";
+  EXPECT_TRUE(dynamic_index.bwt.empty()) << "The source still has records";
+}
+
+TEST(ConsumingConversionTest, Empty)
+{
+  DynamicGBWT dynamic_index;
+  GBWT expected(dynamic_index);
+  GBWT index(std::move(dynamic_index));
+  EXPECT_TRUE(index.empty()) << "The index is not empty";
+  EXPECT_EQ(serializeIndex(index), serializeIndex(expected)) << "The index differs from the copying conversion";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(DynamicLoadTest, SameRecords)
+{
+  // Enough records for several parallel blocks, with samples in some of them.
+  std::vector<vector_type> paths;
+  for(size_type i = 0; i < 8; i++)
+  {
+    for(const vector_type& path : getExternalPaths()) { paths.push_back(shiftPath(path, 20 * i)); }
+  }
+  DynamicGBWT original = buildDynamicGBWT(paths);
+  std::stringstream data;
+  original.serialize(data);
+
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  DynamicGBWT loaded;
+  loaded.load(data);
+  omp_set_num_threads(old_threads);
+
+  ASSERT_EQ(loaded.header, original.header) << "Wrong header";
+  ASSERT_EQ(loaded.bwt.size(), original.bwt.size()) << "Wrong number of records";
+  for(size_type i = 0; i < original.bwt.size(); i++)
+  {
+    const DynamicRecord& expected = original.bwt[i];
+    const DynamicRecord& record = loaded.bwt[i];
+    EXPECT_EQ(record.size(), expected.size()) << "Wrong size for record " << i;
+    EXPECT_EQ(record.incoming, expected.incoming) << "Wrong incoming edges for record " << i;
+    EXPECT_EQ(record.outgoing, expected.outgoing) << "Wrong outgoing edges for record " << i;
+    EXPECT_EQ(record.body, expected.body) << "Wrong body for record " << i;
+    EXPECT_EQ(record.ids, expected.ids) << "Wrong samples for record " << i;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+TEST(DynamicMergeTest, SameAsInsertion)
+{
+  std::vector<vector_type> first, second;
+  for(size_type i = 0; i < 8; i++)
+  {
+    for(const vector_type& path : getExternalPaths())
+    {
+      first.push_back(shiftPath(path, 20 * i));
+      second.push_back(shiftPath(path, 20 * (i + 1)));
+    }
+  }
+  std::vector<vector_type> all = first;
+  all.insert(all.end(), second.begin(), second.end());
+  GBWT expected = buildGBWT(all);
+
+  MergeParameters parameters;
+  parameters.setPosBufferSize(1);
+  parameters.setThreadBufferSize(1);
+  parameters.setMergeJobs(5);
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  DynamicGBWT index = buildDynamicGBWT(first);
+  index.merge(buildDynamicGBWT(second), parameters);
+  omp_set_num_threads(old_threads);
+
+  EXPECT_EQ(serializeIndex(GBWT(index)), serializeIndex(expected)) << "The merged index differs from insertion";
+}
+
+TEST(DynamicMergeTest, MultipleSources)
+{
+  // Overlapping node ranges between the index and the sources and between the sources.
+  std::vector<std::vector<vector_type>> parts(4);
+  for(size_type part = 0; part < parts.size(); part++)
+  {
+    for(size_type i = 0; i < 4; i++)
+    {
+      for(const vector_type& path : getExternalPaths()) { parts[part].push_back(shiftPath(path, 20 * (i + 2 * part))); }
+    }
+  }
+  std::vector<vector_type> all;
+  for(const std::vector<vector_type>& part : parts) { all.insert(all.end(), part.begin(), part.end()); }
+  GBWT expected = buildGBWT(all);
+
+  MergeParameters parameters;
+  parameters.setPosBufferSize(1);
+  parameters.setThreadBufferSize(1);
+  parameters.setMergeJobs(5);
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  DynamicGBWT index = buildDynamicGBWT(parts[0]);
+  std::vector<DynamicGBWT> sources;
+  sources.push_back(buildDynamicGBWT(parts[1]));
+  sources.emplace_back(); // Empty source.
+  sources.push_back(buildDynamicGBWT(parts[2]));
+  sources.push_back(buildDynamicGBWT(parts[3]));
+  std::vector<const DynamicGBWT*> source_ptrs;
+  for(const DynamicGBWT& source : sources) { source_ptrs.push_back(&source); }
+  index.merge(source_ptrs, parameters);
+  omp_set_num_threads(old_threads);
+
+  EXPECT_EQ(serializeIndex(GBWT(index)), serializeIndex(expected)) << "The merged index differs from insertion";
+}
+
+//------------------------------------------------------------------------------
+
+void
+checkCompressedMerge(const std::vector<std::vector<vector_type>>& parts)
+{
+  std::vector<vector_type> all;
+  for(const std::vector<vector_type>& part : parts) { all.insert(all.end(), part.begin(), part.end()); }
+  GBWT expected = buildGBWT(all);
+
+  MergeParameters parameters;
+  parameters.setPosBufferSize(1);
+  parameters.setThreadBufferSize(1);
+  parameters.setMergeJobs(5);
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  std::vector<GBWT> sources;
+  for(size_type i = 0; i < parts.size(); i++)
+  {
+    if(i == 1) { sources.emplace_back(); } // Empty source.
+    sources.emplace_back(buildGBWT(parts[i]));
+  }
+  std::vector<const GBWT*> source_ptrs;
+  for(const GBWT& source : sources) { source_ptrs.push_back(&source); }
+  GBWT merged = mergeCompressed(source_ptrs, parameters);
+  omp_set_num_threads(old_threads);
+
+  EXPECT_EQ(serializeIndex(merged), serializeIndex(expected)) << "The merged index differs from insertion";
+}
+
+std::vector<std::vector<vector_type>>
+getOverlappingParts(bool increasing)
+{
+  std::vector<std::vector<vector_type>> parts(4);
+  for(size_type part = 0; part < parts.size(); part++)
+  {
+    size_type shift = (increasing ? part : parts.size() - 1 - part);
+    for(size_type i = 0; i < 4; i++)
+    {
+      for(const vector_type& path : getExternalPaths()) { parts[part].push_back(shiftPath(path, 20 * (i + 2 * shift))); }
+    }
+  }
+  return parts;
+}
+
+TEST(CompressedMergeTest, IncreasingNodes)
+{
+  checkCompressedMerge(getOverlappingParts(true));
+}
+
+TEST(CompressedMergeTest, DecreasingNodes)
+{
+  checkCompressedMerge(getOverlappingParts(false));
+}
+
+TEST(CompressedMergeTest, Metadata)
+{
+  std::vector<GBWT> sources = getMergeSources(true);
+  std::vector<const GBWT*> source_ptrs;
+  for(const GBWT& source : sources) { source_ptrs.push_back(&source); }
+  GBWT merged = mergeCompressed(source_ptrs, MergeParameters());
+
+  // Empty sources are ignored.
+  Metadata expected = sources.front().metadata;
+  for(size_type i = 1; i < sources.size(); i++)
+  {
+    if(!(sources[i].empty())) { expected.merge(sources[i].metadata, false, true); }
+  }
+  ASSERT_TRUE(merged.hasMetadata()) << "The merged index has no metadata";
+  EXPECT_EQ(merged.metadata, expected) << "Wrong merged metadata";
+}
+
+TEST(CompressedMergeTest, Empty)
+{
+  std::vector<GBWT> sources(2);
+  std::vector<const GBWT*> source_ptrs;
+  for(const GBWT& source : sources) { source_ptrs.push_back(&source); }
+  GBWT merged = mergeCompressed(source_ptrs, MergeParameters());
+  EXPECT_TRUE(merged.empty()) << "The merged index is not empty";
+}
+
+TEST(CompressedMergeTest, ProgressRecords)
+{
+  std::vector<std::vector<vector_type>> parts = getOverlappingParts(true);
+  std::vector<vector_type> all;
+  for(const std::vector<vector_type>& part : parts) { all.insert(all.end(), part.begin(), part.end()); }
+  GBWT expected = buildGBWT(all);
+  size_type nonempty = 0;
+  for(comp_type comp = 0; comp < expected.effective(); comp++)
+  {
+    if(expected.record(expected.toNode(comp)).outdegree() > 0) { nonempty++; }
+  }
+
+  // Both algorithms count the non-empty merged records.
+  std::vector<GBWT> sources;
+  std::vector<DynamicGBWT> dynamic_sources;
+  for(const std::vector<vector_type>& part : parts)
+  {
+    sources.emplace_back(buildGBWT(part));
+    dynamic_sources.emplace_back(buildDynamicGBWT(part));
+  }
+  std::vector<const GBWT*> source_ptrs;
+  for(const GBWT& source : sources) { source_ptrs.push_back(&source); }
+  std::vector<const DynamicGBWT*> dynamic_ptrs;
+  for(const DynamicGBWT& source : dynamic_sources) { dynamic_ptrs.push_back(&source); }
+
+  size_type before = MergeProgress::records.load();
+  GBWT merged = mergeCompressed(source_ptrs, MergeParameters());
+  size_type compressed_records = MergeProgress::records.load() - before;
+  EXPECT_EQ(compressed_records, nonempty) << "mergeCompressed() reported " << compressed_records << " records, expected " << nonempty;
+
+  before = MergeProgress::records.load();
+  DynamicGBWT index;
+  index.merge(dynamic_ptrs, MergeParameters());
+  size_type dynamic_records = MergeProgress::records.load() - before;
+  EXPECT_EQ(dynamic_records, nonempty) << "DynamicGBWT::merge() reported " << dynamic_records << " records, expected " << nonempty;
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace
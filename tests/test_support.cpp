@@ -24,8 +24,12 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <map>
 #include <random>
+#include <thread>
 
+#include <gbwt/internal.h>
 #include <gbwt/support.h>
 
 using namespace gbwt;
@@ -220,6 +224,89 @@ TEST(DictionaryTest, Merging)
   }
 }
 
+TEST(DictionaryTest, MultipleSources)
+{
+  std::vector<std::vector<std::string>> source_keys
+  {
+    { "first", "second", "third" },
+    { },
+    { "fifth", "first", "fourth" },
+    { "sixth", "fourth", "second" }
+  };
+  std::vector<std::string> keys
+  {
+    "first", "second", "third", "fifth", "fourth", "sixth"
+  };
+
+  std::vector<Dictionary> sources;
+  for(const std::vector<std::string>& source : source_keys) { sources.emplace_back(source); }
+  std::vector<const Dictionary*> source_ptrs;
+  for(const Dictionary& source : sources) { source_ptrs.push_back(&source); }
+  source_ptrs.push_back(nullptr);
+  std::vector<std::vector<size_type>> mappings;
+  Dictionary merged(source_ptrs, mappings);
+
+  EXPECT_EQ(merged, Dictionary(keys)) << "The merged dictionary is incorrect";
+  ASSERT_EQ(mappings.size(), source_ptrs.size()) << "Expected " << source_ptrs.size() << " mappings, got " << mappings.size();
+  bool ok = true;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    ok &= (mappings[i].size() == sources[i].size());
+    for(size_type j = 0; ok && j < sources[i].size(); j++)
+    {
+      ok &= (merged[mappings[i][j]] == sources[i][j]);
+    }
+  }
+  ok &= mappings.back().empty();
+  EXPECT_TRUE(ok) << "The mappings are incorrect";
+
+  // A single source is copied.
+  std::vector<const Dictionary*> single { nullptr, &(sources.front()) };
+  Dictionary copied(single, mappings);
+  EXPECT_EQ(copied, sources.front()) << "A single source was not copied";
+}
+
+TEST(DictionaryTest, DuplicatesInLaterSource)
+{
+  std::vector<std::vector<std::string>> source_keys
+  {
+    { "first", "second", "first" },
+    { "third", "second", "third" },
+    { "fourth", "third", "fourth" }
+  };
+
+  // Compare to repeated pairwise merging.
+  std::vector<Dictionary> sources;
+  for(const std::vector<std::string>& source : source_keys) { sources.emplace_back(source); }
+  Dictionary pairwise = sources.front();
+  for(size_type i = 1; i < sources.size(); i++) { pairwise = Dictionary(pairwise, sources[i]); }
+  std::vector<const Dictionary*> source_ptrs;
+  for(const Dictionary& source : sources) { source_ptrs.push_back(&source); }
+  std::vector<std::vector<size_type>> mappings;
+  Dictionary merged(source_ptrs, mappings);
+
+  EXPECT_EQ(merged, pairwise) << "The result differs from pairwise merging";
+  EXPECT_EQ(merged.size(), static_cast<size_type>(7)) << "Expected 7 keys, got " << merged.size();
+  bool ok = true;
+  for(size_type i = 0; i < sources.size(); i++)
+  {
+    for(size_type j = 0; j < sources[i].size(); j++)
+    {
+      ok &= (merged[mappings[i][j]] == sources[i][j]);
+    }
+  }
+  EXPECT_TRUE(ok) << "The mappings are incorrect";
+
+  // The keys of the later sources are mapped to the first copy.
+  std::vector<std::vector<size_type>> expected_mappings
+  {
+    { 0, 1, 2 },
+    { 3, 1, 3 },
+    { 5, 3, 5 }
+  };
+  EXPECT_EQ(mappings, expected_mappings) << "The mappings do not point to the first copies";
+}
+
 TEST(DictionaryTest, Serialization)
 {
   std::vector<std::string> keys
@@ -239,4 +326,244 @@ TEST(DictionaryTest, Serialization)
 
 //------------------------------------------------------------------------------
 
+// Sequences sorted by curr, with increasing offsets for each (curr, next).
+std::vector<Sequence>
+getSequences(size_type n, node_type max_node, size_type seed = 0xDEADBEEF)
+{
+  std::mt19937_64 rng(seed);
+  std::vector<Sequence> result(n);
+  std::map<node_type, size_type> ranks;
+  for(size_type i = 0; i < n; i++)
+  {
+    result[i].id = i;
+    result[i].curr = i / 16;
+    result[i].next = rng() % (max_node + 1);
+    result[i].pos = rng();
+    if(i > 0 && result[i].curr != result[i - 1].curr) { ranks.clear(); }
+    result[i].offset = ranks[result[i].next]++;
+  }
+  return result;
+}
+
+void
+checkRadixSort(size_type n, node_type max_node, int threads)
+{
+  std::vector<Sequence> seqs = getSequences(n, max_node);
+  std::vector<Sequence> truth = seqs;
+  sequentialSort(truth.begin(), truth.end());
+
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(threads);
+  SequenceRadixSort::sort(seqs);
+  omp_set_num_threads(old_threads);
+
+  ASSERT_EQ(seqs.size(), truth.size()) << "Wrong number of sequences with n = " << n << ", max_node = " << max_node;
+  bool ok = true;
+  for(size_type i = 0; i < seqs.size(); i++)
+  {
+    ok &= (seqs[i].id == truth[i].id && seqs[i].pos == truth[i].pos);
+  }
+  EXPECT_TRUE(ok) << "Wrong order with n = " << n << ", max_node = " << max_node << ", threads = " << threads;
+}
+
+TEST(SequenceRadixSortTest, Small)
+{
+  checkRadixSort(0, 100, 1);
+  checkRadixSort(1, 100, 1);
+  checkRadixSort(1000, 0, 1);
+  checkRadixSort(1000, 100, 1);
+  checkRadixSort(1000, 100000, 1);
+}
+
+TEST(SequenceRadixSortTest, Parallel)
+{
+  size_type n = 2 * SequenceRadixSort::PARALLEL_THRESHOLD;
+  checkRadixSort(n, 100, 4);
+  checkRadixSort(n, 100000, 4);
+  checkRadixSort(n, 10000000, 4);
+}
+
+//------------------------------------------------------------------------------
+
+void
+checkFrameCode(size_type width, size_type n)
+{
+  std::mt19937_64 rng(width * FrameCode::FRAME_SIZE + n);
+  std::vector<size_type> values(n);
+  for(size_type& value : values)
+  {
+    value = (width == 0 ? 0 : (width >= 64 ? rng() : rng() % (static_cast<size_type>(1) << width)));
+  }
+  if(n > 0 && width > 0) { values[n / 2] |= static_cast<size_type>(1) << (width - 1); } // Use the full width.
+
+  // Write the frame twice to check that it ends in the right place.
+  std::vector<byte_type> data;
+  FrameCode::write(data, values.data(), n);
+  FrameCode::write(data, values.data(), n);
+  size_type frame_bytes = 1 + (n * width + BYTE_BITS - 1) / BYTE_BITS;
+  ASSERT_EQ(data.size(), 2 * frame_bytes) << "Wrong encoding size with width " << width << ", n = " << n;
+
+  size_type i = 0;
+  for(size_type frame = 0; frame < 2; frame++)
+  {
+    std::vector<size_type> decoded(n);
+    FrameCode::read(data, i, decoded.data(), n);
+    EXPECT_EQ(decoded, values) << "Wrong values in frame " << frame << " with width " << width << ", n = " << n;
+  }
+  EXPECT_EQ(i, data.size()) << "Wrong final offset with width " << width << ", n = " << n;
+}
+
+TEST(FrameCodeTest, Widths)
+{
+  for(size_type width = 0; width <= 64; width++)
+  {
+    checkFrameCode(width, FrameCode::FRAME_SIZE);
+    checkFrameCode(width, 37);
+  }
+  checkFrameCode(13, 1);
+}
+
+//------------------------------------------------------------------------------
+
+// Allocates the given number of blocks of the largest pooled size.
+std::vector<void*>
+allocateBlocks(size_type n)
+{
+  std::vector<void*> blocks;
+  for(size_type i = 0; i < n; i++) { blocks.push_back(RecordPool::allocate(RecordPool::MAX_POOLED_BYTES)); }
+  return blocks;
+}
+
+void
+deallocateBlocks(std::vector<void*>& blocks)
+{
+  for(void* block : blocks) { RecordPool::deallocate(block, RecordPool::MAX_POOLED_BYTES); }
+  blocks.clear();
+}
+
+// Number of blocks of the largest pooled size in a slab.
+constexpr size_type SLAB_BLOCKS = RecordPool::SLAB_SIZE / RecordPool::MAX_POOLED_BYTES;
+
+TEST(RecordPoolTest, AllocateAndDeallocate)
+{
+  RecordPool::release();
+
+  // Freed blocks are reused for the same size class.
+  void* block = RecordPool::allocate(40);
+  ASSERT_NE(block, nullptr) << "Allocation failed";
+  std::fill_n(static_cast<char*>(block), 40, 'x');
+  RecordPool::deallocate(block, 40);
+  EXPECT_EQ(RecordPool::allocate(64), block) << "A freed block was not reused";
+  RecordPool::deallocate(block, 64);
+  EXPECT_EQ(RecordPool::reservedBytes(), RecordPool::SLAB_SIZE) << "Wrong amount of memory reserved";
+
+  // Large allocations bypass the pool.
+  void* large = RecordPool::allocate(2 * RecordPool::MAX_POOLED_BYTES);
+  ASSERT_NE(large, nullptr) << "Large allocation failed";
+  RecordPool::deallocate(large, 2 * RecordPool::MAX_POOLED_BYTES);
+  EXPECT_EQ(RecordPool::reservedBytes(), RecordPool::SLAB_SIZE) << "A large allocation used the pool";
+
+  // The allocator works with vectors.
+  std::vector<size_type, RecordAllocator<size_type>> values;
+  for(size_type i = 0; i < 1000; i++) { values.push_back(i); }
+  bool ok = true;
+  for(size_type i = 0; i < values.size(); i++) { ok &= (values[i] == i); }
+  EXPECT_TRUE(ok) << "Wrong values in a pooled vector";
+}
+
+TEST(RecordPoolTest, CrossThreadFree)
+{
+  RecordPool::release();
+
+  // Blocks allocated in one thread and freed in another end up in the depot.
+  std::vector<void*> blocks;
+  std::thread allocator([&blocks]() { blocks = allocateBlocks(SLAB_BLOCKS / 2); });
+  allocator.join();
+  std::thread deallocator([&blocks]() { deallocateBlocks(blocks); });
+  deallocator.join();
+
+  blocks = allocateBlocks(SLAB_BLOCKS);
+  EXPECT_EQ(RecordPool::reservedBytes(), RecordPool::SLAB_SIZE) << "The freed blocks were not reused";
+  deallocateBlocks(blocks);
+}
+
+TEST(RecordPoolTest, DepotTransfer)
+{
+  RecordPool::release();
+
+  // A thread with too many free blocks returns some of them to the depot, where another
+  // thread can use them while the first thread is still running.
+  size_type reserved = 0;
+  std::thread owner([&reserved]()
+  {
+    std::vector<void*> blocks = allocateBlocks(4 * RecordPool::TRANSFER_SIZE);
+    deallocateBlocks(blocks);
+    std::thread another([&reserved]()
+    {
+      std::vector<void*> blocks = allocateBlocks(2 * RecordPool::TRANSFER_SIZE);
+      reserved = RecordPool::reservedBytes();
+      deallocateBlocks(blocks);
+    });
+    another.join();
+  });
+  owner.join();
+  EXPECT_EQ(reserved, RecordPool::SLAB_SIZE) << "The blocks were not transferred to the depot";
+}
+
+// Uses the pool after the thread-local pool has been destroyed.
+std::atomic<bool> late_allocation_ok(false);
+
+struct LatePoolUser
+{
+  bool active = false;
+
+  ~LatePoolUser()
+  {
+    if(!(this->active)) { return; }
+    void* block = RecordPool::allocate(100);
+    if(block != nullptr)
+    {
+      std::fill_n(static_cast<char*>(block), 100, 'x');
+      RecordPool::deallocate(block, 100);
+      late_allocation_ok = true;
+    }
+  }
+};
+
+thread_local LatePoolUser late_pool_user;
+
+TEST(RecordPoolTest, LocalPoolDestroyed)
+{
+  RecordPool::release();
+  late_allocation_ok = false;
+
+  // The thread-local pool is constructed after the user, so it is destroyed first.
+  std::thread user([]()
+  {
+    late_pool_user.active = true;
+    std::vector<void*> blocks = allocateBlocks(1);
+    deallocateBlocks(blocks);
+  });
+  user.join();
+  EXPECT_TRUE(late_allocation_ok.load()) << "Allocation failed after the thread-local pool was destroyed";
+}
+
+TEST(RecordPoolTest, Release)
+{
+  RecordPool::release();
+
+  std::vector<void*> blocks = allocateBlocks(SLAB_BLOCKS + 1);
+  deallocateBlocks(blocks);
+  EXPECT_EQ(RecordPool::release(), 2 * RecordPool::SLAB_SIZE) << "Wrong number of bytes released";
+  EXPECT_EQ(RecordPool::reservedBytes(), 0u) << "Memory still reserved after release";
+
+  // The free lists of the thread are discarded, and new blocks come from a new slab.
+  blocks = allocateBlocks(1);
+  EXPECT_EQ(RecordPool::reservedBytes(), RecordPool::SLAB_SIZE) << "The pool was not reused after release";
+  deallocateBlocks(blocks);
+  RecordPool::release();
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace
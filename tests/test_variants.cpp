@@ -22,10 +22,12 @@
   SOFTWARE.
 */
 
+#include <memory>
 #include <set>
 
 #include <gtest/gtest.h>
 
+#include <gbwt/dynamic_gbwt.h>
 #include <gbwt/variants.h>
 
 using namespace gbwt;
@@ -52,12 +54,19 @@ public:
   VariantPaths variants;
   PhasingInformation phasings;
   size_type allele_count, num_samples;
+  size_type old_verbosity;
 
-  VariantTest()
+  VariantTest() :
+    old_verbosity(gbwt::Verbosity::level)
   {
     gbwt::Verbosity::set(gbwt::Verbosity::SILENT);
   }
 
+  ~VariantTest()
+  {
+    gbwt::Verbosity::set(this->old_verbosity);
+  }
+
   void SetUp() override
   {
     const VariantTestData& data = GetParam();
@@ -330,4 +339,139 @@ TEST(PhasingTest, ForcePhasing)
 
 //------------------------------------------------------------------------------
 
+// Parses of contigs with disjoint node ranges, with embedded phasings for three samples.
+class ContigTest : public ::testing::Test
+{
+public:
+  constexpr static size_type CONTIGS = 3;
+  constexpr static size_type SAMPLES = 3;
+
+  std::vector<std::unique_ptr<PhasingInformation>> phasings;
+  std::vector<std::string> parse_files;
+  ContigParameters parameters;
+  size_type old_verbosity;
+
+  ContigTest() :
+    old_verbosity(gbwt::Verbosity::level)
+  {
+    gbwt::Verbosity::set(gbwt::Verbosity::SILENT);
+    parameters = { 64, 4, true, false, false, std::set<std::string>() };
+  }
+
+  ~ContigTest()
+  {
+    gbwt::Verbosity::set(this->old_verbosity);
+  }
+
+  void SetUp() override
+  {
+    for(size_type contig = 0; contig < CONTIGS; contig++)
+    {
+      size_type offset = 20 * contig;
+      VariantPaths variants(6);
+      for(size_type i = 1; i <= 6; i++) { variants.appendToReference(Node::encode(offset + i, false)); }
+      variants.addSite(1, 2);
+      variants.addAllele(vector_type(1, static_cast<vector_type::value_type>(Node::encode(offset + 10, false))));
+      variants.addSite(3, 5);
+      variants.addAllele(vector_type(1, static_cast<vector_type::value_type>(Node::encode(offset + 11, false))));
+      variants.addAllele(vector_type());
+      variants.setSampleNames({ "A", "B", "C" });
+      variants.setContigName("contig" + std::to_string(contig));
+
+      phasings.emplace_back(new PhasingInformation(0, SAMPLES));
+      phasings.back()->append({ Phasing(1, 0, true), Phasing(0, 0, true), Phasing(1) });
+      phasings.back()->append({ Phasing(2, 1, true), Phasing(0, 1, true), Phasing(contig % 3) });
+      phasings.back()->close();
+      variants.addFile(phasings.back()->name(), phasings.back()->offset(), phasings.back()->size());
+
+      parse_files.push_back(TempFile::getName("parse"));
+      sdsl::store_to_file(variants, parse_files.back());
+    }
+  }
+
+  void TearDown() override
+  {
+    for(std::string& filename : parse_files) { TempFile::remove(filename); }
+  }
+
+  // Sequential construction with a single GBWTBuilder, as in build_gbwt.
+  GBWT buildSequential() const
+  {
+    GBWTBuilder builder(bit_length(Node::encode(20 * CONTIGS, true)), parameters.batch_size, parameters.sample_interval);
+    builder.index.addMetadata();
+    std::set<range_type> haplotypes;
+    std::vector<std::string> sample_names, contig_names;
+    for(size_type contig = 0; contig < parse_files.size(); contig++)
+    {
+      VariantPaths variants;
+      sdsl::load_from_file(variants, parse_files[contig]);
+      if(contig == 0) { sample_names = variants.getSampleNames(); }
+      contig_names.emplace_back(variants.getContigName());
+      generateHaplotypes(variants, parameters.phasing_files,
+        [](size_type) -> bool { return true; },
+        [&](const Haplotype& haplotype)
+        {
+          builder.insert(haplotype.path, parameters.both_orientations);
+          haplotypes.insert(range_type(haplotype.sample, haplotype.phase));
+          builder.index.metadata.addPath({
+            static_cast<PathName::path_name_type>(haplotype.sample),
+            static_cast<PathName::path_name_type>(contig),
+            static_cast<PathName::path_name_type>(haplotype.phase),
+            static_cast<PathName::path_name_type>(haplotype.count)
+          });
+        },
+        [&](size_type, size_type) -> bool { return parameters.skip_overlaps; });
+    }
+    builder.finish();
+    builder.index.metadata.setSamples(sample_names);
+    builder.index.metadata.setHaplotypes(haplotypes.size());
+    builder.index.metadata.setContigs(contig_names);
+    return GBWT(builder.index);
+  }
+
+  void checkIndex(const GBWT& index, const GBWT& expected, const std::string& test_name) const
+  {
+    ASSERT_EQ(index.sequences(), expected.sequences()) << test_name << ": Wrong number of sequences";
+    bool ok = true;
+    for(size_type i = 0; i < index.sequences(); i++) { ok &= (index.extract(i) == expected.extract(i)); }
+    EXPECT_TRUE(ok) << test_name << ": Wrong sequences";
+    ASSERT_TRUE(index.hasMetadata()) << test_name << ": No metadata";
+    EXPECT_EQ(index.metadata, expected.metadata) << test_name << ": The metadata differs from sequential construction";
+  }
+};
+
+constexpr size_type ContigTest::CONTIGS;
+constexpr size_type ContigTest::SAMPLES;
+
+TEST_F(ContigTest, SameAsSequential)
+{
+  GBWT expected = buildSequential();
+  ASSERT_TRUE(expected.metadata.hasPathNames()) << "No path names in sequential construction";
+  checkIndex(buildContigs(parse_files, parameters, 1, 0), expected, "One job");
+  checkIndex(buildContigs(parse_files, parameters, CONTIGS, 0), expected, "Multiple jobs");
+}
+
+TEST_F(ContigTest, MemoryBudget)
+{
+  // A contig is always started when nothing else is in flight.
+  GBWT expected = buildSequential();
+  checkIndex(buildContigs(parse_files, parameters, CONTIGS, 1), expected, "Small budget");
+}
+
+TEST_F(ContigTest, MemoryEstimate)
+{
+  VariantPaths variants;
+  sdsl::load_from_file(variants, parse_files.front());
+  size_type buffers = 2 * (parameters.batch_size * variants.nodeWidth(parameters.both_orientations)) / BYTE_BITS;
+  size_type estimate = estimateContigMemory(variants, parameters);
+  EXPECT_GT(estimate, sdsl::size_in_bytes(variants) + buffers) << "The estimate does not include the dynamic index";
+
+  // Selecting no phasing files leaves only the records.
+  ContigParameters no_files = parameters;
+  no_files.phasing_files.insert("missing");
+  EXPECT_LT(estimateContigMemory(variants, no_files), estimate) << "The estimate does not depend on the haplotypes";
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace
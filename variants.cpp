@@ -23,9 +23,13 @@
 */
 
 #include <gbwt/variants.h>
+#include <gbwt/dynamic_gbwt.h>
 #include <gbwt/internal.h>
 
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 
 namespace gbwt
 {
@@ -890,4 +894,193 @@ generateHaplotypes(const VariantPaths& variants, const std::set<std::string>& ph
 
 //------------------------------------------------------------------------------
 
+struct ContigBuild
+{
+  VariantPaths          variants;
+  size_type             memory;
+  GBWT                  index;
+  std::vector<PathName> paths;
+  std::set<size_type>   samples;
+  std::set<range_type>  haplotypes;
+  std::set<range_type>  overlaps;
+};
+
+void
+buildContig(ContigBuild& contig, size_type contig_id, const ContigParameters& parameters)
+{
+  GBWTBuilder builder(contig.variants.nodeWidth(parameters.both_orientations), parameters.batch_size, parameters.sample_interval);
+  generateHaplotypes(contig.variants, parameters.phasing_files,
+    [](size_type) -> bool { return true; },
+    [&](const Haplotype& haplotype)
+    {
+      builder.insert(haplotype.path, parameters.both_orientations);
+      contig.samples.insert(haplotype.sample);
+      contig.haplotypes.insert(range_type(haplotype.sample, haplotype.phase));
+      contig.paths.push_back({
+        static_cast<PathName::path_name_type>(haplotype.sample),
+        static_cast<PathName::path_name_type>(contig_id),
+        static_cast<PathName::path_name_type>(haplotype.phase),
+        static_cast<PathName::path_name_type>(haplotype.count)
+      });
+    },
+    [&](size_type site, size_type allele) -> bool
+    {
+      if(parameters.check_overlaps) { contig.overlaps.insert(range_type(site, allele)); }
+      return parameters.skip_overlaps;
+    });
+  builder.finish();
+  contig.index = GBWT(std::move(builder.index));
+  VariantPaths empty;
+  contig.variants = std::move(empty);
+}
+
+size_type
+estimateContigMemory(const VariantPaths& variants, const ContigParameters& parameters)
+{
+  size_type orientations = (parameters.both_orientations ? 2 : 1);
+  size_type haplotypes = 0;
+  for(size_type file = 0; file < variants.files(); file++)
+  {
+    if(parameters.phasing_files.empty() || parameters.phasing_files.find(variants.name(file)) != parameters.phasing_files.end())
+    {
+      haplotypes += 2 * variants.count(file);
+    }
+  }
+  haplotypes *= orientations;
+
+  // Records with incoming and outgoing edges, runs, and samples in the dynamic index.
+  size_type records = orientations * (variants.size() + variants.alt_paths.size());
+  size_type runs = records + haplotypes * (2 * variants.sites() + 1);
+  size_type samples = haplotypes;
+  if(parameters.sample_interval > 0) { samples += haplotypes * (variants.size() / parameters.sample_interval); }
+  size_type dynamic_index = records * (sizeof(DynamicRecord) + 2 * sizeof(edge_type)) +
+    runs * sizeof(run_type) + samples * sizeof(sample_type);
+
+  return sdsl::size_in_bytes(variants) +
+    2 * (parameters.batch_size * variants.nodeWidth(parameters.both_orientations)) / BYTE_BITS +
+    2 * dynamic_index;
+}
+
+// Size of the file or 0 if it cannot be opened.
+size_type
+parseFileSize(const std::string& filename)
+{
+  std::ifstream in(filename, std::ios_base::binary);
+  if(!in) { return 0; }
+  return fileSize(in);
+}
+
+GBWT
+buildContigs(const std::vector<std::string>& parse_files, const ContigParameters& parameters,
+             size_type max_jobs, size_type memory_budget)
+{
+  std::vector<ContigBuild> contigs(parse_files.size());
+  bool use_sample_names = true, use_contig_names = true;
+  std::vector<std::string> sample_names, contig_names;
+
+  std::mutex mtx;
+  std::condition_variable finished;
+  size_type in_flight = 0, reserved = 0;
+  std::vector<std::thread> workers;
+
+  // Split the OpenMP threads between the contigs in flight.
+  size_type concurrent_jobs = Range::bound(max_jobs, 1, parse_files.size());
+  int worker_threads = std::max(1, static_cast<int>(omp_get_max_threads() / concurrent_jobs));
+  for(size_type contig_id = 0; contig_id < parse_files.size(); contig_id++)
+  {
+    const std::string& parse_file = parse_files[contig_id];
+    ContigBuild& contig = contigs[contig_id];
+
+    // Wait until there is room for loading the parse. Its size in memory is close to the
+    // size of the file.
+    size_type file_size = parseFileSize(parse_file);
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      finished.wait(lock, [&]()
+      {
+        return (in_flight == 0 || memory_budget == 0 || reserved + file_size <= memory_budget);
+      });
+      reserved += file_size;
+    }
+
+    if(!sdsl::load_from_file(contig.variants, parse_file))
+    {
+      std::cerr << "buildContigs(): Cannot load variants from " << parse_file << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    use_sample_names &= contig.variants.hasSampleNames();
+    if(use_sample_names && contig_id == 0) { sample_names = contig.variants.getSampleNames(); }
+    use_contig_names &= contig.variants.hasContigName();
+    if(use_contig_names) { contig_names.emplace_back(contig.variants.getContigName()); }
+    if(parameters.check_overlaps) { checkOverlaps(contig.variants, std::cerr, true); }
+    contig.memory = std::max(estimateContigMemory(contig.variants, parameters), file_size);
+
+    // Wait until there is room for the contig. The loaded parse is already reserved.
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      finished.wait(lock, [&]()
+      {
+        if(in_flight == 0) { return true; }
+        return (in_flight < max_jobs && (memory_budget == 0 || reserved - file_size + contig.memory <= memory_budget));
+      });
+      in_flight++; reserved += contig.memory - file_size;
+      if(Verbosity::level >= Verbosity::BASIC)
+      {
+        std::cerr << "buildContigs(): Building contig " << contig_id << " from " << parse_file << std::endl;
+      }
+    }
+
+    // The finished contig keeps its compressed index until the merge.
+    workers.emplace_back([&, contig_id]()
+    {
+      omp_set_num_threads(worker_threads);
+      buildContig(contigs[contig_id], contig_id, parameters);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        in_flight--; reserved -= contigs[contig_id].memory;
+        reserved += sdsl::size_in_bytes(contigs[contig_id].index);
+      }
+      finished.notify_all();
+    });
+  }
+  for(std::thread& worker : workers) { worker.join(); }
+
+  // Merge the contigs and report the overlaps in input order.
+  std::vector<GBWT> sources;
+  std::set<size_type> samples;
+  std::set<range_type> haplotypes;
+  for(ContigBuild& contig : contigs)
+  {
+    if(parameters.check_overlaps && !contig.overlaps.empty())
+    {
+      std::cerr << contig.overlaps.size() << " unresolved overlaps:" << std::endl;
+      for(range_type overlap : contig.overlaps)
+      {
+        std::cerr << "- site " << overlap.first << ", allele " << overlap.second << std::endl;
+      }
+    }
+    samples.insert(contig.samples.begin(), contig.samples.end());
+    haplotypes.insert(contig.haplotypes.begin(), contig.haplotypes.end());
+    sources.emplace_back(std::move(contig.index));
+  }
+  GBWT index(sources);
+  sources.clear();
+
+  // Set the metadata in the same order as in sequential construction.
+  index.addMetadata();
+  for(const ContigBuild& contig : contigs)
+  {
+    for(const PathName& path : contig.paths) { index.metadata.addPath(path); }
+  }
+  if(use_sample_names) { index.metadata.setSamples(sample_names); }
+  else { index.metadata.setSamples(samples.size()); }
+  index.metadata.setHaplotypes(haplotypes.size());
+  if(use_contig_names) { index.metadata.setContigs(contig_names); }
+  else { index.metadata.setContigs(parse_files.size()); }
+
+  return index;
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwt